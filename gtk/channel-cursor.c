@@ -25,6 +25,10 @@
 #include "spice-channel-cache.h"
 #include "spice-marshal.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /**
  * SECTION:channel-cursor
  * @short_description: update cursor shape and position
@@ -50,12 +54,24 @@ struct display_cursor {
     SpiceCursorHeader           hdr;
     gboolean                    default_cursor;
     int                         refcount;
+    gpointer                    user_data;
+    GDestroyNotify              user_data_destroy;
     guint32                     data[];
 };
 
 struct _SpiceCursorChannelPrivate {
     display_cache               *cursors;
+    display_cursor              *current;
     gboolean                    init_done;
+    guint                       cache_hits;
+    guint                       cache_misses;
+};
+
+/* Properties */
+enum {
+    PROP_0,
+    PROP_CACHE_HITS,
+    PROP_CACHE_MISSES,
 };
 
 enum {
@@ -86,6 +102,26 @@ static void spice_cursor_channel_init(SpiceCursorChannel *channel)
     c->cursors = cache_new((GDestroyNotify)display_cursor_unref);
 }
 
+static void spice_cursor_channel_get_property(GObject    *object,
+                                              guint       prop_id,
+                                              GValue     *value,
+                                              GParamSpec *pspec)
+{
+    SpiceCursorChannelPrivate *c = SPICE_CURSOR_CHANNEL(object)->priv;
+
+    switch (prop_id) {
+    case PROP_CACHE_HITS:
+        g_value_set_uint(value, c->cache_hits);
+        break;
+    case PROP_CACHE_MISSES:
+        g_value_set_uint(value, c->cache_misses);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+}
+
 static void spice_cursor_channel_finalize(GObject *obj)
 {
     SpiceCursorChannel *channel = SPICE_CURSOR_CHANNEL(obj);
@@ -114,8 +150,44 @@ static void spice_cursor_channel_class_init(SpiceCursorChannelClass *klass)
     SpiceChannelClass *channel_class = SPICE_CHANNEL_CLASS(klass);
 
     gobject_class->finalize     = spice_cursor_channel_finalize;
+    gobject_class->get_property = spice_cursor_channel_get_property;
     channel_class->channel_reset = spice_cursor_channel_reset;
 
+    /**
+     * SpiceCursorChannel:cache-hits:
+     *
+     * Number of cursor shapes that were taken from the cursor cache,
+     * without any conversion. The data attached with
+     * spice_cursor_channel_set_cursor_data() is reused along with them.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_CACHE_HITS,
+         g_param_spec_uint("cache-hits",
+                           "Cache hits",
+                           "Cursors taken from the cache",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READABLE |
+                           G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceCursorChannel:cache-misses:
+     *
+     * Number of cursor shapes that had to be converted, or that were
+     * missing from the cursor cache.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_CACHE_MISSES,
+         g_param_spec_uint("cache-misses",
+                           "Cache misses",
+                           "Cursors converted or missing from the cache",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READABLE |
+                           G_PARAM_STATIC_STRINGS));
+
     /**
      * SpiceCursorChannel::cursor-set:
      * @cursor: the #SpiceCursorChannel that emitted the signal
@@ -258,6 +330,39 @@ static guint32 get_pix_hack(gint pix_index, gint width)
     return (((pix_index % width) ^ (pix_index / width)) & 1) ? 0xc0303030 : 0x30505050;
 }
 
+/* Swap the red and blue channels of @n pixels, from the native-endian
+ * ARGB words of the protocol to the RGBA bytes of the signal. @dest
+ * and @src may be the same. */
+static void argb_to_rgba(guint32 *dest, const guint8 *src, gint n)
+{
+    gint i = 0;
+
+#ifdef __SSE2__
+    const __m128i ag = _mm_set1_epi32(0xff00ff00);
+    const __m128i ff = _mm_set1_epi32(0x000000ff);
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        __m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), ff);
+        __m128i b = _mm_slli_epi32(_mm_and_si128(v, ff), 16);
+
+        v = _mm_or_si128(_mm_and_si128(v, ag), _mm_or_si128(r, b));
+        _mm_storeu_si128((__m128i *)(dest + i), v);
+    }
+#endif
+
+    for (; i < n; i++) {
+        guint32 p;
+
+        memcpy(&p, src + i * 4, sizeof(p));
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+        dest[i] = (p & 0xff00ff00) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+#else
+        dest[i] = (p & 0x00ff00ff) | ((p >> 16) & 0xff00) | ((p & 0xff00) << 16);
+#endif
+    }
+}
+
 static display_cursor * display_cursor_ref(display_cursor *cursor)
 {
     g_return_val_if_fail(cursor != NULL, NULL);
@@ -273,8 +378,11 @@ static void display_cursor_unref(display_cursor *cursor)
     g_return_if_fail(cursor->refcount > 0);
 
     cursor->refcount--;
-    if (cursor->refcount == 0)
+    if (cursor->refcount == 0) {
+        if (cursor->user_data_destroy)
+            cursor->user_data_destroy(cursor->user_data);
         g_free(cursor);
+    }
 }
 
 static const char *cursor_type_to_string(int type)
@@ -302,8 +410,6 @@ static display_cursor *set_cursor(SpiceChannel *channel, SpiceCursor *scursor)
     size_t size;
     gint i, pix_mask, pix;
     const guint8* data;
-    guint8 *rgba;
-    guint8 val;
 
     CHANNEL_DEBUG(channel, "%s: flags %d, size %d", __FUNCTION__,
                   scursor->flags, scursor->data_size);
@@ -317,11 +423,16 @@ static display_cursor *set_cursor(SpiceChannel *channel, SpiceCursor *scursor)
 
     if (scursor->flags & SPICE_CURSOR_FLAGS_FROM_CACHE) {
         cursor = cache_find(c->cursors, hdr->unique);
-        g_return_val_if_fail(cursor != NULL, NULL);
+        if (cursor == NULL) {
+            c->cache_misses++;
+            g_return_val_if_reached(NULL);
+        }
+        c->cache_hits++;
         return display_cursor_ref(cursor);
     }
 
     g_return_val_if_fail(scursor->data_size != 0, NULL);
+    c->cache_misses++;
 
     size = 4u * hdr->width * hdr->height;
     cursor = g_malloc0(sizeof(*cursor) + size);
@@ -335,11 +446,22 @@ static display_cursor *set_cursor(SpiceChannel *channel, SpiceCursor *scursor)
         mono_cursor(cursor, data);
         break;
     case SPICE_CURSOR_TYPE_ALPHA:
-        memcpy(cursor->data, data, size);
-        break;
+        /* no need to go through the copy */
+        argb_to_rgba(cursor->data, data, hdr->width * hdr->height);
+        goto cache_add;
     case SPICE_CURSOR_TYPE_COLOR32:
         memcpy(cursor->data, data, size);
         for (i = 0; i < hdr->width * hdr->height; i++) {
+            /* fast path for fully opaque runs of 8 pixels */
+            if ((i & 7) == 0 && i + 8 <= hdr->width * hdr->height &&
+                data[size + (i >> 3)] == 0) {
+                gint j;
+
+                for (j = 0; j < 8; j++)
+                    cursor->data[i + j] |= 0xff000000;
+                i += 7;
+                continue;
+            }
             pix_mask = get_pix_mask(data, size, i);
             if (pix_mask && *((guint32*)data + i) == 0xffffff) {
                 cursor->data[i] = get_pix_hack(i, hdr->width);
@@ -381,13 +503,7 @@ static display_cursor *set_cursor(SpiceChannel *channel, SpiceCursor *scursor)
         goto cache_add;
     }
 
-    rgba = (guint8*)cursor->data;
-    for (i = 0; i < hdr->width * hdr->height; i++) {
-        val = rgba[0];
-        rgba[0] = rgba[2];
-        rgba[2] = val;
-        rgba += 4;
-    }
+    argb_to_rgba(cursor->data, (guint8 *)cursor->data, hdr->width * hdr->height);
 
 cache_add:
     if (scursor->flags & SPICE_CURSOR_FLAGS_CACHE_ME) {
@@ -400,11 +516,15 @@ cache_add:
 /* coroutine context */
 static void emit_cursor_set(SpiceChannel *channel, display_cursor *cursor)
 {
+    SpiceCursorChannelPrivate *c = SPICE_CURSOR_CHANNEL(channel)->priv;
+
     g_return_if_fail(cursor != NULL);
+    c->current = cursor;
     g_coroutine_signal_emit(channel, signals[SPICE_CURSOR_SET], 0,
                             cursor->hdr.width, cursor->hdr.height,
                             cursor->hdr.hot_spot_x, cursor->hdr.hot_spot_y,
                             cursor->default_cursor ? NULL : cursor->data);
+    c->current = NULL;
 }
 
 /* coroutine context */
@@ -467,8 +587,8 @@ static void cursor_handle_move(SpiceChannel *channel, SpiceMsgIn *in)
 
     g_return_if_fail(c->init_done == TRUE);
 
-    g_coroutine_signal_emit(channel, signals[SPICE_CURSOR_MOVE], 0,
-                            move->position.x, move->position.y);
+    g_coroutine_signal_emit_queued(channel, signals[SPICE_CURSOR_MOVE], 0,
+                                   move->position.x, move->position.y);
 }
 
 /* coroutine context */
@@ -480,7 +600,7 @@ static void cursor_handle_hide(SpiceChannel *channel, SpiceMsgIn *in)
     g_return_if_fail(c->init_done == TRUE);
 #endif
 
-    g_coroutine_signal_emit(channel, signals[SPICE_CURSOR_HIDE], 0);
+    g_coroutine_signal_emit_queued(channel, signals[SPICE_CURSOR_HIDE], 0);
 }
 
 /* coroutine context */
@@ -527,3 +647,58 @@ static void channel_set_handlers(SpiceChannelClass *klass)
 
     spice_channel_set_handlers(klass, handlers, G_N_ELEMENTS(handlers));
 }
+
+/**
+ * spice_cursor_channel_get_cursor_data:
+ * @channel: a #SpiceCursorChannel
+ *
+ * Gets the data attached to the cursor shape being set with
+ * spice_cursor_channel_set_cursor_data(). The server caches shapes it
+ * sends repeatedly, such as the frames of an animated cursor, and the
+ * data lives as long as the shape is in that cache: it lets a client
+ * reuse the cursor it built for the shape, instead of converting it
+ * again.
+ *
+ * Must be called from a #SpiceCursorChannel::cursor-set handler.
+ *
+ * Returns: (transfer none): the attached data, or %NULL
+ *
+ * Since: 0.28
+ **/
+gpointer spice_cursor_channel_get_cursor_data(SpiceCursorChannel *channel)
+{
+    g_return_val_if_fail(SPICE_IS_CURSOR_CHANNEL(channel), NULL);
+    g_return_val_if_fail(channel->priv->current != NULL, NULL);
+
+    return channel->priv->current->user_data;
+}
+
+/**
+ * spice_cursor_channel_set_cursor_data:
+ * @channel: a #SpiceCursorChannel
+ * @data: data to attach to the cursor shape being set
+ * @destroy: (allow-none): function to free @data
+ *
+ * Attaches @data to the cursor shape being set, replacing any previous
+ * data. @destroy is called once the shape is no longer used by the
+ * channel, that is when it leaves the server cache or right after the
+ * signal emission if it isn't cached.
+ *
+ * Must be called from a #SpiceCursorChannel::cursor-set handler.
+ *
+ * Since: 0.28
+ **/
+void spice_cursor_channel_set_cursor_data(SpiceCursorChannel *channel,
+                                          gpointer data, GDestroyNotify destroy)
+{
+    display_cursor *cursor;
+
+    g_return_if_fail(SPICE_IS_CURSOR_CHANNEL(channel));
+    g_return_if_fail(channel->priv->current != NULL);
+
+    cursor = channel->priv->current;
+    if (cursor->user_data_destroy)
+        cursor->user_data_destroy(cursor->user_data);
+    cursor->user_data = data;
+    cursor->user_data_destroy = destroy;
+}
@@ -72,6 +72,10 @@ struct _SpiceCursorChannelClass {
 
 GType spice_cursor_channel_get_type(void);
 
+gpointer spice_cursor_channel_get_cursor_data(SpiceCursorChannel *channel);
+void spice_cursor_channel_set_cursor_data(SpiceCursorChannel *channel,
+                                          gpointer data, GDestroyNotify destroy);
+
 G_END_DECLS
 
 #endif /* __SPICE_CLIENT_CURSOR_CHANNEL_H__ */
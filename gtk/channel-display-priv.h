@@ -41,6 +41,7 @@ typedef struct display_surface {
     enum SpiceSurfaceFmt        format;
     int                         width, height, stride, size;
     int                         shmid;
+    int                         memfd;
     uint8_t                     *data;
     SpiceCanvas                 *canvas;
     SpiceGlzDecoder             *glz_decoder;
@@ -29,6 +29,15 @@
 #include <sys/ipc.h>
 #endif
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_MEMFD_CREATE
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "glib-compat.h"
 #include "spice-client.h"
 #include "spice-common.h"
@@ -55,7 +64,15 @@
  * #SpiceDisplayChannel::display-primary-create.
  *
  * The update of regions is notified by
- * #SpiceDisplayChannel::display-invalidate signals.
+ * #SpiceDisplayChannel::display-invalidate-region signals, which
+ * carry the union of the areas drawn since the previous notification.
+ * For compatibility, #SpiceDisplayChannel::display-invalidate is also
+ * emitted for each rectangle of that union.
+ *
+ * When #SpiceDisplayChannel:memfd is set, the primary surface is
+ * allocated in an anonymous memory file, which is announced with
+ * #SpiceDisplayChannel::display-primary-memfd so that other processes
+ * can map the framebuffer without copying it.
  */
 
 #define SPICE_DISPLAY_CHANNEL_GET_PRIVATE(obj)                                  \
@@ -63,7 +80,17 @@
 
 #define MONITORS_MAX 256
 
+/* upper bound on how long damage is accumulated before being
+ * notified, when the server keeps the socket busy (a ~60Hz frame) */
+#define INVALIDATE_MAX_DELAY_US (G_USEC_PER_SEC / 60)
+
 struct _SpiceDisplayChannelPrivate {
+    /* the surfaces, primary and monitors are written from the channel
+     * coroutine, which may run in an I/O thread, and read from the main
+     * context: they are modified with the lock held, and read with it
+     * from outside the coroutine. The monitors array is replaced, not
+     * modified, as references to it are handed out. */
+    STATIC_MUTEX                lock;
     GHashTable                  *surfaces;
     display_surface             *primary;
     display_cache               *images;
@@ -79,6 +106,9 @@ struct _SpiceDisplayChannelPrivate {
     GArray                      *monitors;
     guint                       monitors_max;
     gboolean                    enable_adaptive_streaming;
+    gboolean                    use_memfd;
+    QRegion                     invalidate_region;
+    gint64                      invalidate_start;
 #ifdef G_OS_WIN32
     HDC dc;
 #endif
@@ -92,7 +122,8 @@ enum {
     PROP_WIDTH,
     PROP_HEIGHT,
     PROP_MONITORS,
-    PROP_MONITORS_MAX
+    PROP_MONITORS_MAX,
+    PROP_MEMFD,
 };
 
 enum {
@@ -100,6 +131,8 @@ enum {
     SPICE_DISPLAY_PRIMARY_DESTROY,
     SPICE_DISPLAY_INVALIDATE,
     SPICE_DISPLAY_MARK,
+    SPICE_DISPLAY_PRIMARY_MEMFD,
+    SPICE_DISPLAY_INVALIDATE_REGION,
 
     SPICE_DISPLAY_LAST_SIGNAL,
 };
@@ -118,6 +151,8 @@ static void spice_display_channel_reset_capabilities(SpiceChannel *channel);
 static void destroy_canvas(display_surface *surface);
 static void _msg_in_unref_func(gpointer data, gpointer user_data);
 static void display_session_mm_time_reset_cb(SpiceSession *session, gpointer data);
+static void spice_display_channel_iterate_read(SpiceChannel *channel);
+static void flush_invalidate(SpiceChannel *channel);
 
 /* ------------------------------------------------------------------ */
 
@@ -141,8 +176,10 @@ static void spice_display_channel_finalize(GObject *object)
     g_clear_pointer(&c->monitors, g_array_unref);
     clear_surfaces(SPICE_CHANNEL(object), FALSE);
     g_hash_table_unref(c->surfaces);
+    STATIC_MUTEX_CLEAR(c->lock);
     clear_streams(SPICE_CHANNEL(object));
     g_clear_pointer(&c->palettes, cache_unref);
+    region_destroy(&c->invalidate_region);
 
     if (G_OBJECT_CLASS(spice_display_channel_parent_class)->finalize)
         G_OBJECT_CLASS(spice_display_channel_parent_class)->finalize(object);
@@ -181,21 +218,31 @@ static void spice_display_get_property(GObject    *object,
 
     switch (prop_id) {
     case PROP_WIDTH: {
+        STATIC_MUTEX_LOCK(c->lock);
         g_value_set_uint(value, c->primary ? c->primary->width : 0);
+        STATIC_MUTEX_UNLOCK(c->lock);
         break;
     }
     case PROP_HEIGHT: {
+        STATIC_MUTEX_LOCK(c->lock);
         g_value_set_uint(value, c->primary ? c->primary->height : 0);
+        STATIC_MUTEX_UNLOCK(c->lock);
         break;
     }
     case PROP_MONITORS: {
+        STATIC_MUTEX_LOCK(c->lock);
         g_value_set_boxed(value, c->monitors);
+        STATIC_MUTEX_UNLOCK(c->lock);
         break;
     }
     case PROP_MONITORS_MAX: {
         g_value_set_uint(value, c->monitors_max);
         break;
     }
+    case PROP_MEMFD: {
+        g_value_set_boolean(value, c->use_memfd);
+        break;
+    }
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
         break;
@@ -207,7 +254,12 @@ static void spice_display_set_property(GObject      *object,
                                        const GValue *value,
                                        GParamSpec   *pspec)
 {
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(object)->priv;
+
     switch (prop_id) {
+    case PROP_MEMFD:
+        c->use_memfd = g_value_get_boolean(value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
         break;
@@ -236,6 +288,7 @@ static void spice_display_channel_class_init(SpiceDisplayChannelClass *klass)
     gobject_class->constructed = spice_display_channel_constructed;
 
     channel_class->channel_up   = spice_display_channel_up;
+    channel_class->iterate_read = spice_display_channel_iterate_read;
     channel_class->channel_reset = spice_display_channel_reset;
     channel_class->channel_reset_capabilities = spice_display_channel_reset_capabilities;
 
@@ -291,6 +344,25 @@ static void spice_display_channel_class_init(SpiceDisplayChannelClass *klass)
                            G_PARAM_READABLE |
                            G_PARAM_STATIC_STRINGS));
 
+    /**
+     * SpiceDisplayChannel:memfd:
+     *
+     * Whether the primary surface should be backed by a sealed
+     * anonymous memory file (memfd) rather than by private or SysV
+     * shared memory. Takes effect on the next primary surface
+     * creation. Ignored when memfd_create() is not available.
+     *
+     * Since: 0.28
+     */
+    g_object_class_install_property
+        (gobject_class, PROP_MEMFD,
+         g_param_spec_boolean("memfd",
+                              "Use memfd",
+                              "Back the primary surface with a memfd",
+                              FALSE,
+                              G_PARAM_READWRITE |
+                              G_PARAM_STATIC_STRINGS));
+
     /**
      * SpiceDisplayChannel::display-primary-create:
      * @display: the #SpiceDisplayChannel that emitted the signal
@@ -361,6 +433,32 @@ static void spice_display_channel_class_init(SpiceDisplayChannelClass *klass)
                      4,
                      G_TYPE_INT, G_TYPE_INT, G_TYPE_INT, G_TYPE_INT);
 
+    /**
+     * SpiceDisplayChannel::display-invalidate-region:
+     * @display: the #SpiceDisplayChannel that emitted the signal
+     * @rects: an array of 4 * @n_rects integers, the x, y, width and
+     * height of each rectangle
+     * @n_rects: number of rectangles in @rects
+     *
+     * The #SpiceDisplayChannel::display-invalidate-region signal is
+     * emitted when the region made of @rects of the primary buffer is
+     * updated. Updates are accumulated while the channel processes
+     * incoming messages, and the rectangles don't overlap. @rects is
+     * only valid during the signal emission.
+     *
+     * Since: 0.28
+     **/
+    signals[SPICE_DISPLAY_INVALIDATE_REGION] =
+        g_signal_new("display-invalidate-region",
+                     G_OBJECT_CLASS_TYPE(gobject_class),
+                     G_SIGNAL_RUN_FIRST,
+                     0,
+                     NULL, NULL,
+                     g_cclosure_user_marshal_VOID__POINTER_INT,
+                     G_TYPE_NONE,
+                     2,
+                     G_TYPE_POINTER, G_TYPE_INT);
+
     /**
      * SpiceDisplayChannel::display-mark:
      * @display: the #SpiceDisplayChannel that emitted the signal
@@ -382,6 +480,33 @@ static void spice_display_channel_class_init(SpiceDisplayChannelClass *klass)
                      1,
                      G_TYPE_INT);
 
+    /**
+     * SpiceDisplayChannel::display-primary-memfd:
+     * @display: the #SpiceDisplayChannel that emitted the signal
+     * @fd: file descriptor of the memfd holding the primary surface
+     *
+     * The #SpiceDisplayChannel::display-primary-memfd signal is
+     * emitted right after #SpiceDisplayChannel::display-primary-create
+     * when the primary surface is backed by a memfd. The file has the
+     * size of the surface and is sealed against resizing, so it can
+     * safely be mapped with mmap(). The descriptor is owned by the
+     * channel and is closed after
+     * #SpiceDisplayChannel::display-primary-destroy, use dup() to
+     * keep it longer.
+     *
+     * Since: 0.28
+     **/
+    signals[SPICE_DISPLAY_PRIMARY_MEMFD] =
+        g_signal_new("display-primary-memfd",
+                     G_OBJECT_CLASS_TYPE(gobject_class),
+                     G_SIGNAL_RUN_FIRST,
+                     0,
+                     NULL, NULL,
+                     g_cclosure_marshal_VOID__INT,
+                     G_TYPE_NONE,
+                     1,
+                     G_TYPE_INT);
+
     g_type_class_add_private(klass, sizeof(SpiceDisplayChannelPrivate));
 
     sw_canvas_init();
@@ -408,12 +533,17 @@ gboolean spice_display_get_primary(SpiceChannel *channel, guint32 surface_id,
     g_return_val_if_fail(primary != NULL, FALSE);
 
     SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
-    display_surface *surface = find_surface(c, surface_id);
+    display_surface *surface;
 
-    if (surface == NULL)
-        return FALSE;
+    STATIC_MUTEX_LOCK(c->lock);
+    surface = find_surface(c, surface_id);
+    if (surface == NULL || !surface->primary) {
+        gboolean found = surface != NULL;
 
-    g_return_val_if_fail(surface->primary, FALSE);
+        STATIC_MUTEX_UNLOCK(c->lock);
+        g_return_val_if_fail(!found, FALSE);
+        return FALSE;
+    }
 
     primary->format = surface->format;
     primary->width = surface->width;
@@ -422,11 +552,49 @@ gboolean spice_display_get_primary(SpiceChannel *channel, guint32 surface_id,
     primary->shmid = surface->shmid;
     primary->data = surface->data;
     primary->marked = c->mark;
+    STATIC_MUTEX_UNLOCK(c->lock);
     CHANNEL_DEBUG(channel, "get primary %p", primary->data);
 
     return TRUE;
 }
 
+/**
+ * spice_display_get_primary_fd:
+ * @channel:
+ * @surface_id:
+ *
+ * Retrieve the memfd backing the primary display surface @surface_id,
+ * see #SpiceDisplayChannel:memfd. The descriptor remains owned by the
+ * channel.
+ *
+ * Returns: the file descriptor, or -1 if the surface was not found or
+ * is not backed by a memfd.
+ *
+ * Since: 0.28
+ */
+gint spice_display_get_primary_fd(SpiceChannel *channel, guint32 surface_id)
+{
+    g_return_val_if_fail(SPICE_IS_DISPLAY_CHANNEL(channel), -1);
+
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
+    display_surface *surface;
+    gboolean is_primary = TRUE;
+    gint fd = -1;
+
+    STATIC_MUTEX_LOCK(c->lock);
+    surface = find_surface(c, surface_id);
+    if (surface != NULL) {
+        is_primary = surface->primary;
+        if (is_primary)
+            fd = surface->memfd;
+    }
+    STATIC_MUTEX_UNLOCK(c->lock);
+
+    g_return_val_if_fail(is_primary, -1);
+
+    return fd;
+}
+
 /* ------------------------------------------------------------------ */
 
 static void image_put(SpiceImageCache *cache, uint64_t id, pixman_image_t *image)
@@ -606,12 +774,31 @@ static void destroy_surface(gpointer data)
     g_slice_free(display_surface, surface);
 }
 
+/* main context */
+static void invalidate_region_compat(SpiceChannel *channel,
+                                     gint *rects, gint n_rects, gpointer data)
+{
+    gint i;
+
+    if (!g_signal_has_handler_pending(channel, signals[SPICE_DISPLAY_INVALIDATE], 0, FALSE))
+        return;
+
+    for (i = 0; i < n_rects; i++)
+        g_signal_emit(channel, signals[SPICE_DISPLAY_INVALIDATE], 0,
+                      rects[4 * i], rects[4 * i + 1],
+                      rects[4 * i + 2], rects[4 * i + 3]);
+}
+
 static void spice_display_channel_init(SpiceDisplayChannel *channel)
 {
     SpiceDisplayChannelPrivate *c;
 
     c = channel->priv = SPICE_DISPLAY_CHANNEL_GET_PRIVATE(channel);
 
+    STATIC_MUTEX_INIT(c->lock);
+    region_init(&c->invalidate_region);
+    g_signal_connect(channel, "display-invalidate-region",
+                     G_CALLBACK(invalidate_region_compat), NULL);
     c->surfaces = g_hash_table_new_full(NULL, NULL, NULL, destroy_surface);
     c->image_cache.ops = &image_cache_ops;
     c->palette_cache.ops = &palette_cache_ops;
@@ -632,6 +819,57 @@ static void spice_display_channel_init(SpiceDisplayChannel *channel)
 
 /* ------------------------------------------------------------------ */
 
+#ifdef HAVE_MEMFD_CREATE
+static gboolean create_memfd_data(SpiceChannel *channel, display_surface *surface)
+{
+    int fd;
+    void *data;
+
+    fd = memfd_create("spice-primary", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        g_warning("memfd_create() failed: %s", g_strerror(errno));
+        return FALSE;
+    }
+
+    if (ftruncate(fd, surface->size) < 0) {
+        g_warning("memfd ftruncate(%d) failed: %s", surface->size, g_strerror(errno));
+        close(fd);
+        return FALSE;
+    }
+
+    /* the size is fixed for the lifetime of the surface, let other
+     * processes map it without fearing SIGBUS */
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+        CHANNEL_DEBUG(channel, "memfd sealing failed: %s", g_strerror(errno));
+
+    data = mmap(NULL, surface->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        g_warning("memfd mmap(%d) failed: %s", surface->size, g_strerror(errno));
+        close(fd);
+        return FALSE;
+    }
+
+    surface->memfd = fd;
+    surface->data = data;
+
+    return TRUE;
+}
+#endif
+
+/* coroutine context */
+static void set_monitors(SpiceChannel *channel, GArray *monitors)
+{
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
+    GArray *old;
+
+    STATIC_MUTEX_LOCK(c->lock);
+    old = c->monitors;
+    c->monitors = monitors;
+    STATIC_MUTEX_UNLOCK(c->lock);
+
+    g_array_unref(old);
+}
+
 static int create_canvas(SpiceChannel *channel, display_surface *surface)
 {
     SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
@@ -644,29 +882,40 @@ static int create_canvas(SpiceChannel *channel, display_surface *surface)
                 return 0;
             }
 
+            region_clear(&c->invalidate_region);
             g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_PRIMARY_DESTROY], 0);
 
+            STATIC_MUTEX_LOCK(c->lock);
             g_hash_table_remove(c->surfaces, GINT_TO_POINTER(c->primary->surface_id));
+            c->primary = NULL;
+            STATIC_MUTEX_UNLOCK(c->lock);
         }
 
         CHANNEL_DEBUG(channel, "Create primary canvas");
+        surface->shmid = -1;
+        surface->memfd = -1;
+#ifdef HAVE_MEMFD_CREATE
+        if (c->use_memfd)
+            create_memfd_data(channel, surface);
+#endif
 #if defined(WITH_X11) && defined(HAVE_SYS_SHM_H)
-        surface->shmid = shmget(IPC_PRIVATE, surface->size, IPC_CREAT | 0777);
-        if (surface->shmid >= 0) {
-            surface->data = shmat(surface->shmid, 0, 0);
-            if (surface->data == NULL) {
-                shmctl(surface->shmid, IPC_RMID, 0);
-                surface->shmid = -1;
+        if (surface->memfd == -1) {
+            surface->shmid = shmget(IPC_PRIVATE, surface->size, IPC_CREAT | 0777);
+            if (surface->shmid >= 0) {
+                surface->data = shmat(surface->shmid, 0, 0);
+                if (surface->data == NULL) {
+                    shmctl(surface->shmid, IPC_RMID, 0);
+                    surface->shmid = -1;
+                }
             }
         }
-#else
-        surface->shmid = -1;
 #endif
     } else {
         surface->shmid = -1;
+        surface->memfd = -1;
     }
 
-    if (surface->shmid == -1)
+    if (surface->shmid == -1 && surface->memfd == -1)
         surface->data = g_malloc0(surface->size);
 
     g_return_val_if_fail(c->glz_window, 0);
@@ -693,21 +942,30 @@ static int create_canvas(SpiceChannel *channel, display_surface *surface)
                                              surface->zlib_decoder);
 
     g_return_val_if_fail(surface->canvas != NULL, 0);
+    STATIC_MUTEX_LOCK(c->lock);
     g_hash_table_insert(c->surfaces, GINT_TO_POINTER(surface->surface_id), surface);
-
     if (surface->primary) {
         g_warn_if_fail(c->primary == NULL);
         c->primary = surface;
+    }
+    STATIC_MUTEX_UNLOCK(c->lock);
+
+    if (surface->primary) {
         g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_PRIMARY_CREATE], 0,
                                 surface->format, surface->width, surface->height,
                                 surface->stride, surface->shmid, surface->data);
+        if (surface->memfd != -1)
+            g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_PRIMARY_MEMFD], 0,
+                                    surface->memfd);
 
         if (!spice_channel_test_capability(channel, SPICE_DISPLAY_CAP_MONITORS_CONFIG)) {
-            g_array_set_size(c->monitors, 1);
-            SpiceDisplayMonitorConfig *config = &g_array_index(c->monitors, SpiceDisplayMonitorConfig, 0);
+            GArray *monitors = g_array_sized_new(FALSE, TRUE, sizeof(SpiceDisplayMonitorConfig), 1);
+            g_array_set_size(monitors, 1);
+            SpiceDisplayMonitorConfig *config = &g_array_index(monitors, SpiceDisplayMonitorConfig, 0);
             config->x = config->y = 0;
             config->width = surface->width;
             config->height = surface->height;
+            set_monitors(channel, monitors);
             g_coroutine_object_notify(G_OBJECT(channel), "monitors");
         }
     }
@@ -724,7 +982,12 @@ static void destroy_canvas(display_surface *surface)
     zlib_decoder_destroy(surface->zlib_decoder);
     jpeg_decoder_destroy(surface->jpeg_decoder);
 
-    if (surface->shmid == -1) {
+    if (surface->memfd != -1) {
+#ifdef HAVE_MEMFD_CREATE
+        munmap(surface->data, surface->size);
+        close(surface->memfd);
+#endif
+    } else if (surface->shmid == -1) {
         g_free(surface->data);
     }
 #ifdef HAVE_SYS_SHM_H
@@ -734,6 +997,7 @@ static void destroy_canvas(display_surface *surface)
     }
 #endif
     surface->shmid = -1;
+    surface->memfd = -1;
     surface->data = NULL;
 
     surface->canvas->ops->destroy(surface->canvas);
@@ -756,10 +1020,14 @@ static void clear_surfaces(SpiceChannel *channel, gboolean keep_primary)
     display_surface *surface;
 
     if (!keep_primary) {
+        STATIC_MUTEX_LOCK(c->lock);
         c->primary = NULL;
+        STATIC_MUTEX_UNLOCK(c->lock);
+        region_clear(&c->invalidate_region);
         g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_PRIMARY_DESTROY], 0);
     }
 
+    STATIC_MUTEX_LOCK(c->lock);
     g_hash_table_iter_init(&iter, c->surfaces);
     while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&surface)) {
 
@@ -770,15 +1038,60 @@ static void clear_surfaces(SpiceChannel *channel, gboolean keep_primary)
 
         g_hash_table_iter_remove(&iter);
     }
+    STATIC_MUTEX_UNLOCK(c->lock);
+}
+
+/* main or coroutine context */
+static void flush_invalidate(SpiceChannel *channel)
+{
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
+    pixman_box32_t *boxes;
+    gint *rects;
+    int i, n;
+
+    if (!pixman_region32_not_empty(&c->invalidate_region))
+        return;
+
+    boxes = pixman_region32_rectangles(&c->invalidate_region, &n);
+    rects = g_new(gint, 4 * n);
+    for (i = 0; i < n; i++) {
+        rects[4 * i] = boxes[i].x1;
+        rects[4 * i + 1] = boxes[i].y1;
+        rects[4 * i + 2] = boxes[i].x2 - boxes[i].x1;
+        rects[4 * i + 3] = boxes[i].y2 - boxes[i].y1;
+    }
+    region_clear(&c->invalidate_region);
+
+    spice_session_latency_display(spice_channel_get_session(channel),
+                                  channel->priv->channel_id, c->monitors,
+                                  rects, n);
+    g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_INVALIDATE_REGION], 0,
+                            rects, n);
+    g_free(rects);
 }
 
 /* coroutine context */
 static void emit_invalidate(SpiceChannel *channel, SpiceRect *bbox)
 {
-    g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_INVALIDATE], 0,
-                            bbox->left, bbox->top,
-                            bbox->right - bbox->left,
-                            bbox->bottom - bbox->top);
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
+    gint64 now = g_get_monotonic_time();
+
+    /* the damage is notified once all readable messages are processed,
+     * see spice_display_channel_iterate_read() */
+    if (!pixman_region32_not_empty(&c->invalidate_region))
+        c->invalidate_start = now;
+    region_add(&c->invalidate_region, bbox);
+
+    if (now - c->invalidate_start >= INVALIDATE_MAX_DELAY_US)
+        flush_invalidate(channel);
+}
+
+/* coroutine context */
+static void spice_display_channel_iterate_read(SpiceChannel *channel)
+{
+    SPICE_CHANNEL_CLASS(spice_display_channel_parent_class)->iterate_read(channel);
+
+    flush_invalidate(channel);
 }
 
 /* ------------------------------------------------------------------ */
@@ -855,6 +1168,8 @@ static void display_handle_mark(SpiceChannel *channel, SpiceMsgIn *in)
     g_warn_if_fail(c->mark == FALSE);
 #endif
 
+    flush_invalidate(channel);
+    spice_session_latency_mark(spice_channel_get_session(channel));
     c->mark = TRUE;
     g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_MARK], 0, TRUE);
 }
@@ -1026,7 +1341,10 @@ static gboolean display_stream_schedule(display_stream *st)
     if (time < op->multi_media_time) {
         d = op->multi_media_time - time;
         SPICE_DEBUG("scheduling next stream render in %u ms", d);
-        st->timeout = g_timeout_add(d, (GSourceFunc)display_stream_render, st);
+        st->timeout = g_coroutine_timeout_add_full(&st->channel->priv->coroutine,
+                                                   G_PRIORITY_DEFAULT, d,
+                                                   (GSourceFunc)display_stream_render,
+                                                   st, NULL);
         return TRUE;
     } else {
         SPICE_DEBUG("%s: rendering too late by %u ms (ts: %u, mmtime: %u), dropping ",
@@ -1152,11 +1470,21 @@ static gboolean display_stream_render(display_stream *st)
                 width, height, stride,
                 st->have_region ? &st->region : NULL);
 
-            if (st->surface->primary)
-                g_signal_emit(st->channel, signals[SPICE_DISPLAY_INVALIDATE], 0,
+            if (st->surface->primary) {
+                gint rect[4] = {
                     dest->left, dest->top,
                     dest->right - dest->left,
-                    dest->bottom - dest->top);
+                    dest->bottom - dest->top
+                };
+
+                spice_session_latency_display(spice_channel_get_session(st->channel),
+                                              st->channel->priv->channel_id,
+                                              SPICE_DISPLAY_CHANNEL(st->channel)->priv->monitors,
+                                              rect, 1);
+                /* from the main context, or an I/O thread */
+                g_coroutine_signal_emit(st->channel, signals[SPICE_DISPLAY_INVALIDATE_REGION], 0,
+                                        rect, 1);
+            }
         }
 
         st->msg_data = NULL;
@@ -1236,7 +1564,7 @@ static void display_stream_reset_rendering_timer(display_stream *st)
 {
     SPICE_DEBUG("%s", __FUNCTION__);
     if (st->timeout != 0) {
-        g_source_remove(st->timeout);
+        g_coroutine_source_remove(&st->channel->priv->coroutine, st->timeout);
         st->timeout = 0;
     }
     while (!display_stream_schedule(st)) {
@@ -1277,14 +1605,12 @@ static void display_stream_reset_rendering_timer(display_stream *st)
  */
 
 /* main context */
-static void display_session_mm_time_reset_cb(SpiceSession *session, gpointer data)
+static gboolean display_mm_time_reset(gpointer data)
 {
     SpiceChannel *channel = data;
     SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
     guint i;
 
-    CHANNEL_DEBUG(channel, "%s", __FUNCTION__);
-
     for (i = 0; i < c->nstreams; i++) {
         display_stream *st;
 
@@ -1295,6 +1621,25 @@ static void display_session_mm_time_reset_cb(SpiceSession *session, gpointer dat
         st = c->streams[i];
         display_stream_reset_rendering_timer(st);
     }
+
+    return FALSE;
+}
+
+static void display_session_mm_time_reset_cb(SpiceSession *session, gpointer data)
+{
+    SpiceChannel *channel = data;
+    GCoroutine *co = &channel->priv->coroutine;
+
+    CHANNEL_DEBUG(channel, "%s", __FUNCTION__);
+
+    if (co->context != NULL && !g_main_context_is_owner(co->context)) {
+        /* the streams are rendered from the I/O thread */
+        g_coroutine_timeout_add_full(co, G_PRIORITY_HIGH, 0, display_mm_time_reset,
+                                     g_object_ref(channel), g_object_unref);
+        return;
+    }
+
+    display_mm_time_reset(channel);
 }
 
 /* coroutine context */
@@ -1481,7 +1826,7 @@ static void destroy_stream(SpiceChannel *channel, int id)
     g_queue_foreach(st->msgq, _msg_in_unref_func, NULL);
     g_queue_free(st->msgq);
     if (st->timeout != 0)
-        g_source_remove(st->timeout);
+        g_coroutine_source_remove(&st->channel->priv->coroutine, st->timeout);
     g_free(st);
     c->streams[id] = NULL;
 }
@@ -1694,11 +2039,15 @@ static void display_handle_surface_destroy(SpiceChannel *channel, SpiceMsgIn *in
         if (id != 0 && c->mark_false_event_id == 0) {
             c->mark_false_event_id = g_timeout_add_seconds(1, display_mark_false, channel);
         }
+        STATIC_MUTEX_LOCK(c->lock);
         c->primary = NULL;
+        STATIC_MUTEX_UNLOCK(c->lock);
         g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_PRIMARY_DESTROY], 0);
     }
 
+    STATIC_MUTEX_LOCK(c->lock);
     g_hash_table_remove(c->surfaces, GINT_TO_POINTER(surface->surface_id));
+    STATIC_MUTEX_UNLOCK(c->lock);
 }
 
 #define CLAMP_CHECK(x, low, high)  (((x) > (high)) ? TRUE : (((x) < (low)) ? TRUE : FALSE))
@@ -1708,6 +2057,7 @@ static void display_handle_monitors_config(SpiceChannel *channel, SpiceMsgIn *in
 {
     SpiceMsgDisplayMonitorsConfig *config = spice_msg_in_parsed(in);
     SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
+    GArray *monitors;
     guint i;
 
     g_return_if_fail(config != NULL);
@@ -1726,10 +2076,11 @@ static void display_handle_monitors_config(SpiceChannel *channel, SpiceMsgIn *in
         config->count = CLAMP(config->count, 1, c->monitors_max);
     }
 
-    c->monitors = g_array_set_size(c->monitors, config->count);
+    monitors = g_array_sized_new(FALSE, TRUE, sizeof(SpiceDisplayMonitorConfig), config->count);
+    g_array_set_size(monitors, config->count);
 
     for (i = 0; i < config->count; i++) {
-        SpiceDisplayMonitorConfig *mc = &g_array_index(c->monitors, SpiceDisplayMonitorConfig, i);
+        SpiceDisplayMonitorConfig *mc = &g_array_index(monitors, SpiceDisplayMonitorConfig, i);
         SpiceHead *head = &config->heads[i];
         CHANNEL_DEBUG(channel, "monitor id: %u, surface id: %u, +%u+%u-%ux%u",
                     head->id, head->surface_id,
@@ -1742,6 +2093,7 @@ static void display_handle_monitors_config(SpiceChannel *channel, SpiceMsgIn *in
         mc->height = head->height;
     }
 
+    set_monitors(channel, monitors);
     g_coroutine_object_notify(G_OBJECT(channel), "monitors");
 }
 
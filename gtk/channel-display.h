@@ -96,6 +96,7 @@ struct _SpiceDisplayChannelClass {
 GType	        spice_display_channel_get_type(void);
 gboolean        spice_display_get_primary(SpiceChannel *channel, guint32 surface_id,
                                           SpiceDisplayPrimary *primary);
+gint            spice_display_get_primary_fd(SpiceChannel *channel, guint32 surface_id);
 
 G_END_DECLS
 
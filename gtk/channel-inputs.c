@@ -20,6 +20,7 @@
 #include "spice-client.h"
 #include "spice-common.h"
 #include "spice-channel-priv.h"
+#include "spice-session-priv.h"
 
 /**
  * SECTION:channel-inputs
@@ -43,6 +44,9 @@
 #define SPICE_INPUTS_CHANNEL_GET_PRIVATE(obj)                                  \
     (G_TYPE_INSTANCE_GET_PRIVATE((obj), SPICE_TYPE_INPUTS_CHANNEL, SpiceInputsChannelPrivate))
 
+/* upper bound of the adaptive motion interval, in ms */
+#define MOTION_INTERVAL_MAX 50
+
 struct _SpiceInputsChannelPrivate {
     int                         bs;
     int                         dx, dy;
@@ -50,6 +54,18 @@ struct _SpiceInputsChannelPrivate {
     int                         motion_count;
     int                         modifiers;
     guint32                     locks;
+
+    /* motion scheduling */
+    guint                       motion_interval;
+    guint                       motion_timer_id;
+    gint64                      motion_last_send;
+    guint                       motion_sent;
+    guint                       motion_acks;
+    gint64                      bunch_sent[4];
+    gint64                      rtt;
+
+    /* input latency tracing: time of the oldest pending motion */
+    gint64                      motion_trace;
 };
 
 G_DEFINE_TYPE(SpiceInputsChannel, spice_inputs_channel, SPICE_TYPE_CHANNEL)
@@ -58,6 +74,7 @@ G_DEFINE_TYPE(SpiceInputsChannel, spice_inputs_channel, SPICE_TYPE_CHANNEL)
 enum {
     PROP_0,
     PROP_KEY_MODIFIERS,
+    PROP_MOTION_INTERVAL,
 };
 
 /* Signals */
@@ -78,6 +95,8 @@ static void channel_set_handlers(SpiceChannelClass *klass);
 static void spice_inputs_channel_init(SpiceInputsChannel *channel)
 {
     channel->priv = SPICE_INPUTS_CHANNEL_GET_PRIVATE(channel);
+    /* don't let input wait behind rendering in the main loop */
+    SPICE_CHANNEL(channel)->priv->xmit_immediate = TRUE;
 }
 
 static void spice_inputs_get_property(GObject    *object,
@@ -91,6 +110,26 @@ static void spice_inputs_get_property(GObject    *object,
     case PROP_KEY_MODIFIERS:
         g_value_set_int(value, c->modifiers);
         break;
+    case PROP_MOTION_INTERVAL:
+        g_value_set_uint(value, c->motion_interval);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+}
+
+static void spice_inputs_set_property(GObject      *object,
+                                      guint         prop_id,
+                                      const GValue *value,
+                                      GParamSpec   *pspec)
+{
+    SpiceInputsChannelPrivate *c = SPICE_INPUTS_CHANNEL(object)->priv;
+
+    switch (prop_id) {
+    case PROP_MOTION_INTERVAL:
+        c->motion_interval = g_value_get_uint(value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
         break;
@@ -99,6 +138,11 @@ static void spice_inputs_get_property(GObject    *object,
 
 static void spice_inputs_channel_finalize(GObject *obj)
 {
+    SpiceInputsChannelPrivate *c = SPICE_INPUTS_CHANNEL(obj)->priv;
+
+    if (c->motion_timer_id)
+        g_source_remove(c->motion_timer_id);
+
     if (G_OBJECT_CLASS(spice_inputs_channel_parent_class)->finalize)
         G_OBJECT_CLASS(spice_inputs_channel_parent_class)->finalize(obj);
 }
@@ -110,6 +154,7 @@ static void spice_inputs_channel_class_init(SpiceInputsChannelClass *klass)
 
     gobject_class->finalize     = spice_inputs_channel_finalize;
     gobject_class->get_property = spice_inputs_get_property;
+    gobject_class->set_property = spice_inputs_set_property;
     channel_class->channel_up   = spice_inputs_channel_up;
     channel_class->channel_reset = spice_inputs_channel_reset;
 
@@ -124,6 +169,27 @@ static void spice_inputs_channel_class_init(SpiceInputsChannelClass *klass)
                           G_PARAM_STATIC_NICK |
                           G_PARAM_STATIC_BLURB));
 
+    /**
+     * SpiceInputsChannel:motion-interval:
+     *
+     * Minimum interval between two mouse motion messages, in
+     * milliseconds. Motion events in between are merged, the last
+     * position is always sent. The interval is raised on high latency
+     * links, so that the mouse keeps moving smoothly within the
+     * number of unacknowledged messages the protocol allows.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_MOTION_INTERVAL,
+         g_param_spec_uint("motion-interval",
+                           "Motion interval",
+                           "Minimum interval between motion messages (ms)",
+                           0, MOTION_INTERVAL_MAX, 10,
+                           G_PARAM_READWRITE |
+                           G_PARAM_CONSTRUCT |
+                           G_PARAM_STATIC_STRINGS));
+
     /**
      * SpiceInputsChannel::inputs-modifier:
      * @display: the #SpiceInputsChannel that emitted the signal
@@ -149,6 +215,51 @@ static void spice_inputs_channel_class_init(SpiceInputsChannelClass *klass)
 
 /* ------------------------------------------------------------------ */
 
+/* main or coroutine context */
+static void motion_sent(SpiceInputsChannelPrivate *c)
+{
+    c->motion_count++;
+    c->motion_sent++;
+    c->motion_last_send = g_get_monotonic_time();
+
+    /* the server acks every bunch of messages, remember when the
+     * last one of each bunch left to measure the round-trip time */
+    if (c->motion_sent % SPICE_INPUT_MOTION_ACK_BUNCH == 0)
+        c->bunch_sent[(c->motion_sent / SPICE_INPUT_MOTION_ACK_BUNCH) %
+                      G_N_ELEMENTS(c->bunch_sent)] = c->motion_last_send;
+}
+
+/* The interval between motion messages, in us: at least the configured
+ * one, and long enough that a round-trip doesn't exhaust the window of
+ * unacknowledged messages. */
+static gint64 motion_interval(SpiceInputsChannelPrivate *c)
+{
+    gint64 interval = c->motion_interval * 1000;
+
+    if (c->rtt > 0)
+        interval = MAX(interval, c->rtt / (SPICE_INPUT_MOTION_ACK_BUNCH * 2));
+
+    return MIN(interval, MOTION_INTERVAL_MAX * 1000);
+}
+
+/* main context */
+static gint64 latency_input(SpiceInputsChannel *channel, gint display, gint x, gint y)
+{
+    SpiceSession *session = spice_channel_get_session(SPICE_CHANNEL(channel));
+
+    return spice_session_latency_input(session, display, x, y);
+}
+
+/* main context */
+static void motion_trace(SpiceInputsChannel *channel, gint display, gint x, gint y)
+{
+    SpiceInputsChannelPrivate *c = channel->priv;
+    gint64 time = latency_input(channel, display, x, y);
+
+    if (c->motion_trace == 0)
+        c->motion_trace = time;
+}
+
 static SpiceMsgOut* mouse_motion(SpiceInputsChannel *channel)
 {
     SpiceInputsChannelPrivate *c = channel->priv;
@@ -164,8 +275,10 @@ static SpiceMsgOut* mouse_motion(SpiceInputsChannel *channel)
     msg = spice_msg_out_new(SPICE_CHANNEL(channel),
                             SPICE_MSGC_INPUTS_MOUSE_MOTION);
     msg->marshallers->msgc_inputs_mouse_motion(msg->marshaller, &motion);
+    msg->trace_time = c->motion_trace;
+    c->motion_trace = 0;
 
-    c->motion_count++;
+    motion_sent(c);
     c->dx = 0;
     c->dy = 0;
 
@@ -189,8 +302,10 @@ static SpiceMsgOut* mouse_position(SpiceInputsChannel *channel)
     msg = spice_msg_out_new(SPICE_CHANNEL(channel),
                             SPICE_MSGC_INPUTS_MOUSE_POSITION);
     msg->marshallers->msgc_inputs_mouse_position(msg->marshaller, &position);
+    msg->trace_time = c->motion_trace;
+    c->motion_trace = 0;
 
-    c->motion_count++;
+    motion_sent(c);
     c->dpy = -1;
 
     return msg;
@@ -226,6 +341,43 @@ static void send_motion(SpiceInputsChannel *channel)
     spice_msg_out_send(msg);
 }
 
+static gboolean motion_timeout(gpointer data);
+
+/* main context */
+static void motion_schedule(SpiceInputsChannel *channel)
+{
+    SpiceInputsChannelPrivate *c = channel->priv;
+    gint64 elapsed, interval;
+
+    /* pending motion will be sent by the timer, or the next ack */
+    if (c->motion_timer_id != 0 ||
+        c->motion_count >= SPICE_INPUT_MOTION_ACK_BUNCH * 2)
+        return;
+
+    interval = motion_interval(c);
+    elapsed = g_get_monotonic_time() - c->motion_last_send;
+    if (elapsed >= interval) {
+        send_motion(channel);
+        send_position(channel);
+        return;
+    }
+
+    c->motion_timer_id = g_timeout_add((interval - elapsed + 999) / 1000,
+                                       motion_timeout, channel);
+}
+
+/* main context */
+static gboolean motion_timeout(gpointer data)
+{
+    SpiceInputsChannel *channel = data;
+
+    channel->priv->motion_timer_id = 0;
+    if (SPICE_CHANNEL(channel)->priv->state == SPICE_CHANNEL_STATE_READY)
+        motion_schedule(channel);
+
+    return FALSE;
+}
+
 /* coroutine context */
 static void inputs_handle_init(SpiceChannel *channel, SpiceMsgIn *in)
 {
@@ -243,7 +395,7 @@ static void inputs_handle_modifiers(SpiceChannel *channel, SpiceMsgIn *in)
     SpiceMsgInputsKeyModifiers *modifiers = spice_msg_in_parsed(in);
 
     c->modifiers = modifiers->modifiers;
-    g_coroutine_signal_emit(channel, signals[SPICE_INPUTS_MODIFIERS], 0);
+    g_coroutine_signal_emit_queued(channel, signals[SPICE_INPUTS_MODIFIERS], 0);
 }
 
 /* coroutine context */
@@ -251,8 +403,22 @@ static void inputs_handle_ack(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceInputsChannelPrivate *c = SPICE_INPUTS_CHANNEL(channel)->priv;
     SpiceMsgOut *msg;
+    gint64 sent;
 
     c->motion_count -= SPICE_INPUT_MOTION_ACK_BUNCH;
+    c->motion_acks++;
+
+    sent = c->bunch_sent[c->motion_acks % G_N_ELEMENTS(c->bunch_sent)];
+    c->bunch_sent[c->motion_acks % G_N_ELEMENTS(c->bunch_sent)] = 0;
+    if (sent != 0) {
+        gint64 rtt = g_get_monotonic_time() - sent;
+
+        c->rtt = c->rtt ? (7 * c->rtt + rtt) / 8 : rtt;
+    }
+
+    /* the timer will send the pending motion at the right time */
+    if (c->motion_timer_id != 0)
+        return;
 
     msg = mouse_motion(SPICE_INPUTS_CHANNEL(channel));
     if (msg) { /* if no motion, msg == NULL */
@@ -302,10 +468,9 @@ void spice_inputs_motion(SpiceInputsChannel *channel, gint dx, gint dy,
     c->bs  = button_state;
     c->dx += dx;
     c->dy += dy;
+    motion_trace(channel, -1, 0, 0);
 
-    if (c->motion_count < SPICE_INPUT_MOTION_ACK_BUNCH * 2) {
-        send_motion(channel);
-    }
+    motion_schedule(channel);
 }
 
 /**
@@ -333,12 +498,9 @@ void spice_inputs_position(SpiceInputsChannel *channel, gint x, gint y,
     c->x   = x;
     c->y   = y;
     c->dpy = display;
+    motion_trace(channel, display, x, y);
 
-    if (c->motion_count < SPICE_INPUT_MOTION_ACK_BUNCH * 2) {
-        send_position(channel);
-    } else {
-        CHANNEL_DEBUG(channel, "over SPICE_INPUT_MOTION_ACK_BUNCH * 2, dropping");
-    }
+    motion_schedule(channel);
 }
 
 /**
@@ -385,6 +547,7 @@ void spice_inputs_button_press(SpiceInputsChannel *channel, gint button,
     press.button = button;
     press.buttons_state = button_state;
     msg->marshallers->msgc_inputs_mouse_press(msg->marshaller, &press);
+    msg->trace_time = latency_input(channel, -1, 0, 0);
     spice_msg_out_send(msg);
 }
 
@@ -432,6 +595,7 @@ void spice_inputs_button_release(SpiceInputsChannel *channel, gint button,
     release.button = button;
     release.buttons_state = button_state;
     msg->marshallers->msgc_inputs_mouse_release(msg->marshaller, &release);
+    msg->trace_time = latency_input(channel, -1, 0, 0);
     spice_msg_out_send(msg);
 }
 
@@ -458,6 +622,7 @@ void spice_inputs_key_press(SpiceInputsChannel *channel, guint scancode)
     down.code = spice_make_scancode(scancode, FALSE);
     msg = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_INPUTS_KEY_DOWN);
     msg->marshallers->msgc_inputs_key_down(msg->marshaller, &down);
+    msg->trace_time = latency_input(channel, -1, 0, 0);
     spice_msg_out_send(msg);
 }
 
@@ -484,6 +649,7 @@ void spice_inputs_key_release(SpiceInputsChannel *channel, guint scancode)
     up.code = spice_make_scancode(scancode, TRUE);
     msg = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_INPUTS_KEY_UP);
     msg->marshallers->msgc_inputs_key_up(msg->marshaller, &up);
+    msg->trace_time = latency_input(channel, -1, 0, 0);
     spice_msg_out_send(msg);
 }
 
@@ -528,6 +694,7 @@ void spice_inputs_key_press_and_release(SpiceInputsChannel *input_channel, guint
             buf[2] = code & 0xff;
             buf[3] = code >> 8;
         }
+        msg->trace_time = latency_input(input_channel, -1, 0, 0);
         spice_msg_out_send(msg);
     } else {
         CHANNEL_DEBUG(channel, "The server doesn't support atomic press and release");
@@ -598,6 +765,14 @@ static void spice_inputs_channel_reset(SpiceChannel *channel, gboolean migrating
 {
     SpiceInputsChannelPrivate *c = SPICE_INPUTS_CHANNEL(channel)->priv;
     c->motion_count = 0;
+    c->motion_sent = 0;
+    c->motion_acks = 0;
+    memset(c->bunch_sent, 0, sizeof(c->bunch_sent));
+    c->motion_trace = 0;
+    if (c->motion_timer_id) {
+        g_source_remove(c->motion_timer_id);
+        c->motion_timer_id = 0;
+    }
 
     SPICE_CHANNEL_CLASS(spice_inputs_channel_parent_class)->channel_reset(channel, migrating);
 }
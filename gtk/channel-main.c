@@ -55,9 +55,28 @@
 typedef struct spice_migrate spice_migrate;
 
 #define FILE_XFER_CHUNK_SIZE (VD_AGENT_MAX_DATA_SIZE * 32)
-typedef struct SpiceFileXferTask {
+#define FILE_XFER_MAX_CHUNKS 8
+/* files being sent at the same time, the others wait for their turn */
+#define FILE_XFER_MAX_ACTIVE 8
+#define FILE_XFER_RATE_PERIOD 1 /* seconds */
+
+typedef struct SpiceFileXferTask SpiceFileXferTask;
+
+/* A chunk is referenced by the read filling it, then by each agent
+   message carrying a part of it, until the message is sent */
+typedef struct SpiceFileXferChunk {
+    SpiceMainChannel               *channel;
+    SpiceFileXferTask              *task; /* NULL once the task is freed */
+    guint                          refs;
+    gsize                          size;
+    guint8                         data[FILE_XFER_CHUNK_SIZE];
+} SpiceFileXferChunk;
+
+struct SpiceFileXferTask {
     uint32_t                       id;
     gboolean                       pending;
+    gboolean                       active;
+    gboolean                       eof;
     GFile                          *file;
     SpiceMainChannel               *channel;
     GFileInputStream               *file_stream;
@@ -67,11 +86,16 @@ typedef struct SpiceFileXferTask {
     gpointer                       progress_callback_data;
     GAsyncReadyCallback            callback;
     gpointer                       user_data;
-    char                           buffer[FILE_XFER_CHUNK_SIZE];
+    SpiceFileXferChunk             *chunks[FILE_XFER_MAX_CHUNKS];
+    guint                          n_chunks;
+    GQueue                         ready; /* chunks read, waiting to be queued */
     uint64_t                       read_bytes;
+    uint64_t                       sent_bytes;
+    gboolean                       sent; /* progress not reported yet */
+    gboolean                       dropped; /* queued data lost in a channel reset */
     uint64_t                       file_size;
     GError                         *error;
-} SpiceFileXferTask;
+};
 
 struct _SpiceMainChannelPrivate  {
     enum SpiceMouseMode         mouse_mode;
@@ -87,6 +111,7 @@ struct _SpiceMainChannelPrivate  {
     gboolean                    disable_display_align:1;
 
     int                         agent_tokens;
+    int                         agent_tokens_window;
     VDAgentMessage              agent_msg; /* partial msg reconstruction */
     guint8                      *agent_msg_data;
     guint                       agent_msg_pos;
@@ -103,7 +128,18 @@ struct _SpiceMainChannelPrivate  {
     gint                        timer_id;
     GQueue                      *agent_msg_queue;
     GHashTable                  *file_xfer_tasks;
-    GSList                      *flushing;
+    GQueue                      *file_xfer_waiting; /* tasks waiting to be started */
+    guint                       file_xfer_active;
+    GQueue                      *file_xfer_ready; /* tasks with ready chunks, round-robin */
+    gsize                       file_xfer_queued; /* file data bytes in agent_msg_queue */
+    guint64                     file_xfer_total;
+    guint64                     file_xfer_sent;
+    guint64                     file_xfer_rate_bytes;
+    gint64                      file_xfer_rate_time;
+    guint64                     file_xfer_rate;
+    gint                        file_xfer_eta;
+    guint                       file_xfer_rate_id;
+    guint                       file_xfer_sent_id;
 
     guint                       switch_host_delayed_id;
     guint                       migrate_delayed_id;
@@ -141,6 +177,8 @@ enum {
     PROP_DISABLE_DISPLAY_POSITION,
     PROP_DISABLE_DISPLAY_ALIGN,
     PROP_MAX_CLIPBOARD,
+    PROP_FILE_XFER_RATE,
+    PROP_FILE_XFER_ETA,
 };
 
 /* Signals */
@@ -171,7 +209,8 @@ static gboolean main_migrate_handshake_done(gpointer data);
 static void spice_main_channel_send_migration_handshake(SpiceChannel *channel);
 static void file_xfer_continue_read(SpiceFileXferTask *task);
 static void file_xfer_completed(SpiceFileXferTask *task, GError *error);
-static void file_xfer_flushed(SpiceMainChannel *channel, gboolean success);
+static void file_xfer_start_next(SpiceMainChannel *channel);
+static void file_xfer_schedule(SpiceMainChannel *channel);
 static void spice_main_set_max_clipboard(SpiceMainChannel *self, gint max);
 static void set_agent_connected(SpiceMainChannel *channel, gboolean connected);
 
@@ -231,6 +270,8 @@ static void spice_main_channel_init(SpiceMainChannel *channel)
     c = channel->priv = SPICE_MAIN_CHANNEL_GET_PRIVATE(channel);
     c->agent_msg_queue = g_queue_new();
     c->file_xfer_tasks = g_hash_table_new(g_direct_hash, g_direct_equal);
+    c->file_xfer_waiting = g_queue_new();
+    c->file_xfer_ready = g_queue_new();
 
     spice_main_channel_reset_capabilties(SPICE_CHANNEL(channel));
 }
@@ -284,6 +325,12 @@ static void spice_main_get_property(GObject    *object,
     case PROP_MAX_CLIPBOARD:
         g_value_set_int(value, spice_main_get_max_clipboard(self));
         break;
+    case PROP_FILE_XFER_RATE:
+        g_value_set_uint64(value, c->file_xfer_rate);
+        break;
+    case PROP_FILE_XFER_ETA:
+        g_value_set_int(value, c->file_xfer_eta);
+        break;
     default:
 	G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 	break;
@@ -346,6 +393,16 @@ static void spice_main_channel_dispose(GObject *obj)
         c->migrate_delayed_id = 0;
     }
 
+    if (c->file_xfer_rate_id) {
+        g_source_remove(c->file_xfer_rate_id);
+        c->file_xfer_rate_id = 0;
+    }
+
+    if (c->file_xfer_sent_id) {
+        g_source_remove(c->file_xfer_sent_id);
+        c->file_xfer_sent_id = 0;
+    }
+
     if (G_OBJECT_CLASS(spice_main_channel_parent_class)->dispose)
         G_OBJECT_CLASS(spice_main_channel_parent_class)->dispose(obj);
 }
@@ -358,6 +415,10 @@ static void spice_main_channel_finalize(GObject *obj)
     agent_free_msg_queue(SPICE_MAIN_CHANNEL(obj));
     if (c->file_xfer_tasks)
         g_hash_table_unref(c->file_xfer_tasks);
+    if (c->file_xfer_waiting)
+        g_queue_free(c->file_xfer_waiting);
+    if (c->file_xfer_ready)
+        g_queue_free(c->file_xfer_ready);
 
     if (G_OBJECT_CLASS(spice_main_channel_parent_class)->finalize)
         G_OBJECT_CLASS(spice_main_channel_parent_class)->finalize(obj);
@@ -397,13 +458,20 @@ static void spice_main_channel_reset_agent(SpiceMainChannel *channel)
         file_xfer_completed(task, error);
     }
     g_list_free(tasks);
-    file_xfer_flushed(channel, FALSE);
 }
 
 /* main or coroutine context */
 static void spice_main_channel_reset(SpiceChannel *channel, gboolean migrating)
 {
     SpiceMainChannelPrivate *c = SPICE_MAIN_CHANNEL(channel)->priv;
+    GHashTableIter iter;
+    gpointer value;
+
+    /* The file data in the agent queue, and in the channel xmit queue
+       freed later by the parent reset, never reaches the agent */
+    g_hash_table_iter_init(&iter, c->file_xfer_tasks);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        ((SpiceFileXferTask *)value)->dropped = TRUE;
 
     /* This is not part of reset_agent, since the spice-server expects any
        pending multi-chunk messages to be completed by the client, even after
@@ -575,6 +643,40 @@ static void spice_main_channel_class_init(SpiceMainChannelClass *klass)
                           G_PARAM_CONSTRUCT |
                           G_PARAM_STATIC_STRINGS));
 
+    /**
+     * SpiceMainChannel:file-xfer-rate:
+     *
+     * Aggregate throughput of the file transfers in progress, in bytes
+     * per second, updated every second (0 when there is no transfer).
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_FILE_XFER_RATE,
+         g_param_spec_uint64("file-xfer-rate",
+                             "File transfer rate",
+                             "File transfer rate in bytes per second",
+                             0, G_MAXUINT64, 0,
+                             G_PARAM_READABLE |
+                             G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceMainChannel:file-xfer-eta:
+     *
+     * Estimated time in seconds before all the file transfers in
+     * progress are completed, or -1 if it is unknown yet.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_FILE_XFER_ETA,
+         g_param_spec_int("file-xfer-eta",
+                          "File transfer ETA",
+                          "Estimated remaining file transfer time in seconds",
+                          -1, G_MAXINT, 0,
+                          G_PARAM_READABLE |
+                          G_PARAM_STATIC_STRINGS));
+
     /* TODO use notify instead */
     /**
      * SpiceMainChannel::main-mouse-update:
@@ -814,71 +916,20 @@ static void spice_main_channel_class_init(SpiceMainChannelClass *klass)
 static void agent_free_msg_queue(SpiceMainChannel *channel)
 {
     SpiceMainChannelPrivate *c = channel->priv;
+    GQueue *queue = c->agent_msg_queue;
     SpiceMsgOut *out;
 
-    if (!c->agent_msg_queue)
+    if (!queue)
         return;
 
-    while (!g_queue_is_empty(c->agent_msg_queue)) {
-        out = g_queue_pop_head(c->agent_msg_queue);
-        spice_msg_out_unref(out);
-    }
-
-    g_queue_free(c->agent_msg_queue);
+    /* dropping file data releases chunks, don't schedule more */
     c->agent_msg_queue = NULL;
-}
-
-/* Here, flushing algorithm is stolen from spice-channel.c */
-static void file_xfer_flushed(SpiceMainChannel *channel, gboolean success)
-{
-    SpiceMainChannelPrivate *c = channel->priv;
-    GSList *l;
-
-    for (l = c->flushing; l != NULL; l = l->next) {
-        GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT(l->data);
-        g_simple_async_result_set_op_res_gboolean(result, success);
-        g_simple_async_result_complete_in_idle(result);
-    }
-
-    g_slist_free_full(c->flushing, g_object_unref);
-    c->flushing = NULL;
-}
-
-static void file_xfer_flush_async(SpiceMainChannel *channel, GCancellable *cancellable,
-                                  GAsyncReadyCallback callback, gpointer user_data)
-{
-    GSimpleAsyncResult *simple;
-    SpiceMainChannelPrivate *c = channel->priv;
-    gboolean was_empty;
-
-    simple = g_simple_async_result_new(G_OBJECT(channel), callback, user_data,
-                                       file_xfer_flush_async);
-
-    was_empty = g_queue_is_empty(c->agent_msg_queue);
-    if (was_empty) {
-        g_simple_async_result_set_op_res_gboolean(simple, TRUE);
-        g_simple_async_result_complete_in_idle(simple);
-        g_object_unref(simple);
-        return;
-    }
-
-    c->flushing = g_slist_append(c->flushing, simple);
-}
-
-static gboolean file_xfer_flush_finish(SpiceMainChannel *channel, GAsyncResult *result,
-                                       GError **error)
-{
-    GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
-
-    g_return_val_if_fail(g_simple_async_result_is_valid(result,
-        G_OBJECT(channel), file_xfer_flush_async), FALSE);
-
-    if (g_simple_async_result_propagate_error(simple, error)) {
-        return FALSE;
+    while (!g_queue_is_empty(queue)) {
+        out = g_queue_pop_head(queue);
+        spice_msg_out_unref(out);
     }
 
-    CHANNEL_DEBUG(channel, "flushed finished!");
-    return g_simple_async_result_get_op_res_gboolean(simple);
+    g_queue_free(queue);
 }
 
 /* coroutine context */
@@ -893,9 +944,6 @@ static void agent_send_msg_queue(SpiceMainChannel *channel)
         out = g_queue_pop_head(c->agent_msg_queue);
         spice_msg_out_send_internal(out);
     }
-    if (g_queue_is_empty(c->agent_msg_queue) && c->flushing != NULL) {
-        file_xfer_flushed(channel, TRUE);
-    }
 }
 
 /* any context: the message is not flushed immediately,
@@ -967,6 +1015,56 @@ static void agent_msg_queue_many(SpiceMainChannel *channel, int type, const void
     g_warn_if_fail(out == NULL);
 }
 
+/* any context: like agent_msg_queue_many() with a small @header copied
+   in the first message, but @data is not copied: it is referenced by
+   the queued messages, and @free_data is called once for each of them
+   when it is sent or dropped. Returns the number of such messages. */
+static guint agent_msg_queue_ref(SpiceMainChannel *channel, int type,
+                                 const void *header, gsize header_size,
+                                 guint8 *data, gsize size,
+                                 spice_marshaller_item_free_func free_data,
+                                 gpointer opaque)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    SpiceMsgOut *out;
+    VDAgentMessage msg;
+    guint8 *payload;
+    gsize paysize, s;
+    guint n = 0;
+
+    g_return_val_if_fail(sizeof(VDAgentMessage) + header_size < VD_AGENT_MAX_DATA_SIZE, 0);
+
+    msg.protocol = VD_AGENT_PROTOCOL;
+    msg.type = type;
+    msg.opaque = 0;
+    msg.size = header_size + size;
+
+    out = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_MAIN_AGENT_DATA);
+    payload = spice_marshaller_reserve_space(out->marshaller,
+                                             sizeof(VDAgentMessage) + header_size);
+    memcpy(payload, &msg, sizeof(VDAgentMessage));
+    memcpy(payload + sizeof(VDAgentMessage), header, header_size);
+    paysize = VD_AGENT_MAX_DATA_SIZE - sizeof(VDAgentMessage) - header_size;
+
+    while (size > 0) {
+        if (out == NULL) {
+            out = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_MAIN_AGENT_DATA);
+            paysize = VD_AGENT_MAX_DATA_SIZE;
+        }
+        s = MIN(paysize, size);
+        spice_marshaller_add_ref_full(out->marshaller, data, s, free_data, opaque);
+        data += s;
+        size -= s;
+        n++;
+        g_queue_push_tail(c->agent_msg_queue, out);
+        out = NULL;
+    }
+    if (out != NULL)
+        g_queue_push_tail(c->agent_msg_queue, out);
+
+    return n;
+}
+
 static int monitors_cmp(const void *p1, const void *p2, gpointer user_data)
 {
     const VDAgentMonConfig *m1 = p1;
@@ -1404,10 +1502,10 @@ static void main_handle_init(SpiceChannel *channel, SpiceMsgIn *in)
     set_mouse_mode(SPICE_MAIN_CHANNEL(channel), init->supported_mouse_modes,
                    init->current_mouse_mode);
 
-    spice_session_set_mm_time(session, init->multi_media_time);
+    spice_session_set_mm_time(session, SPICE_MM_CLOCK_SERVER, init->multi_media_time);
     spice_session_set_caches_hints(session, init->ram_hint, init->display_channels_hint);
 
-    c->agent_tokens = init->agent_tokens;
+    c->agent_tokens = c->agent_tokens_window = init->agent_tokens;
     if (init->agent_connected)
         agent_start(SPICE_MAIN_CHANNEL(channel));
 
@@ -1448,7 +1546,7 @@ static void main_handle_mm_time(SpiceChannel *channel, SpiceMsgIn *in)
     SpiceMsgMainMultiMediaTime *msg = spice_msg_in_parsed(in);
 
     session = spice_channel_get_session(channel);
-    spice_session_set_mm_time(session, msg->time);
+    spice_session_set_mm_time(session, SPICE_MM_CLOCK_SERVER, msg->time);
 }
 
 typedef struct channel_new {
@@ -1516,7 +1614,7 @@ static void main_handle_agent_connected_tokens(SpiceChannel *channel, SpiceMsgIn
     SpiceMainChannelPrivate *c = SPICE_MAIN_CHANNEL(channel)->priv;
     SpiceMsgMainAgentConnectedTokens *msg = spice_msg_in_parsed(in);
 
-    c->agent_tokens = msg->num_tokens;
+    c->agent_tokens = c->agent_tokens_window = msg->num_tokens;
     agent_start(SPICE_MAIN_CHANNEL(channel));
 }
 
@@ -1529,12 +1627,35 @@ static void main_handle_agent_disconnected(SpiceChannel *channel, SpiceMsgIn *in
 static void file_xfer_task_free(SpiceFileXferTask *task)
 {
     SpiceMainChannelPrivate *c;
+    SpiceFileXferChunk *chunk;
+    guint i;
 
     g_return_if_fail(task != NULL);
 
     c = task->channel->priv;
     g_hash_table_remove(c->file_xfer_tasks, GUINT_TO_POINTER(task->id));
 
+    if (task->active)
+        c->file_xfer_active--;
+    else
+        g_queue_remove(c->file_xfer_waiting, task);
+    if (!g_queue_is_empty(&task->ready))
+        g_queue_remove(c->file_xfer_ready, task);
+    while ((chunk = g_queue_pop_head(&task->ready)) != NULL)
+        chunk->refs--;
+    c->file_xfer_total -= task->file_size;
+    c->file_xfer_sent -= task->sent_bytes;
+
+    for (i = 0; i < task->n_chunks; i++) {
+        /* chunks still queued are freed once sent */
+        if (task->chunks[i]->refs == 0)
+            g_free(task->chunks[i]);
+        else
+            task->chunks[i]->task = NULL;
+    }
+
+    file_xfer_start_next(task->channel);
+
     g_clear_object(&task->channel);
     g_clear_object(&task->file);
     g_clear_object(&task->file_stream);
@@ -1580,49 +1701,164 @@ static void file_xfer_close_cb(GObject      *object,
     file_xfer_task_free(task);
 }
 
-static void file_xfer_data_flushed_cb(GObject *source_object,
-                                      GAsyncResult *res,
-                                      gpointer user_data)
+/* Bytes of file data kept in the agent queue: enough to cover the
+   agent token window, so that sending never waits for the scheduler */
+static gsize file_xfer_window(SpiceMainChannel *channel)
 {
-    SpiceFileXferTask *task = user_data;
-    SpiceMainChannel *channel = (SpiceMainChannel *)source_object;
-    GError *error = NULL;
+    SpiceMainChannelPrivate *c = channel->priv;
 
-    task->pending = FALSE;
-    file_xfer_flush_finish(channel, res, &error);
-    if (error || task->error) {
-        file_xfer_completed(task, error);
+    return MAX(c->agent_tokens_window, 1) * VD_AGENT_MAX_DATA_SIZE;
+}
+
+/* Chunks in flight for a task: a window worth of data, plus the one
+   being read */
+static guint file_xfer_max_chunks(SpiceFileXferTask *task)
+{
+    gsize window = file_xfer_window(task->channel);
+
+    return CLAMP((window + FILE_XFER_CHUNK_SIZE - 1) / FILE_XFER_CHUNK_SIZE + 1,
+                 2, FILE_XFER_MAX_CHUNKS);
+}
+
+static SpiceFileXferChunk *file_xfer_get_chunk(SpiceFileXferTask *task)
+{
+    SpiceFileXferChunk *chunk;
+    guint i;
+
+    for (i = 0; i < task->n_chunks; i++) {
+        if (task->chunks[i]->refs == 0)
+            return task->chunks[i];
+    }
+
+    if (task->n_chunks >= file_xfer_max_chunks(task))
+        return NULL;
+
+    chunk = g_new(SpiceFileXferChunk, 1);
+    chunk->channel = task->channel;
+    chunk->task = task;
+    chunk->refs = 0;
+    chunk->size = 0;
+    task->chunks[task->n_chunks++] = chunk;
+
+    return chunk;
+}
+
+/* main context */
+static gboolean file_xfer_sent_idle(gpointer data)
+{
+    SpiceMainChannel *channel = data;
+    SpiceMainChannelPrivate *c = channel->priv;
+    GList *tasks, *l;
+
+    c->file_xfer_sent_id = 0;
+
+    /* the progress callbacks may start new transfers */
+    tasks = g_hash_table_get_values(c->file_xfer_tasks);
+    for (l = tasks; l != NULL; l = l->next) {
+        SpiceFileXferTask *task = l->data;
+
+        if (!task->sent)
+            continue;
+        task->sent = FALSE;
+        if (task->progress_callback && !task->error)
+            task->progress_callback(task->sent_bytes, task->file_size,
+                                    task->progress_callback_data);
+
+        /* Read more data in the chunks that were released */
+        file_xfer_continue_read(task);
+    }
+    g_list_free(tasks);
+
+    file_xfer_schedule(channel);
+
+    return FALSE;
+}
+
+/* coroutine context once the message is sent, or any context when the
+   agent queue is dropped: the progress and the next reads are left to
+   the main context, out of the coroutine stack */
+static void file_xfer_chunk_sent(uint8_t *data, void *opaque)
+{
+    SpiceFileXferChunk *chunk = opaque;
+    SpiceFileXferTask *task = chunk->task;
+    SpiceMainChannel *channel = chunk->channel;
+    SpiceMainChannelPrivate *c = channel->priv;
+
+    g_return_if_fail(chunk->refs > 0);
+
+    if (--chunk->refs > 0)
+        return;
+
+    c->file_xfer_queued -= chunk->size;
+    if (task == NULL) {
+        g_free(chunk);
         return;
     }
 
-    if (task->progress_callback)
-        task->progress_callback(task->read_bytes, task->file_size,
-                                task->progress_callback_data);
+    if (task->dropped)
+        return;
+
+    task->sent_bytes += chunk->size;
+    task->sent = TRUE;
+    c->file_xfer_sent += chunk->size;
+    c->file_xfer_rate_bytes += chunk->size;
 
-    /* Read more data */
-    file_xfer_continue_read(task);
+    if (c->file_xfer_sent_id == 0)
+        c->file_xfer_sent_id = g_idle_add(file_xfer_sent_idle, channel);
 }
 
-static void file_xfer_queue(SpiceFileXferTask *task, int data_size)
+static void file_xfer_queue(SpiceFileXferChunk *chunk)
 {
     VDAgentFileXferDataMessage msg;
+    SpiceFileXferTask *task = chunk->task;
     SpiceMainChannel *channel = SPICE_MAIN_CHANNEL(task->channel);
+    guint n;
 
     msg.id = task->id;
-    msg.size = data_size;
-    agent_msg_queue_many(channel, VD_AGENT_FILE_XFER_DATA,
-                         &msg, sizeof(msg),
-                         task->buffer, data_size, NULL);
+    msg.size = chunk->size;
+    n = agent_msg_queue_ref(channel, VD_AGENT_FILE_XFER_DATA,
+                            &msg, sizeof(msg),
+                            chunk->data, chunk->size,
+                            file_xfer_chunk_sent, chunk);
+    /* the messages take over the reference held while the chunk was ready */
+    if (n > 0)
+        chunk->refs += n - 1;
+    else
+        chunk->refs--;
+    channel->priv->file_xfer_queued += chunk->size;
     spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
 }
 
+/* main or coroutine context: queue the ready chunks of the tasks in
+   turn, as long as the file data in the agent queue is below the
+   window, so other agent messages don't wait behind megabytes of it */
+static void file_xfer_schedule(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    SpiceFileXferTask *task;
+
+    if (c->agent_msg_queue == NULL)
+        return;
+
+    while (c->file_xfer_queued < file_xfer_window(channel) &&
+           (task = g_queue_pop_head(c->file_xfer_ready)) != NULL) {
+        /* its ready chunks are released when the failed task is freed */
+        if (task->dropped)
+            continue;
+        file_xfer_queue(g_queue_pop_head(&task->ready));
+        if (!g_queue_is_empty(&task->ready))
+            g_queue_push_tail(c->file_xfer_ready, task);
+    }
+}
+
 /* main context */
 static void file_xfer_read_cb(GObject *source_object,
                               GAsyncResult *res,
                               gpointer user_data)
 {
-    SpiceFileXferTask *task = user_data;
-    SpiceMainChannel *channel = task->channel;
+    SpiceFileXferChunk *chunk = user_data;
+    SpiceFileXferTask *task = chunk->task;
+    SpiceMainChannelPrivate *c = task->channel->priv;
     gssize count;
     GError *error = NULL;
 
@@ -1631,19 +1867,27 @@ static void file_xfer_read_cb(GObject *source_object,
                                        res, &error);
     /* Check for pending earlier errors */
     if (task->error) {
+        chunk->refs--;
         file_xfer_completed(task, error);
         return;
     }
 
     if (count > 0 || task->file_size == 0) {
         task->read_bytes += count;
-        file_xfer_queue(task, count);
-        if (count == 0)
-            return;
-        file_xfer_flush_async(channel, task->cancellable,
-                              file_xfer_data_flushed_cb, task);
-        task->pending = TRUE;
-    } else if (error) {
+        task->eof = count == 0 || task->read_bytes >= task->file_size;
+        /* the read reference is kept while the chunk waits for its turn */
+        chunk->size = count;
+        if (g_queue_is_empty(&task->ready))
+            g_queue_push_tail(c->file_xfer_ready, task);
+        g_queue_push_tail(&task->ready, chunk);
+        file_xfer_schedule(task->channel);
+        /* Don't wait for the chunk to be sent, read ahead in the next one */
+        file_xfer_continue_read(task);
+        return;
+    }
+
+    chunk->refs--;
+    if (error) {
         VDAgentFileXferStatusMessage msg = {
             .id = task->id,
             .result = VD_AGENT_FILE_XFER_STATUS_ERROR,
@@ -1652,20 +1896,33 @@ static void file_xfer_read_cb(GObject *source_object,
                              &msg, sizeof(msg), NULL);
         spice_channel_wakeup(SPICE_CHANNEL(task->channel), FALSE);
         file_xfer_completed(task, error);
+    } else {
+        /* EOF, do nothing (wait for VD_AGENT_FILE_XFER_STATUS from agent) */
+        task->eof = TRUE;
     }
-    /* else EOF, do nothing (wait for VD_AGENT_FILE_XFER_STATUS from agent) */
 }
 
-/* coroutine context */
+/* main or coroutine context */
 static void file_xfer_continue_read(SpiceFileXferTask *task)
 {
+    SpiceFileXferChunk *chunk;
+
+    if (task->pending || task->eof || task->error)
+        return;
+
+    /* if all the chunks are queued, reading resumes when one is sent */
+    chunk = file_xfer_get_chunk(task);
+    if (chunk == NULL)
+        return;
+
+    chunk->refs++;
     g_input_stream_read_async(G_INPUT_STREAM(task->file_stream),
-                              task->buffer,
+                              chunk->data,
                               FILE_XFER_CHUNK_SIZE,
                               G_PRIORITY_DEFAULT,
                               task->cancellable,
                               file_xfer_read_cb,
-                              task);
+                              chunk);
     task->pending = TRUE;
 }
 
@@ -2660,9 +2917,8 @@ static void file_xfer_completed(SpiceFileXferTask *task, GError *error)
     task->pending = TRUE;
 }
 
-static void file_xfer_info_async_cb(GObject *obj, GAsyncResult *res, gpointer data)
+static void file_xfer_read_async_cb(GObject *obj, GAsyncResult *res, gpointer data)
 {
-    GFileInfo *info;
     GFile *file = G_FILE(obj);
     GError *error = NULL;
     GKeyFile *keyfile = NULL;
@@ -2673,12 +2929,10 @@ static void file_xfer_info_async_cb(GObject *obj, GAsyncResult *res, gpointer da
     SpiceFileXferTask *task = (SpiceFileXferTask *)data;
 
     task->pending = FALSE;
-    info = g_file_query_info_finish(file, res, &error);
+    task->file_stream = g_file_read_finish(file, res, &error);
     if (error || task->error)
         goto failed;
 
-    task->file_size =
-        g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
     keyfile = g_key_file_new();
 
     /* File name */
@@ -2708,27 +2962,90 @@ failed:
     file_xfer_completed(task, error);
 }
 
-static void file_xfer_read_async_cb(GObject *obj, GAsyncResult *res, gpointer data)
+/* Start the transfer of the waiting files, a few at a time: the agent
+   round-trips of small files overlap, without opening thousands of
+   them at once */
+static void file_xfer_start_next(SpiceMainChannel *channel)
 {
+    SpiceMainChannelPrivate *c = channel->priv;
+    SpiceFileXferTask *task;
+
+    while (c->agent_connected &&
+           c->file_xfer_active < FILE_XFER_MAX_ACTIVE &&
+           (task = g_queue_pop_head(c->file_xfer_waiting)) != NULL) {
+        CHANNEL_DEBUG(channel, "Start xfer task:%d", task->id);
+        task->active = TRUE;
+        c->file_xfer_active++;
+        g_file_read_async(task->file,
+                          G_PRIORITY_DEFAULT,
+                          task->cancellable,
+                          file_xfer_read_async_cb,
+                          task);
+        task->pending = TRUE;
+    }
+}
+
+static void file_xfer_info_async_cb(GObject *obj, GAsyncResult *res, gpointer data)
+{
+    GFileInfo *info;
     GFile *file = G_FILE(obj);
-    SpiceFileXferTask *task = (SpiceFileXferTask *)data;
     GError *error = NULL;
+    SpiceFileXferTask *task = (SpiceFileXferTask *)data;
+    SpiceMainChannelPrivate *c = task->channel->priv;
 
     task->pending = FALSE;
-    task->file_stream = g_file_read_finish(file, res, &error);
+    info = g_file_query_info_finish(file, res, &error);
     if (error || task->error) {
+        g_clear_object(&info);
         file_xfer_completed(task, error);
         return;
     }
 
-    g_file_query_info_async(task->file,
-                            G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                            G_FILE_QUERY_INFO_NONE,
-                            G_PRIORITY_DEFAULT,
-                            task->cancellable,
-                            file_xfer_info_async_cb,
-                            task);
-    task->pending = TRUE;
+    task->file_size =
+        g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+    g_object_unref(info);
+    c->file_xfer_total += task->file_size;
+
+    g_queue_push_tail(c->file_xfer_waiting, task);
+    file_xfer_start_next(task->channel);
+}
+
+/* main context */
+static gboolean file_xfer_rate_cb(gpointer data)
+{
+    SpiceMainChannel *channel = data;
+    SpiceMainChannelPrivate *c = channel->priv;
+    gint64 now = g_get_monotonic_time();
+    gint64 elapsed = now - c->file_xfer_rate_time;
+    guint64 rate, remaining;
+
+    if (g_hash_table_size(c->file_xfer_tasks) == 0) {
+        c->file_xfer_rate = 0;
+        c->file_xfer_eta = 0;
+        c->file_xfer_rate_id = 0;
+    } else if (elapsed > 0) {
+        /* average over a few periods */
+        rate = c->file_xfer_rate_bytes * G_USEC_PER_SEC / elapsed;
+        if (c->file_xfer_rate == 0)
+            c->file_xfer_rate = rate;
+        else
+            c->file_xfer_rate = (c->file_xfer_rate * 3 + rate) / 4;
+        c->file_xfer_rate_bytes = 0;
+        c->file_xfer_rate_time = now;
+
+        remaining = c->file_xfer_total > c->file_xfer_sent ?
+            c->file_xfer_total - c->file_xfer_sent : 0;
+        if (c->file_xfer_rate == 0)
+            c->file_xfer_eta = -1;
+        else
+            c->file_xfer_eta = MIN((remaining + c->file_xfer_rate - 1) / c->file_xfer_rate,
+                                   G_MAXINT);
+    }
+
+    g_object_notify(G_OBJECT(channel), "file-xfer-rate");
+    g_object_notify(G_OBJECT(channel), "file-xfer-eta");
+
+    return c->file_xfer_rate_id != 0;
 }
 
 static void file_xfer_send_start_msg_async(SpiceMainChannel *channel,
@@ -2760,13 +3077,25 @@ static void file_xfer_send_start_msg_async(SpiceMainChannel *channel,
         CHANNEL_DEBUG(task->channel, "Insert a xfer task:%d to task list", task->id);
         g_hash_table_insert(c->file_xfer_tasks, GUINT_TO_POINTER(task->id), task);
 
-        g_file_read_async(files[i],
-                          G_PRIORITY_DEFAULT,
-                          cancellable,
-                          file_xfer_read_async_cb,
-                          task);
+        /* the size is queried first, for the ETA of waiting files */
+        g_file_query_info_async(task->file,
+                                G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                G_FILE_QUERY_INFO_NONE,
+                                G_PRIORITY_DEFAULT,
+                                cancellable,
+                                file_xfer_info_async_cb,
+                                task);
         task->pending = TRUE;
     }
+
+    if (c->file_xfer_rate_id == 0 && g_hash_table_size(c->file_xfer_tasks) > 0) {
+        c->file_xfer_rate_bytes = 0;
+        c->file_xfer_rate_time = g_get_monotonic_time();
+        c->file_xfer_eta = -1;
+        c->file_xfer_rate_id = g_timeout_add_seconds(FILE_XFER_RATE_PERIOD,
+                                                     file_xfer_rate_cb, channel);
+        g_object_notify(G_OBJECT(channel), "file-xfer-eta");
+    }
 }
 
 /**
@@ -21,4 +21,6 @@
 gboolean spice_playback_channel_is_active(SpicePlaybackChannel *channel);
 guint32 spice_playback_channel_get_latency(SpicePlaybackChannel *channel);
 void spice_playback_channel_sync_latency(SpicePlaybackChannel *channel);
+gpointer spice_playback_data_ref(gpointer data);
+void spice_playback_data_unref(gpointer data);
 #endif
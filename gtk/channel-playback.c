@@ -59,6 +59,34 @@ struct _SpicePlaybackChannelPrivate {
     gboolean                    is_active;
     guint32                     latency;
     guint32                     min_latency;
+
+    /* jitter buffer, see jitter_push() */
+    gboolean                    jitter_enabled;
+    gboolean                    jitter_active;
+    guint                       frequency;
+    guint                       frame_size;
+    guint                       period_frames;
+    GQueue                      jitter_queue;
+    guint                       jitter_frames;
+    guint                       jitter_timer;
+    gboolean                    jitter_prebuffering;
+    gboolean                    jitter_has_transit;
+    gint64                      jitter_last_transit;
+    gdouble                     jitter;
+    guint                       jitter_boost;
+    guint                       jitter_target;
+    gdouble                     jitter_depth;
+    gdouble                     jitter_drift;
+    gint64                      playout_start;
+    guint64                     playout_frames;
+    guint                       playout_batch;
+    guint8                      *playout_in;
+
+    /* loss concealment, see jitter_conceal() */
+    guint32                     decode_time;
+    guint                       conceal_run;
+    guint                       glitch_count;
+    guint                       concealed_ms;
 };
 
 G_DEFINE_TYPE(SpicePlaybackChannel, spice_playback_channel, SPICE_TYPE_CHANNEL)
@@ -70,6 +98,9 @@ enum {
     PROP_VOLUME,
     PROP_MUTE,
     PROP_MIN_LATENCY,
+    PROP_JITTER_BUFFER,
+    PROP_GLITCH_COUNT,
+    PROP_CONCEALED_MS,
 };
 
 /* Signals */
@@ -84,6 +115,7 @@ enum {
 
 static guint signals[SPICE_PLAYBACK_LAST_SIGNAL];
 static void channel_set_handlers(SpiceChannelClass *klass);
+static void jitter_clear(SpiceChannel *channel);
 
 /* ------------------------------------------------------------------ */
 
@@ -104,6 +136,8 @@ static void spice_playback_channel_reset_capabilities(SpiceChannel *channel)
 static void spice_playback_channel_init(SpicePlaybackChannel *channel)
 {
     channel->priv = SPICE_PLAYBACK_CHANNEL_GET_PRIVATE(channel);
+    channel->priv->jitter_enabled = !g_getenv("SPICE_DISABLE_JITTER_BUFFER");
+    g_queue_init(&channel->priv->jitter_queue);
 
     spice_playback_channel_reset_capabilities(SPICE_CHANNEL(channel));
 }
@@ -113,6 +147,7 @@ static void spice_playback_channel_finalize(GObject *obj)
     SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(obj)->priv;
 
     snd_codec_destroy(&c->codec);
+    jitter_clear(SPICE_CHANNEL(obj));
 
     g_free(c->volume);
     c->volume = NULL;
@@ -142,6 +177,15 @@ static void spice_playback_channel_get_property(GObject    *gobject,
     case PROP_MIN_LATENCY:
         g_value_set_uint(value, c->min_latency);
         break;
+    case PROP_JITTER_BUFFER:
+        g_value_set_boolean(value, c->jitter_enabled);
+        break;
+    case PROP_GLITCH_COUNT:
+        g_value_set_uint(value, c->glitch_count);
+        break;
+    case PROP_CONCEALED_MS:
+        g_value_set_uint(value, c->concealed_ms);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
         break;
@@ -153,6 +197,8 @@ static void spice_playback_channel_set_property(GObject      *gobject,
                                                 const GValue *value,
                                                 GParamSpec   *pspec)
 {
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(gobject)->priv;
+
     switch (prop_id) {
     case PROP_VOLUME:
         /* TODO: request guest volume change */
@@ -160,6 +206,9 @@ static void spice_playback_channel_set_property(GObject      *gobject,
     case PROP_MUTE:
         /* TODO: request guest mute change */
         break;
+    case PROP_JITTER_BUFFER:
+        c->jitter_enabled = g_value_get_boolean(value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
         break;
@@ -172,6 +221,7 @@ static void spice_playback_channel_reset(SpiceChannel *channel, gboolean migrati
     SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
 
     snd_codec_destroy(&c->codec);
+    jitter_clear(channel);
 
     SPICE_CHANNEL_CLASS(spice_playback_channel_parent_class)->channel_reset(channel, migrating);
 }
@@ -221,6 +271,69 @@ static void spice_playback_channel_class_init(SpicePlaybackChannelClass *klass)
                            0, G_MAXUINT32, SPICE_PLAYBACK_DEFAULT_LATENCY_MS,
                            G_PARAM_READWRITE |
                            G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpicePlaybackChannel:jitter-buffer:
+     *
+     * Whether audio packets are buffered before being played, to absorb
+     * the network jitter. When set, packets are ordered by their time
+     * stamp in a buffer whose depth adapts to the measured jitter, and
+     * #SpicePlaybackChannel::playback-data is emitted with periods of
+     * 10ms, paced by the local clock. The drift between the server and
+     * the client clocks is compensated by resampling slightly.
+     *
+     * The buffer adds at least 20ms of latency: applications favoring
+     * latency over continuity can unset it, so that each packet is
+     * emitted as soon as it is received. This is taken into account on
+     * the next playback start. It can also be disabled by setting
+     * SPICE_DISABLE_JITTER_BUFFER in the environment.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_JITTER_BUFFER,
+         g_param_spec_boolean("jitter-buffer",
+                              "Jitter buffer",
+                              "Buffer audio to absorb the network jitter",
+                              TRUE,
+                              G_PARAM_READWRITE |
+                              G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpicePlaybackChannel:glitch-count:
+     *
+     * The number of audio glitches since the channel was created: packets
+     * lost, dropped for being too late or failing to decode, and buffer
+     * underflows. This property is not notified.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_GLITCH_COUNT,
+         g_param_spec_uint("glitch-count",
+                           "Glitch count",
+                           "Number of audio glitches",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READABLE |
+                           G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpicePlaybackChannel:concealed-ms:
+     *
+     * The duration of audio, in ms, synthesized by the Opus decoder to
+     * conceal lost, late or corrupted packets since the channel was
+     * created. This property is not notified.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_CONCEALED_MS,
+         g_param_spec_uint("concealed-ms",
+                           "Concealed audio (ms)",
+                           "Duration of concealed audio in ms",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READABLE |
+                           G_PARAM_STATIC_STRINGS));
     /**
      * SpicePlaybackChannel::playback-start:
      * @channel: the #SpicePlaybackChannel that emitted the signal
@@ -249,7 +362,8 @@ static void spice_playback_channel_class_init(SpicePlaybackChannelClass *klass)
      * @data: pointer to audio data
      * @data_size: size in byte of @data
      *
-     * Provide audio data to be played.
+     * Provide audio data to be played. @data is only valid during the
+     * emission.
      **/
     signals[SPICE_PLAYBACK_DATA] =
         g_signal_new("playback-data",
@@ -298,6 +412,524 @@ static void spice_playback_channel_class_init(SpicePlaybackChannelClass *klass)
     channel_set_handlers(SPICE_CHANNEL_CLASS(klass));
 }
 
+/* ------------------------------------------------------------------ */
+/* PCM buffers                                                        */
+
+/*
+ * The PCM data emitted with playback-data lives in refcounted buffers,
+ * so that the backends can hold on to it rather than copy it, see
+ * spice_playback_data_ref(). Buffers of PLAYBACK_DATA_SIZE bytes, which
+ * fit a few periods, are recycled through a pool shared by all the
+ * channels: the backends may release them from any thread.
+ */
+#define PLAYBACK_DATA_SIZE      (4 * SND_CODEC_MAX_FRAME_SIZE * 2 * 2)
+#define PLAYBACK_DATA_POOL_MAX  64
+
+typedef struct PlaybackData {
+    gint ref_count;
+    guint size;
+    guint8 data[];
+} PlaybackData;
+
+static PlaybackData *data_pool[PLAYBACK_DATA_POOL_MAX];
+static guint data_pool_len;
+G_LOCK_DEFINE_STATIC(data_pool);
+
+static guint8 *playback_data_new(gsize size)
+{
+    PlaybackData *d = NULL;
+
+    if (size <= PLAYBACK_DATA_SIZE) {
+        G_LOCK(data_pool);
+        if (data_pool_len > 0)
+            d = data_pool[--data_pool_len];
+        G_UNLOCK(data_pool);
+        size = PLAYBACK_DATA_SIZE;
+    }
+    if (d == NULL) {
+        d = g_malloc(sizeof(PlaybackData) + size);
+        d->size = size;
+    }
+    d->ref_count = 1;
+
+    return d->data;
+}
+
+/**
+ * spice_playback_data_ref:
+ * @data: PCM data emitted with #SpicePlaybackChannel::playback-data
+ *
+ * Keep @data valid after the signal emission, until
+ * spice_playback_data_unref() is called.
+ *
+ * Returns: @data
+ **/
+G_GNUC_INTERNAL
+gpointer spice_playback_data_ref(gpointer data)
+{
+    PlaybackData *d = SPICE_CONTAINEROF(data, PlaybackData, data);
+
+    g_atomic_int_inc(&d->ref_count);
+
+    return data;
+}
+
+/* any thread */
+G_GNUC_INTERNAL
+void spice_playback_data_unref(gpointer data)
+{
+    PlaybackData *d = SPICE_CONTAINEROF(data, PlaybackData, data);
+
+    if (!g_atomic_int_dec_and_test(&d->ref_count))
+        return;
+
+    if (d->size == PLAYBACK_DATA_SIZE) {
+        G_LOCK(data_pool);
+        if (data_pool_len < PLAYBACK_DATA_POOL_MAX) {
+            data_pool[data_pool_len++] = d;
+            d = NULL;
+        }
+        G_UNLOCK(data_pool);
+    }
+    g_free(d);
+}
+
+/* ------------------------------------------------------------------ */
+/* jitter buffer                                                      */
+
+/*
+ * Decoded packets are queued ordered by time, and played out in
+ * periods of JITTER_PERIOD_MS paced by the monotonic clock, once the
+ * queue holds jitter_target ms. The target follows the interarrival
+ * jitter, estimated as in RFC 3550, and grows after each underflow.
+ * The difference between the average depth and the target, which
+ * grows or shrinks when the server clock drifts from ours, is
+ * compensated by taking a few more or fewer frames per period and
+ * resampling them linearly.
+ *
+ * Packets are pushed from the channel coroutine, and played from a
+ * timer attached to the same context. Packets are decoded directly in
+ * PCM buffers, and the periods are copied once, to the buffer which is
+ * emitted. When the backend has enough buffered, the timer runs less
+ * often and several periods are emitted at once.
+ */
+#define JITTER_PERIOD_MS        10
+#define JITTER_MIN_DEPTH_MS     20
+#define JITTER_MAX_DEPTH_MS     400
+#define JITTER_UNDERFLOW_MS     20
+#define JITTER_MAX_DRIFT        0.005
+#define JITTER_DRIFT_WINDOW_MS  2000.
+#define JITTER_MAX_CONCEAL_MS   60
+#define JITTER_MAX_BATCH        4
+#define JITTER_BATCH_LATENCY_MS 100
+
+typedef struct JitterPacket {
+    guint32 time;
+    guint n_frames;
+    guint offset;
+    guint8 *data;
+} JitterPacket;
+
+static gboolean jitter_playout(gpointer data);
+
+static void jitter_packet_free(JitterPacket *p)
+{
+    spice_playback_data_unref(p->data);
+    g_slice_free(JitterPacket, p);
+}
+
+static void jitter_clear(SpiceChannel *channel)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+    JitterPacket *p;
+
+    if (c->jitter_timer != 0) {
+        g_coroutine_source_remove(&channel->priv->coroutine, c->jitter_timer);
+        c->jitter_timer = 0;
+    }
+    while ((p = g_queue_pop_head(&c->jitter_queue)) != NULL)
+        jitter_packet_free(p);
+    c->jitter_frames = 0;
+    c->jitter_active = FALSE;
+
+    g_free(c->playout_in);
+    c->playout_in = NULL;
+}
+
+static void jitter_start(SpiceChannel *channel, guint channels, guint frequency)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+
+    jitter_clear(channel);
+    if (channels == 0 || frequency == 0)
+        return;
+
+    /* the deadline and concealment also apply without the buffer */
+    c->frequency = frequency;
+    c->frame_size = channels * sizeof(gint16);
+
+    /* the resampling needs at least 2 frames per period */
+    if (!c->jitter_enabled || frequency * JITTER_PERIOD_MS / 1000 < 2)
+        return;
+
+    c->period_frames = frequency * JITTER_PERIOD_MS / 1000;
+    /* the drift correction takes at most a few more frames per period */
+    c->playout_in = g_malloc((c->period_frames + 8) * c->frame_size);
+    c->playout_batch = 1;
+
+    c->jitter_active = TRUE;
+    c->jitter_prebuffering = TRUE;
+    c->jitter_has_transit = FALSE;
+    c->jitter = 0;
+    c->jitter_boost = 0;
+    c->jitter_target = JITTER_MIN_DEPTH_MS;
+    c->jitter_depth = JITTER_MIN_DEPTH_MS;
+    c->jitter_drift = 0;
+}
+
+static guint jitter_depth_ms(SpicePlaybackChannelPrivate *c)
+{
+    return (guint64)c->jitter_frames * 1000 / c->frequency;
+}
+
+/* copy @n_frames frames from the head of the queue to @dest, or drop
+   them if @dest is NULL */
+static void jitter_read(SpicePlaybackChannelPrivate *c, guint8 *dest, guint n_frames)
+{
+    while (n_frames > 0) {
+        JitterPacket *p = g_queue_peek_head(&c->jitter_queue);
+        guint n;
+
+        g_return_if_fail(p != NULL);
+
+        n = MIN(n_frames, p->n_frames - p->offset);
+        if (dest) {
+            memcpy(dest, p->data + p->offset * c->frame_size, n * c->frame_size);
+            dest += n * c->frame_size;
+        }
+        p->offset += n;
+        n_frames -= n;
+        c->jitter_frames -= n;
+        /* the time of the next frame to be played */
+        c->last_time = p->time + (guint64)p->offset * 1000 / c->frequency;
+
+        if (p->offset == p->n_frames)
+            jitter_packet_free(g_queue_pop_head(&c->jitter_queue));
+    }
+}
+
+/* the first and last frames are kept, so that consecutive periods join.
+ * @n_out is the period, of at least 2 frames, see jitter_start() */
+static void jitter_resample(SpicePlaybackChannelPrivate *c, const gint16 *in, guint n_in,
+                            gint16 *out, guint n_out)
+{
+    guint channels = c->frame_size / sizeof(gint16);
+    guint i, ch;
+
+    for (i = 0; i < n_out; i++) {
+        guint64 pos = (guint64)i * (n_in - 1) * 65536 / (n_out - 1);
+        guint idx = pos >> 16;
+        gint64 frac = pos & 0xffff;
+
+        for (ch = 0; ch < channels; ch++) {
+            gint64 a = in[idx * channels + ch];
+            gint64 b = idx + 1 < n_in ? in[(idx + 1) * channels + ch] : a;
+
+            out[i * channels + ch] = a + (((b - a) * frac) >> 16);
+        }
+    }
+}
+
+/* emits and releases @data */
+static void jitter_emit(SpiceChannel *channel, guint8 *data, guint n_frames)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+
+    g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_DATA], 0,
+                            data, n_frames * c->frame_size);
+    spice_playback_data_unref(data);
+
+    if ((c->frame_count++ % 100) == 0) {
+        g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_GET_DELAY], 0);
+        /* forget about an old underflow */
+        if (c->jitter_boost > 0)
+            c->jitter_boost--;
+    }
+}
+
+static gboolean jitter_fill_period(SpiceChannel *channel, guint8 *dest)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+    gdouble correction;
+    gint delta;
+    guint n_in;
+
+    c->jitter_depth += (jitter_depth_ms(c) - c->jitter_depth) / 32;
+    correction = (c->jitter_depth - c->jitter_target) / JITTER_DRIFT_WINDOW_MS;
+    correction = CLAMP(correction, -JITTER_MAX_DRIFT, JITTER_MAX_DRIFT);
+    c->jitter_drift += c->period_frames * correction;
+    delta = (gint)c->jitter_drift;
+    n_in = c->period_frames + delta;
+
+    if (c->jitter_frames < n_in) {
+        if (c->jitter_frames < c->period_frames)
+            return FALSE;
+        /* short after a concealment, correct later */
+        delta = 0;
+        n_in = c->period_frames;
+    }
+
+    c->jitter_drift -= delta;
+    if (delta == 0) {
+        jitter_read(c, dest, c->period_frames);
+    } else {
+        jitter_read(c, c->playout_in, n_in);
+        jitter_resample(c, (gint16 *)c->playout_in, n_in,
+                        (gint16 *)dest, c->period_frames);
+    }
+
+    return TRUE;
+}
+
+/* coroutine or playout context */
+/* queues and takes @data */
+static void jitter_queue(SpiceChannel *channel, guint32 time, guint8 *data, guint n_frames)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+    guint32 end = time + (guint64)n_frames * 1000 / c->frequency;
+    JitterPacket *p;
+    GList *l;
+
+    p = g_slice_new(JitterPacket);
+    p->time = time;
+    p->n_frames = n_frames;
+    p->offset = 0;
+    p->data = data;
+
+    for (l = c->jitter_queue.tail; l != NULL; l = l->prev) {
+        JitterPacket *prev = l->data;
+        if ((gint32)(time - prev->time) >= 0)
+            break;
+    }
+    if (l == NULL)
+        g_queue_push_head(&c->jitter_queue, p);
+    else
+        g_queue_insert_after(&c->jitter_queue, l, p);
+    c->jitter_frames += n_frames;
+    if ((gint32)(end - c->decode_time) > 0)
+        c->decode_time = end;
+
+    if (jitter_depth_ms(c) > JITTER_MAX_DEPTH_MS) {
+        guint keep = (guint64)c->jitter_target * c->frequency / 1000;
+
+        CHANNEL_DEBUG(channel, "playback overflow, dropping %ums",
+                      jitter_depth_ms(c) - c->jitter_target);
+        jitter_read(c, NULL, c->jitter_frames - keep);
+    }
+
+    if (c->jitter_prebuffering && jitter_depth_ms(c) >= c->jitter_target) {
+        c->jitter_prebuffering = FALSE;
+        c->jitter_depth = c->jitter_target;
+        c->jitter_drift = 0;
+        c->playout_start = g_get_monotonic_time();
+        c->playout_frames = 0;
+        c->playout_batch = 1;
+        c->jitter_timer = g_coroutine_timeout_add_full(&channel->priv->coroutine,
+                                                       G_PRIORITY_HIGH, JITTER_PERIOD_MS,
+                                                       jitter_playout, channel, NULL);
+    }
+}
+
+/*
+ * Synthesize the frame following the last decoded one, and queue it
+ * at decode_time, or emit it right away without the jitter buffer.
+ * Opus does packet loss concealment when decoding without data. The
+ * decoder state must not have moved past the gap, this is called
+ * before decoding the packet following a gap, or when the buffer is
+ * empty.
+ *
+ * coroutine or playout context
+ */
+static gboolean jitter_conceal(SpiceChannel *channel)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+    int n = SND_CODEC_MAX_FRAME_SIZE * 2 * 2;
+    guint8 *pcm;
+    guint n_frames;
+
+    if (c->frequency == 0 || c->mode != SPICE_AUDIO_DATA_MODE_OPUS || c->codec == NULL)
+        return FALSE;
+
+    pcm = playback_data_new(n);
+    if (snd_codec_decode(c->codec, NULL, 0, pcm, &n) != SND_CODEC_OK ||
+        n < (int)c->frame_size) {
+        spice_playback_data_unref(pcm);
+        return FALSE;
+    }
+    n_frames = n / c->frame_size;
+
+    c->concealed_ms += (guint64)n_frames * 1000 / c->frequency;
+    if (c->jitter_active) {
+        jitter_queue(channel, c->decode_time, pcm, n_frames);
+    } else {
+        c->decode_time += (guint64)n_frames * 1000 / c->frequency;
+        jitter_emit(channel, pcm, n_frames);
+    }
+
+    return TRUE;
+}
+
+/* main or I/O thread context */
+static gboolean jitter_playout(gpointer data)
+{
+    SpiceChannel *channel = data;
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+    guint period_size = c->period_frames * c->frame_size;
+    guint max_batch = CLAMP(PLAYBACK_DATA_SIZE / period_size, 1, JITTER_MAX_BATCH);
+    guint8 *out = NULL;
+    guint batch, n = 0;
+    guint64 due;
+
+    due = (g_get_monotonic_time() - c->playout_start) * c->frequency / G_USEC_PER_SEC;
+
+    /* the timer is removed if the channel is reset while emitting */
+    while (c->jitter_timer != 0 && c->playout_frames + c->period_frames <= due) {
+        if (out == NULL)
+            out = playback_data_new(max_batch * period_size);
+
+        if (!jitter_fill_period(channel, out + n * period_size)) {
+            /* bridge short stalls rather than restart buffering */
+            if (c->conceal_run < JITTER_MAX_CONCEAL_MS / JITTER_PERIOD_MS &&
+                jitter_conceal(channel)) {
+                if (c->conceal_run++ == 0)
+                    c->glitch_count++;
+                continue;
+            }
+            c->glitch_count++;
+            c->jitter_boost = MIN(c->jitter_boost + JITTER_UNDERFLOW_MS, JITTER_MAX_DEPTH_MS);
+            CHANNEL_DEBUG(channel, "playback underflow, jitter %.1fms, boost %ums",
+                          c->jitter, c->jitter_boost);
+            c->jitter_prebuffering = TRUE;
+            c->jitter_timer = 0;
+            break;
+        }
+        c->playout_frames += c->period_frames;
+
+        if (++n == max_batch) {
+            jitter_emit(channel, out, n * c->period_frames);
+            out = NULL;
+            n = 0;
+        }
+    }
+
+    if (n > 0)
+        jitter_emit(channel, out, n * c->period_frames);
+    else if (out != NULL)
+        spice_playback_data_unref(out);
+
+    if (c->jitter_timer == 0)
+        return FALSE;
+
+    /* wake up less often when the backend is well ahead */
+    batch = c->latency >= JITTER_BATCH_LATENCY_MS ? max_batch : 1;
+    if (batch != c->playout_batch) {
+        c->playout_batch = batch;
+        c->jitter_timer = g_coroutine_timeout_add_full(&channel->priv->coroutine,
+                                                       G_PRIORITY_HIGH,
+                                                       batch * JITTER_PERIOD_MS,
+                                                       jitter_playout, channel, NULL);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Check @time against the audio decoded so far, before decoding the
+ * packet. Returns FALSE if the packet is too late to be played: its
+ * time was already played, or concealed. Gaps up to
+ * JITTER_MAX_CONCEAL_MS are concealed.
+ *
+ * coroutine context
+ */
+static gboolean jitter_check_time(SpiceChannel *channel, guint32 time)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+    gint32 gap = time - c->decode_time;
+
+    if (gap < -JITTER_MAX_DEPTH_MS || gap > JITTER_MAX_CONCEAL_MS) {
+        /* a discontinuity, not a loss */
+        c->decode_time = time;
+        return TRUE;
+    }
+
+    /* the same deadline applies to all the codecs, but only Opus
+       conceals: a one period difference is rounding with the others */
+    if (gap < 0 && (c->mode == SPICE_AUDIO_DATA_MODE_OPUS || gap <= -JITTER_PERIOD_MS)) {
+        CHANNEL_DEBUG(channel, "dropping late audio packet, time %u, %dms late", time, -gap);
+        c->glitch_count++;
+        return FALSE;
+    }
+
+    if (gap >= JITTER_PERIOD_MS) {
+        CHANNEL_DEBUG(channel, "audio gap of %dms at time %u", gap, time);
+        c->glitch_count++;
+        while ((gint32)(time - c->decode_time) >= JITTER_PERIOD_MS &&
+               jitter_conceal(channel))
+            ;
+    }
+
+    return TRUE;
+}
+
+/* coroutine context, takes @data */
+static void jitter_push(SpiceChannel *channel, guint32 time, guint8 *data, gint size)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+    guint n_frames = size / c->frame_size;
+    gint64 transit;
+
+    if (n_frames == 0) {
+        spice_playback_data_unref(data);
+        return;
+    }
+
+    transit = g_get_monotonic_time() / 1000 - time;
+    if (c->jitter_has_transit) {
+        gint64 d = ABS(transit - c->jitter_last_transit);
+
+        /* large jumps are mm-time resets, not jitter */
+        if (d < 1000)
+            c->jitter += (d - c->jitter) / 16;
+    }
+    c->jitter_last_transit = transit;
+    c->jitter_has_transit = TRUE;
+    c->jitter_target = CLAMP(2 * JITTER_PERIOD_MS + 4 * c->jitter + c->jitter_boost,
+                             JITTER_MIN_DEPTH_MS, JITTER_MAX_DEPTH_MS);
+    c->conceal_run = 0;
+
+    jitter_queue(channel, time, data, n_frames);
+}
+
+/* coroutine context */
+static void jitter_drain(SpiceChannel *channel)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+
+    if (c->jitter_timer != 0) {
+        g_coroutine_source_remove(&channel->priv->coroutine, c->jitter_timer);
+        c->jitter_timer = 0;
+    }
+
+    while (c->jitter_active && c->jitter_frames > 0) {
+        guint n = MIN(c->jitter_frames, c->period_frames);
+        guint8 *out = playback_data_new(n * c->frame_size);
+
+        jitter_read(c, out, n);
+        jitter_emit(channel, out, n);
+    }
+}
+
 /* ------------------------------------------------------------------ */
 
 /* coroutine context */
@@ -311,31 +943,57 @@ static void playback_handle_data(SpiceChannel *channel, SpiceMsgIn *in)
                   packet->time, packet->data, packet->data_size);
 #endif
 
-    if (c->last_time > packet->time)
-        g_warn_if_reached();
+    /* the decoded time is only tracked for S16 */
+    if (c->frequency != 0 && !jitter_check_time(channel, packet->time))
+        return;
 
-    c->last_time = packet->time;
+    if (!c->jitter_active)
+        c->last_time = packet->time;
 
-    uint8_t *data = packet->data;
-    int n = packet->data_size;
-    uint8_t pcm[SND_CODEC_MAX_FRAME_SIZE * 2 * 2];
+    guint8 *data;
+    guint n_frames;
+    int n;
 
     if (c->mode != SPICE_AUDIO_DATA_MODE_RAW) {
-        n = sizeof(pcm);
-        data = pcm;
+        n = SND_CODEC_MAX_FRAME_SIZE * 2 * 2;
+        data = playback_data_new(n);
 
         if (snd_codec_decode(c->codec, packet->data, packet->data_size,
-                    pcm, &n) != SND_CODEC_OK) {
+                    data, &n) != SND_CODEC_OK) {
             g_warning("snd_codec_decode() error");
+            spice_playback_data_unref(data);
+            c->glitch_count++;
+            jitter_conceal(channel);
             return;
         }
+    } else {
+        n = packet->data_size;
+        data = playback_data_new(n);
+        memcpy(data, packet->data, n);
     }
 
-    g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_DATA], 0, data, n);
+    if (c->jitter_active) {
+        jitter_push(channel, packet->time, data, n);
+        return;
+    }
 
-    if ((c->frame_count++ % 100) == 0) {
-        g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_GET_DELAY], 0);
+    if (c->frequency == 0) {
+        g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_DATA], 0, data, n);
+        spice_playback_data_unref(data);
+
+        if ((c->frame_count++ % 100) == 0) {
+            g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_GET_DELAY], 0);
+        }
+        return;
+    }
+
+    n_frames = n / c->frame_size;
+    if (n_frames == 0) {
+        spice_playback_data_unref(data);
+        return;
     }
+    c->decode_time = packet->time + (guint64)n_frames * 1000 / c->frequency;
+    jitter_emit(channel, data, n_frames);
 }
 
 /* coroutine context */
@@ -369,7 +1027,9 @@ static void playback_handle_start(SpiceChannel *channel, SpiceMsgIn *in)
                   start->format, start->channels, start->frequency, start->time);
 
     c->frame_count = 0;
+    c->frequency = 0;
     c->last_time = start->time;
+    c->decode_time = start->time;
     c->is_active = TRUE;
     c->min_latency = SPICE_PLAYBACK_DEFAULT_LATENCY_MS;
     snd_codec_destroy(&c->codec);
@@ -380,6 +1040,8 @@ static void playback_handle_start(SpiceChannel *channel, SpiceMsgIn *in)
             return;
         }
     }
+    if (start->format == SPICE_AUDIO_FMT_S16)
+        jitter_start(channel, start->channels, start->frequency);
     g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_START], 0,
                             start->format, start->channels, start->frequency);
 }
@@ -389,6 +1051,8 @@ static void playback_handle_stop(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
 
+    jitter_drain(channel);
+    jitter_clear(channel);
     g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_STOP], 0);
     c->is_active = FALSE;
 }
@@ -457,8 +1121,9 @@ void spice_playback_channel_set_delay(SpicePlaybackChannel *channel, guint32 del
 
     c = channel->priv;
     c->latency = delay_ms;
+    /* the mm-time of the audio being heard */
     spice_session_set_mm_time(spice_channel_get_session(SPICE_CHANNEL(channel)),
-                              c->last_time - delay_ms);
+                              SPICE_MM_CLOCK_AUDIO, c->last_time - delay_ms);
 }
 
 G_GNUC_INTERNAL
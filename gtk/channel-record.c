@@ -57,6 +57,9 @@ struct _SpiceRecordChannelPrivate {
     gsize                       frame_bytes;
     guint8                      *last_frame;
     gsize                       last_frame_current;
+    guint                       frequency;
+    gsize                       sample_bytes;
+    gsize                       batch_bytes;
     guint8                      nchannels;
     guint16                     *volume;
     guint8                      mute;
@@ -304,27 +307,114 @@ static void spice_record_start_mark(SpiceRecordChannel *channel, uint32_t time)
     spice_msg_out_send(msg);
 }
 
+/*
+ * Encoded frames, and raw data, are written to pooled buffers which are
+ * attached to the messages by reference, and released once sent. The
+ * protocol carries one codec frame per message, but raw data can be
+ * sent in messages of up to RECORD_MAX_BATCH_MS.
+ */
+#define RECORD_MAX_BATCH_MS     40
+#define RECORD_DATA_SIZE        MAX(8192, SND_CODEC_MAX_COMPRESSED_BYTES)
+#define RECORD_DATA_POOL_MAX    32
+
+static guint8 *data_pool[RECORD_DATA_POOL_MAX];
+static guint data_pool_len;
+G_LOCK_DEFINE_STATIC(data_pool);
+
+static guint8 *record_data_new(void)
+{
+    guint8 *data = NULL;
+
+    G_LOCK(data_pool);
+    if (data_pool_len > 0)
+        data = data_pool[--data_pool_len];
+    G_UNLOCK(data_pool);
+
+    return data ? data : g_malloc(RECORD_DATA_SIZE);
+}
+
+static void record_data_free(uint8_t *data, void *opaque)
+{
+    G_LOCK(data_pool);
+    if (data_pool_len < RECORD_DATA_POOL_MAX) {
+        data_pool[data_pool_len++] = data;
+        data = NULL;
+    }
+    G_UNLOCK(data_pool);
+    g_free(data);
+}
+
+/* time offset of @offset bytes from the start of the data */
+static gint32 record_bytes_to_ms(SpiceRecordChannelPrivate *rc, gint64 offset)
+{
+    if (rc->frequency == 0)
+        return 0;
+
+    return offset * 1000 / (gint64)(rc->frequency * rc->sample_bytes);
+}
+
+/* takes @payload */
+static void record_send_packet(SpiceRecordChannel *channel, uint32_t time,
+                               guint8 *payload, gsize size)
+{
+    SpiceMsgcRecordPacket p = {0, };
+    SpiceMsgOut *msg;
+
+    p.time = time;
+    msg = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_RECORD_DATA);
+    msg->marshallers->msgc_record_data(msg->marshaller, &p);
+    spice_marshaller_add_ref_full(msg->marshaller, payload, size,
+                                  record_data_free, NULL);
+    spice_msg_out_send(msg);
+}
+
+static gboolean record_encode_frame(SpiceRecordChannel *channel, guint8 *frame,
+                                    uint32_t time)
+{
+    SpiceRecordChannelPrivate *rc = channel->priv;
+    guint8 *payload = record_data_new();
+    int len = RECORD_DATA_SIZE;
+
+    if (snd_codec_encode(rc->codec, frame, rc->frame_bytes, payload, &len) != SND_CODEC_OK) {
+        g_warning("encode failed");
+        record_data_free(payload, NULL);
+        return FALSE;
+    }
+
+    record_send_packet(channel, time, payload, len);
+    return TRUE;
+}
+
 /**
  * spice_record_send_data:
  * @channel:
  * @data: PCM data
  * @bytes: size of @data
- * @time: stream timestamp
+ * @time: stream timestamp in ms, or 0
  *
  * Send recorded PCM data to the guest.
+ *
+ * When @time is 0, the end of @data is timestamped with the current
+ * multimedia time of the session.
  **/
 void spice_record_send_data(SpiceRecordChannel *channel, gpointer data,
                             gsize bytes, uint32_t time)
 {
     SpiceRecordChannelPrivate *rc;
-    SpiceMsgcRecordPacket p = {0, };
+    guint8 *in = data;
+    gsize batch, offset = 0;
 
     g_return_if_fail(channel != NULL);
     g_return_if_fail(spice_channel_get_read_only(SPICE_CHANNEL(channel)) == FALSE);
 
-    uint8_t *encode_buf = NULL;
-
     rc = channel->priv;
+    g_return_if_fail(rc->frame_bytes > 0);
+
+    if (time == 0) {
+        SpiceSession *session = spice_channel_get_session(SPICE_CHANNEL(channel));
+
+        time = spice_session_get_mm_time(session) - record_bytes_to_ms(rc, bytes);
+    }
 
     if (!rc->started) {
         spice_record_mode(channel, time, rc->mode, NULL, 0);
@@ -332,61 +422,47 @@ void spice_record_send_data(SpiceRecordChannel *channel, gpointer data,
         rc->started = TRUE;
     }
 
-    if (rc->mode != SPICE_AUDIO_DATA_MODE_RAW)
-        encode_buf = g_alloca(SND_CODEC_MAX_COMPRESSED_BYTES);
+    if (rc->mode == SPICE_AUDIO_DATA_MODE_RAW) {
+        batch = rc->batch_bytes > 0 ? rc->batch_bytes : RECORD_DATA_SIZE;
+        while (offset < bytes) {
+            gsize n = MIN(bytes - offset, batch);
+            guint8 *payload = record_data_new();
 
-    p.time = time;
-
-    while (bytes > 0) {
-        gsize n;
-        int frame_size;
-        SpiceMsgOut *msg;
-        uint8_t *frame;
-
-        if (rc->last_frame_current > 0) {
-            /* complete previous frame */
-            n = MIN(bytes, rc->frame_bytes - rc->last_frame_current);
-            memcpy(rc->last_frame + rc->last_frame_current, data, n);
-            rc->last_frame_current += n;
-            if (rc->last_frame_current < rc->frame_bytes)
-                /* if the frame is still incomplete, return */
-                break;
-            frame = rc->last_frame;
-            frame_size = rc->frame_bytes;
-        } else {
-            n = MIN(bytes, rc->frame_bytes);
-            frame_size = n;
-            frame = data;
+            memcpy(payload, in + offset, n);
+            record_send_packet(channel, time + record_bytes_to_ms(rc, offset), payload, n);
+            offset += n;
         }
+        return;
+    }
 
-        if (rc->last_frame_current == 0 &&
-            n < rc->frame_bytes) {
-            /* start a new frame */
-            memcpy(rc->last_frame, data, n);
-            rc->last_frame_current = n;
-            break;
-        }
+    if (rc->last_frame_current > 0) {
+        /* complete previous frame */
+        gsize n = MIN(bytes, rc->frame_bytes - rc->last_frame_current);
 
-        if (rc->mode != SPICE_AUDIO_DATA_MODE_RAW) {
-            int len = SND_CODEC_MAX_COMPRESSED_BYTES;
-            if (snd_codec_encode(rc->codec, frame, frame_size, encode_buf, &len) != SND_CODEC_OK) {
-                g_warning("encode failed");
-                return;
-            }
-            frame = encode_buf;
-            frame_size = len;
-        }
+        memcpy(rc->last_frame + rc->last_frame_current, in, n);
+        rc->last_frame_current += n;
+        if (rc->last_frame_current < rc->frame_bytes)
+            /* if the frame is still incomplete, return */
+            return;
 
-        msg = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_RECORD_DATA);
-        msg->marshallers->msgc_record_data(msg->marshaller, &p);
-        spice_marshaller_add(msg->marshaller, frame, frame_size);
-        spice_msg_out_send(msg);
+        offset = n;
+        if (!record_encode_frame(channel, rc->last_frame,
+                                 time - record_bytes_to_ms(rc, rc->frame_bytes - n)))
+            return;
+        rc->last_frame_current = 0;
+    }
 
-        if (rc->last_frame_current == rc->frame_bytes)
-            rc->last_frame_current = 0;
+    /* encode the complete frames where they are */
+    while (bytes - offset >= rc->frame_bytes) {
+        if (!record_encode_frame(channel, in + offset, time + record_bytes_to_ms(rc, offset)))
+            return;
+        offset += rc->frame_bytes;
+    }
 
-        bytes -= n;
-        data = (guint8*)data + n;
+    if (offset < bytes) {
+        /* start a new frame */
+        memcpy(rc->last_frame, in + offset, bytes - offset);
+        rc->last_frame_current = bytes - offset;
     }
 }
 
@@ -420,6 +496,10 @@ static void record_handle_start(SpiceChannel *channel, SpiceMsgIn *in)
     c->frame_bytes = frame_size * 16 * start->channels / 8;
     c->last_frame = g_malloc0(c->frame_bytes);
     c->last_frame_current = 0;
+    c->frequency = start->frequency;
+    c->sample_bytes = 16 * start->channels / 8;
+    c->batch_bytes = MIN(RECORD_DATA_SIZE, RECORD_MAX_BATCH_MS * start->frequency / 1000 * c->sample_bytes);
+    c->batch_bytes -= c->batch_bytes % c->sample_bytes;
 
     g_coroutine_signal_emit(channel, signals[SPICE_RECORD_START], 0,
                             start->format, start->channels, start->frequency);
@@ -584,7 +584,6 @@ typedef struct device_error_data {
     SpiceUsbredirChannel *channel;
     SpiceUsbDevice *spice_device;
     GError *error;
-    struct coroutine *caller;
 } device_error_data;
 
 /* main context */
@@ -603,7 +602,6 @@ static gboolean device_error(gpointer user_data)
                 data->spice_device, data->error);
     }
 
-    coroutine_yieldto(data->caller, NULL);
     return FALSE;
 }
 
@@ -668,11 +666,9 @@ static void usbredir_handle_msg(SpiceChannel *c, SpiceMsgIn *in)
         CHANNEL_DEBUG(c, "%s", err->message);
 
         data.channel = channel;
-        data.caller = coroutine_self();
         data.spice_device = g_boxed_copy(spice_usb_device_get_type(), spice_device);
         data.error = err;
-        g_idle_add(device_error, &data);
-        coroutine_yield(NULL);
+        g_coroutine_call_main(device_error, &data);
 
         g_boxed_free(spice_usb_device_get_type(), data.spice_device);
 
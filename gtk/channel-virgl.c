@@ -197,9 +197,9 @@ static void spice_virgl_handle_update(SpiceChannel *channel, SpiceMsgIn *in)
     CHANNEL_DEBUG(channel, "update %dx%d+%d+%d",
                   update->w, update->h, update->x, update->y);
 
-    g_coroutine_signal_emit(channel, signals[SIGNAL_VIRGL_UPDATE], 0,
-                            update->x, update->y,
-                            update->w, update->h);
+    g_coroutine_signal_emit_queued(channel, signals[SIGNAL_VIRGL_UPDATE], 0,
+                                   update->x, update->y,
+                                   update->w, update->h);
 }
 
 static void channel_set_handlers(SpiceChannelClass *klass)
@@ -21,9 +21,13 @@
 #ifndef _CONTINUATION_H_
 #define _CONTINUATION_H_
 
+#include "config.h"
+
 #include <stddef.h>
+#if !WITH_CONTINUATION_ASM
 #include <ucontext.h>
 #include <setjmp.h>
+#endif
 
 struct continuation
 {
@@ -33,10 +37,15 @@ struct continuation
 	int (*release)(struct continuation *cc);
 
 	/* private */
+#if WITH_CONTINUATION_ASM
+	void *sp;
+	struct continuation *last;
+#else
 	ucontext_t uc;
 	ucontext_t last;
-	int exited;
 	jmp_buf jmp;
+#endif
+	int exited;
 };
 
 void cc_init(struct continuation *cc);
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2015 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <glib.h>
+
+#include "continuation.h"
+
+/*
+ * Register-only continuation switch.
+ *
+ * swapcontext() saves and restores the signal mask, which costs a
+ * rt_sigprocmask syscall on every switch. Coroutines never change
+ * the signal mask, so only the registers the ABI requires a callee
+ * to preserve are saved here, pushed on the stack of the continuation
+ * being suspended; its stack pointer is all that is kept in
+ * struct continuation.
+ *
+ * cc_asm_switch(save, sp, ret) stores the current stack pointer in
+ * *save, resumes the continuation whose stack pointer is sp, and
+ * makes the cc_asm_switch() call that suspended it return ret.
+ *
+ * A new continuation starts in cc_asm_start with a frame prepared by
+ * cc_init(): the continuation pointer and continuation_trampoline are
+ * found in callee-saved registers.
+ */
+long cc_asm_switch(void **save, void *sp, long ret) G_GNUC_INTERNAL;
+void cc_asm_start(void) G_GNUC_INTERNAL;
+
+#if defined(__x86_64__)
+
+/* mxcsr/x87 control word, r15, r14, r13, r12, rbx, rbp, return address */
+#define CC_FRAME_WORDS 8
+#define CC_FRAME_ARG   4
+#define CC_FRAME_FUNC   3
+#define CC_FRAME_RET   7
+
+__asm__(
+	".text\n"
+	".p2align 4\n"
+	".globl cc_asm_switch\n"
+	".hidden cc_asm_switch\n"
+	".type cc_asm_switch, @function\n"
+	"cc_asm_switch:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	movq %rdx, %rax\n"
+	"	ret\n"
+	".size cc_asm_switch, .-cc_asm_switch\n"
+	"\n"
+	".p2align 4\n"
+	".globl cc_asm_start\n"
+	".hidden cc_asm_start\n"
+	".type cc_asm_start, @function\n"
+	"cc_asm_start:\n"
+	"	movq %r12, %rdi\n"
+	"	andq $-16, %rsp\n"
+	"	callq *%r13\n"
+	"	ud2\n"
+	".size cc_asm_start, .-cc_asm_start\n"
+);
+
+static void cc_frame_init(uintptr_t *frame)
+{
+	/* default mxcsr (all exceptions masked) and x87 control word */
+	frame[0] = 0x1f80 | ((uintptr_t)0x037f << 32);
+}
+
+#elif defined(__aarch64__)
+
+/* x19-x28, x29 (fp), x30 (lr), d8-d15 */
+#define CC_FRAME_WORDS 20
+#define CC_FRAME_ARG   0 /* x19 */
+#define CC_FRAME_FUNC   1 /* x20 */
+#define CC_FRAME_RET   11 /* x30 */
+
+__asm__(
+	".text\n"
+	".p2align 4\n"
+	".globl cc_asm_switch\n"
+	".hidden cc_asm_switch\n"
+	".type cc_asm_switch, %function\n"
+	"cc_asm_switch:\n"
+	"	sub sp, sp, #160\n"
+	"	stp x19, x20, [sp, #0]\n"
+	"	stp x21, x22, [sp, #16]\n"
+	"	stp x23, x24, [sp, #32]\n"
+	"	stp x25, x26, [sp, #48]\n"
+	"	stp x27, x28, [sp, #64]\n"
+	"	stp x29, x30, [sp, #80]\n"
+	"	stp d8, d9, [sp, #96]\n"
+	"	stp d10, d11, [sp, #112]\n"
+	"	stp d12, d13, [sp, #128]\n"
+	"	stp d14, d15, [sp, #144]\n"
+	"	mov x3, sp\n"
+	"	str x3, [x0]\n"
+	"	mov sp, x1\n"
+	"	ldp x19, x20, [sp, #0]\n"
+	"	ldp x21, x22, [sp, #16]\n"
+	"	ldp x23, x24, [sp, #32]\n"
+	"	ldp x25, x26, [sp, #48]\n"
+	"	ldp x27, x28, [sp, #64]\n"
+	"	ldp x29, x30, [sp, #80]\n"
+	"	ldp d8, d9, [sp, #96]\n"
+	"	ldp d10, d11, [sp, #112]\n"
+	"	ldp d12, d13, [sp, #128]\n"
+	"	ldp d14, d15, [sp, #144]\n"
+	"	add sp, sp, #160\n"
+	"	mov x0, x2\n"
+	"	ret\n"
+	".size cc_asm_switch, .-cc_asm_switch\n"
+	"\n"
+	".p2align 4\n"
+	".globl cc_asm_start\n"
+	".hidden cc_asm_start\n"
+	".type cc_asm_start, %function\n"
+	"cc_asm_start:\n"
+	"	mov x0, x19\n"
+	"	blr x20\n"
+	"	brk #0\n"
+	".size cc_asm_start, .-cc_asm_start\n"
+);
+
+static void cc_frame_init(uintptr_t *frame)
+{
+}
+
+#else
+#error "no assembly continuation switch for this architecture, use --with-coroutine=ucontext"
+#endif
+
+static void continuation_trampoline(struct continuation *cc)
+{
+	cc->entry(cc);
+
+	/* return to whoever switched to us last, never resumed */
+	cc->exited = 1;
+	cc_asm_switch(&cc->sp, cc->last->sp, 1);
+	g_assert_not_reached();
+}
+
+void cc_init(struct continuation *cc)
+{
+	uintptr_t top = (uintptr_t)(cc->stack + cc->stack_size) & ~(uintptr_t)15;
+	uintptr_t *frame = (uintptr_t *)top - CC_FRAME_WORDS;
+
+	memset(frame, 0, CC_FRAME_WORDS * sizeof(uintptr_t));
+	cc_frame_init(frame);
+	frame[CC_FRAME_ARG] = (uintptr_t)cc;
+	frame[CC_FRAME_FUNC] = (uintptr_t)continuation_trampoline;
+	frame[CC_FRAME_RET] = (uintptr_t)cc_asm_start;
+
+	cc->sp = frame;
+	cc->last = NULL;
+	cc->exited = 0;
+}
+
+int cc_release(struct continuation *cc)
+{
+	if (cc->release)
+		return cc->release(cc);
+
+	return 0;
+}
+
+int cc_swap(struct continuation *from, struct continuation *to)
+{
+	to->last = from;
+	return (int)cc_asm_switch(&from->sp, to->sp, 0);
+}
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
@@ -31,6 +31,11 @@
 #include <glib.h>
 #endif
 
+#if WITH_UCONTEXT && defined(HAVE_TLS)
+/* each thread has its own leader and current coroutine */
+#define COROUTINE_THREADS 1
+#endif
+
 struct coroutine
 {
 	size_t stack_size;
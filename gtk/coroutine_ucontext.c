@@ -29,12 +29,99 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "coroutine.h"
 
 #ifndef MAP_ANONYMOUS
 # define MAP_ANONYMOUS MAP_ANON
 #endif
 
+#ifndef MAP_STACK
+# define MAP_STACK 0
+#endif
+
+/*
+ * Stacks of exited coroutines are kept in a pool, so that channels
+ * reconnecting or being swapped during migration don't have to map
+ * new ones. Each stack has a PROT_NONE guard page below it to catch
+ * overflows. The pages of pooled stacks are given back to the kernel
+ * with madvise(), only the mappings are kept.
+ */
+#define STACK_POOL_MAX 16
+
+static struct {
+	char *stack;
+	size_t size;
+} stack_pool[STACK_POOL_MAX];
+static unsigned int stack_pool_len;
+G_LOCK_DEFINE_STATIC(stack_pool);
+
+static size_t stack_page_size(void)
+{
+	static size_t page_size;
+
+	if (page_size == 0) {
+		long sz = sysconf(_SC_PAGESIZE);
+		page_size = sz > 0 ? sz : 4096;
+	}
+	return page_size;
+}
+
+static char *stack_alloc(size_t size)
+{
+	size_t page = stack_page_size();
+	char *base;
+	unsigned int i;
+
+	G_LOCK(stack_pool);
+	for (i = 0; i < stack_pool_len; i++) {
+		if (stack_pool[i].size == size) {
+			base = stack_pool[i].stack;
+			stack_pool[i] = stack_pool[--stack_pool_len];
+			G_UNLOCK(stack_pool);
+			return base;
+		}
+	}
+	G_UNLOCK(stack_pool);
+
+	base = mmap(0, size + page,
+		    PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+		    -1, 0);
+	if (base == MAP_FAILED)
+		g_error("mmap(%" G_GSIZE_FORMAT ") failed: %s",
+			size + page, g_strerror(errno));
+
+	/* stacks grow down on all the architectures we support */
+	if (mprotect(base, page, PROT_NONE) != 0)
+		g_warning("failed to protect coroutine stack guard page: %s",
+			  g_strerror(errno));
+
+	return base + page;
+}
+
+static void stack_free(char *stack, size_t size)
+{
+	size_t page = stack_page_size();
+
+#ifdef MADV_FREE
+	if (madvise(stack, size, MADV_FREE) != 0)
+#endif
+		madvise(stack, size, MADV_DONTNEED);
+
+	G_LOCK(stack_pool);
+	if (stack_pool_len < STACK_POOL_MAX) {
+		stack_pool[stack_pool_len].stack = stack;
+		stack_pool[stack_pool_len].size = size;
+		stack_pool_len++;
+		G_UNLOCK(stack_pool);
+		return;
+	}
+	G_UNLOCK(stack_pool);
+
+	munmap(stack - page, size + page);
+}
+
 int coroutine_release(struct coroutine *co)
 {
 	return cc_release(&co->cc);
@@ -50,7 +137,7 @@ static int _coroutine_release(struct continuation *cc)
 			return ret;
 	}
 
-	munmap(co->cc.stack, co->cc.stack_size);
+	stack_free(co->cc.stack, co->cc.stack_size);
 
 	co->caller = NULL;
 
@@ -65,17 +152,13 @@ static void coroutine_trampoline(struct continuation *cc)
 
 void coroutine_init(struct coroutine *co)
 {
+	size_t page = stack_page_size();
+
 	if (co->stack_size == 0)
 		co->stack_size = 16 << 20;
 
-	co->cc.stack_size = co->stack_size;
-	co->cc.stack = mmap(0, co->stack_size,
-			    PROT_READ | PROT_WRITE,
-			    MAP_PRIVATE | MAP_ANONYMOUS,
-			    -1, 0);
-	if (co->cc.stack == MAP_FAILED)
-		g_error("mmap(%" G_GSIZE_FORMAT ") failed: %s",
-			co->stack_size, g_strerror(errno));
+	co->cc.stack_size = (co->stack_size + page - 1) & ~(page - 1);
+	co->cc.stack = stack_alloc(co->cc.stack_size);
 
 	co->cc.entry = coroutine_trampoline;
 	co->cc.release = _coroutine_release;
@@ -84,7 +167,7 @@ void coroutine_init(struct coroutine *co)
 	cc_init(&co->cc);
 }
 
-#if 0
+#ifdef HAVE_TLS
 static __thread struct coroutine leader;
 static __thread struct coroutine *current;
 #else
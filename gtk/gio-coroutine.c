@@ -20,6 +20,8 @@
 */
 #include "config.h"
 
+#include <gobject/gvaluecollector.h>
+
 #include "gio-coroutine.h"
 
 typedef struct _GConditionWaitSource
@@ -30,11 +32,87 @@ typedef struct _GConditionWaitSource
     gpointer data;
 } GConditionWaitSource;
 
+#ifdef G_COROUTINE_IO_THREADS
+/* set in I/O threads, whose signals are marshalled to the main context */
+static GPrivate io_thread;
+#endif
+
 GCoroutine* g_coroutine_self(void)
 {
     return (GCoroutine*)coroutine_self();
 }
 
+static gboolean in_io_thread(void)
+{
+#ifdef G_COROUTINE_IO_THREADS
+    return g_private_get(&io_thread) != NULL;
+#else
+    return FALSE;
+#endif
+}
+
+/*
+ * g_coroutine_set_io_thread:
+ *
+ * Mark the calling thread as an I/O thread, running the coroutines
+ * whose #GCoroutine context it owns: signals emitted from it are
+ * marshalled to the default main context.
+ */
+void g_coroutine_set_io_thread(void)
+{
+#ifdef G_COROUTINE_IO_THREADS
+    g_private_set(&io_thread, GINT_TO_POINTER(TRUE));
+#else
+    g_warn_if_reached();
+#endif
+}
+
+/*
+ * g_coroutine_timeout_add_full:
+ *
+ * Like g_timeout_add_full(), but the source is attached to the context
+ * @coroutine is scheduled from. Can be called from any thread.
+ */
+guint g_coroutine_timeout_add_full(GCoroutine *self, gint priority,
+                                   guint interval, GSourceFunc function,
+                                   gpointer data, GDestroyNotify notify)
+{
+    GSource *src;
+    guint id;
+
+    g_return_val_if_fail(self != NULL, 0);
+    g_return_val_if_fail(function != NULL, 0);
+
+    src = g_timeout_source_new(interval);
+    g_source_set_priority(src, priority);
+    g_source_set_callback(src, function, data, notify);
+    id = g_source_attach(src, self->context);
+    g_source_unref(src);
+
+    return id;
+}
+
+/*
+ * g_coroutine_source_remove:
+ *
+ * Like g_source_remove(), for sources attached to the context
+ * @coroutine is scheduled from. Can be called from any thread.
+ */
+void g_coroutine_source_remove(GCoroutine *self, guint tag)
+{
+    GSource *src;
+
+    g_return_if_fail(self != NULL);
+    g_return_if_fail(tag != 0);
+
+    src = g_main_context_find_source_by_id(self->context, tag);
+    if (src == NULL) {
+        g_critical("Source ID %u was not found when attempting to remove it", tag);
+        return;
+    }
+    g_source_destroy(src);
+}
+
 /* Main loop helper functions */
 static gboolean g_io_wait_helper(GSocket *sock G_GNUC_UNUSED,
 				 GIOCondition cond,
@@ -58,14 +136,14 @@ GIOCondition g_coroutine_socket_wait(GCoroutine *self,
 
     src = g_socket_create_source(sock, cond | G_IO_HUP | G_IO_ERR | G_IO_NVAL, NULL);
     g_source_set_callback(src, (GSourceFunc)g_io_wait_helper, self, NULL);
-    self->wait_id = g_source_attach(src, NULL);
+    self->wait_id = g_source_attach(src, self->context);
     ret = coroutine_yield(NULL);
     g_source_unref(src);
 
     if (ret != NULL)
         val = *ret;
     else
-        g_source_remove(self->wait_id);
+        g_coroutine_source_remove(self, self->wait_id);
 
     self->wait_id = 0;
     return val;
@@ -78,7 +156,7 @@ void g_coroutine_condition_cancel(GCoroutine *coroutine)
     if (coroutine->condition_id == 0)
         return;
 
-    g_source_remove(coroutine->condition_id);
+    g_coroutine_source_remove(coroutine, coroutine->condition_id);
     coroutine->condition_id = 0;
 }
 
@@ -169,7 +247,7 @@ gboolean g_coroutine_condition_wait(GCoroutine *self, GConditionWaitFunc func, g
     vsrc->data = data;
     vsrc->self = self;
 
-    self->condition_id = g_source_attach(src, NULL);
+    self->condition_id = g_source_attach(src, self->context);
     g_source_set_callback(src, g_condition_wait_helper, self, NULL);
     coroutine_yield(NULL);
     g_source_unref(src);
@@ -182,6 +260,89 @@ gboolean g_coroutine_condition_wait(GCoroutine *self, GConditionWaitFunc func, g
     return TRUE;
 }
 
+struct main_call
+{
+    GSourceFunc function;
+    gpointer data;
+    struct coroutine *caller;
+    gboolean done;
+#ifdef G_COROUTINE_IO_THREADS
+    GMutex lock;
+    GCond cond;
+#endif
+};
+
+static gboolean call_main_context(gpointer opaque)
+{
+    struct main_call *call = opaque;
+
+    call->function(call->data);
+
+#ifdef G_COROUTINE_IO_THREADS
+    if (call->caller == NULL) {
+        g_mutex_lock(&call->lock);
+        call->done = TRUE;
+        g_cond_signal(&call->cond);
+        g_mutex_unlock(&call->lock);
+        return FALSE;
+    }
+#endif
+
+    call->done = TRUE;
+    coroutine_yieldto(call->caller, NULL);
+
+    return FALSE;
+}
+
+/*
+ * g_coroutine_call_main:
+ * @function: the function to call
+ * @data: the data to pass to @function
+ *
+ * Call @function from the default main context, and wait for it to
+ * return. From a coroutine, this switches to the main context and
+ * back; from an I/O thread, this blocks the thread.
+ */
+void g_coroutine_call_main(GSourceFunc function, gpointer data)
+{
+    struct main_call call = {
+        .function = function,
+        .data = data,
+    };
+
+    g_return_if_fail(function != NULL);
+
+    if (in_io_thread()) {
+#ifdef G_COROUTINE_IO_THREADS
+        GSource *src = g_idle_source_new();
+
+        g_mutex_init(&call.lock);
+        g_cond_init(&call.cond);
+        g_source_set_callback(src, call_main_context, &call, NULL);
+        g_source_attach(src, NULL);
+        g_source_unref(src);
+
+        g_mutex_lock(&call.lock);
+        while (!call.done)
+            g_cond_wait(&call.cond, &call.lock);
+        g_mutex_unlock(&call.lock);
+        g_cond_clear(&call.cond);
+        g_mutex_clear(&call.lock);
+#endif
+    } else if (coroutine_self_is_main()) {
+        function(data);
+    } else {
+        guint idle;
+
+        call.caller = coroutine_self();
+        idle = g_idle_add(call_main_context, &call);
+        coroutine_yield(NULL);
+        g_warn_if_fail(call.done);
+        if (!call.done)
+            g_source_remove(idle);
+    }
+}
+
 struct signal_data
 {
     gpointer instance;
@@ -193,10 +354,65 @@ struct signal_data
     va_list var_args;
 };
 
+typedef struct _GCoroutineSignal
+{
+    guint signal_id;
+    GQuark detail;
+    guint n_values;
+    GValue *values;
+} GCoroutineSignal;
+
+static void g_coroutine_signal_free(GCoroutineSignal *signal)
+{
+    guint i;
+
+    for (i = 0; i < signal->n_values; i++)
+        g_value_unset(&signal->values[i]);
+    g_free(signal->values);
+    g_slice_free(GCoroutineSignal, signal);
+}
+
+/* main context */
+static void g_coroutine_flush_signals(GCoroutine *self)
+{
+    GCoroutineSignal *signal;
+
+    if (self->pending_id != 0) {
+        g_source_remove(self->pending_id);
+        self->pending_id = 0;
+    }
+
+    while ((signal = g_queue_pop_head(&self->pending_signals)) != NULL) {
+        g_signal_emitv(signal->values, signal->signal_id, signal->detail, NULL);
+        g_coroutine_signal_free(signal);
+    }
+}
+
+static gboolean emit_queued_main_context(gpointer opaque)
+{
+    GCoroutineSignal *signal = opaque;
+
+    g_signal_emitv(signal->values, signal->signal_id, signal->detail, NULL);
+
+    return FALSE;
+}
+
+static gboolean flush_main_context(gpointer opaque)
+{
+    GCoroutine *self = opaque;
+
+    self->pending_id = 0;
+    g_coroutine_flush_signals(self);
+
+    return FALSE;
+}
+
 static gboolean emit_main_context(gpointer opaque)
 {
     struct signal_data *signal = opaque;
 
+    /* keep the ordering with previously queued signals */
+    g_coroutine_flush_signals((GCoroutine *)signal->caller);
     g_signal_emit_valist(signal->instance, signal->signal_id,
                          signal->detail, signal->var_args);
     signal->notified = TRUE;
@@ -206,6 +422,17 @@ static gboolean emit_main_context(gpointer opaque)
     return FALSE;
 }
 
+static gboolean emit_io_thread(gpointer opaque)
+{
+    struct signal_data *signal = opaque;
+
+    g_signal_emit_valist(signal->instance, signal->signal_id,
+                         signal->detail, signal->var_args);
+    signal->notified = TRUE;
+
+    return FALSE;
+}
+
 void
 g_coroutine_signal_emit(gpointer instance, guint signal_id,
                         GQuark detail, ...)
@@ -219,7 +446,11 @@ g_coroutine_signal_emit(gpointer instance, guint signal_id,
 
     va_start (data.var_args, detail);
 
-    if (coroutine_self_is_main()) {
+    if (in_io_thread()) {
+        g_object_ref(instance);
+        g_coroutine_call_main(emit_io_thread, &data);
+        g_object_unref(instance);
+    } else if (coroutine_self_is_main()) {
         g_signal_emit_valist(instance, signal_id, detail, data.var_args);
     } else {
         g_object_ref(instance);
@@ -235,10 +466,105 @@ g_coroutine_signal_emit(gpointer instance, guint signal_id,
 }
 
 
+/*
+ * g_coroutine_signal_emit_queued:
+ * @instance: the instance the signal is being emitted on
+ * @signal_id: the signal id
+ * @detail: the detail
+ *
+ * Like g_coroutine_signal_emit(), but when called from a coroutine,
+ * the signal is queued and the coroutine keeps running instead of
+ * switching to the main context and back. Queued signals are emitted
+ * in order from a single main context dispatch, or before the next
+ * synchronous emission from the same coroutine.
+ *
+ * From an I/O thread, the signal is emitted from the default main
+ * context without waiting, in order with the synchronous emissions.
+ *
+ * The signal arguments are copied, pointers are not followed: this is
+ * only suitable for signals whose arguments remain valid until
+ * emission, and which don't return a value.
+ */
+void
+g_coroutine_signal_emit_queued(gpointer instance, guint signal_id,
+                               GQuark detail, ...)
+{
+    GCoroutine *self;
+    GCoroutineSignal *signal;
+    GSignalQuery query;
+    va_list var_args;
+    guint i;
+
+    va_start(var_args, detail);
+
+    if (coroutine_self_is_main() && !in_io_thread()) {
+        g_signal_emit_valist(instance, signal_id, detail, var_args);
+        va_end(var_args);
+        return;
+    }
+
+    g_signal_query(signal_id, &query);
+    g_return_if_fail(query.signal_id != 0);
+    g_warn_if_fail(query.return_type == G_TYPE_NONE);
+
+    signal = g_slice_new0(GCoroutineSignal);
+    signal->signal_id = signal_id;
+    signal->detail = detail;
+    signal->n_values = query.n_params + 1;
+    signal->values = g_new0(GValue, signal->n_values);
+
+    g_value_init(&signal->values[0], G_TYPE_FROM_INSTANCE(instance));
+    g_value_set_instance(&signal->values[0], instance);
+
+    for (i = 0; i < query.n_params; i++) {
+        GType type = query.param_types[i] & ~G_SIGNAL_TYPE_STATIC_SCOPE;
+        gchar *error = NULL;
+
+        G_VALUE_COLLECT_INIT(&signal->values[i + 1], type, var_args, 0, &error);
+        if (error != NULL) {
+            g_critical("%s: %s", G_STRFUNC, error);
+            g_free(error);
+            /* the remaining values are unusable */
+            signal->n_values = i + 1;
+            g_coroutine_signal_free(signal);
+            va_end(var_args);
+            return;
+        }
+    }
+
+    va_end(var_args);
+
+    if (in_io_thread()) {
+        GSource *src = g_idle_source_new();
+
+        g_source_set_callback(src, emit_queued_main_context, signal,
+                              (GDestroyNotify)g_coroutine_signal_free);
+        g_source_attach(src, NULL);
+        g_source_unref(src);
+        return;
+    }
+
+    self = g_coroutine_self();
+    g_queue_push_tail(&self->pending_signals, signal);
+    if (self->pending_id == 0)
+        self->pending_id = g_idle_add(flush_main_context, self);
+}
+
+static gboolean notify_io_thread(gpointer opaque)
+{
+    struct signal_data *signal = opaque;
+
+    g_object_notify(signal->instance, signal->propname);
+    signal->notified = TRUE;
+
+    return FALSE;
+}
+
 static gboolean notify_main_context(gpointer opaque)
 {
     struct signal_data *signal = opaque;
 
+    g_coroutine_flush_signals((GCoroutine *)signal->caller);
     g_object_notify(signal->instance, signal->propname);
     signal->notified = TRUE;
 
@@ -253,7 +579,13 @@ void g_coroutine_object_notify(GObject *object,
 {
     struct signal_data data;
 
-    if (coroutine_self_is_main()) {
+    if (in_io_thread()) {
+        data.instance = g_object_ref(object);
+        data.propname = (gpointer)property_name;
+        data.notified = FALSE;
+        g_coroutine_call_main(notify_io_thread, &data);
+        g_object_unref(object);
+    } else if (coroutine_self_is_main()) {
         g_object_notify(object, property_name);
     } else {
 
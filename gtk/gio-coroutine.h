@@ -26,6 +26,11 @@
 
 G_BEGIN_DECLS
 
+#if defined(COROUTINE_THREADS) && GLIB_CHECK_VERSION(2,32,0)
+/* coroutines can be scheduled from I/O threads, see SpiceSession:io-threads */
+#define G_COROUTINE_IO_THREADS 1
+#endif
+
 typedef struct _GCoroutine GCoroutine;
 
 struct _GCoroutine
@@ -33,6 +38,14 @@ struct _GCoroutine
     struct coroutine coroutine;
     guint wait_id;
     guint condition_id;
+
+    /* signals queued with g_coroutine_signal_emit_queued() */
+    GQueue pending_signals;
+    guint pending_id;
+
+    /* the context the coroutine is scheduled from, owned by an I/O
+     * thread, or NULL for the default main context */
+    GMainContext *context;
 };
 
 /*
@@ -56,8 +69,17 @@ gboolean     g_coroutine_condition_wait (GCoroutine *coroutine,
                                          GConditionWaitFunc func, gpointer data);
 void         g_coroutine_condition_cancel(GCoroutine *coroutine);
 
+guint        g_coroutine_timeout_add_full(GCoroutine *coroutine, gint priority,
+                                          guint interval, GSourceFunc function,
+                                          gpointer data, GDestroyNotify notify);
+void         g_coroutine_source_remove  (GCoroutine *coroutine, guint tag);
+void         g_coroutine_call_main      (GSourceFunc function, gpointer data);
+void         g_coroutine_set_io_thread  (void);
+
 void         g_coroutine_signal_emit (gpointer instance, guint signal_id,
                                       GQuark detail, ...);
+void         g_coroutine_signal_emit_queued (gpointer instance, guint signal_id,
+                                             GQuark detail, ...);
 
 void         g_coroutine_object_notify(GObject *object, const gchar *property_name);
 
@@ -30,6 +30,10 @@
  *
  * A class that handles the playback and record channels for your
  * application, and connect them to the default sound system.
+ *
+ * When SPICE_AUDIO_BACKEND is set to "null" in the environment, a
+ * backend without sound device is used instead: playback is consumed
+ * at real-time pace, and a tone is recorded, for tests and benchmarks.
  */
 
 #include "config.h"
@@ -42,6 +46,7 @@
 #include "spice-channel-priv.h"
 #include "spice-audio-priv.h"
 
+#include "spice-nullaudio.h"
 #ifdef WITH_PULSE
 #include "spice-pulse.h"
 #endif
@@ -215,11 +220,15 @@ SpiceAudio *spice_audio_new(SpiceSession *session, GMainContext *context,
     if (name == NULL)
         name = g_get_application_name();
 
+    if (g_strcmp0(g_getenv("SPICE_AUDIO_BACKEND"), "null") == 0)
+        self = SPICE_AUDIO(spice_nullaudio_new(session, context, name));
 #ifdef WITH_PULSE
-    self = SPICE_AUDIO(spice_pulse_new(session, context, name));
+    if (!self)
+        self = SPICE_AUDIO(spice_pulse_new(session, context, name));
 #endif
 #if defined(WITH_GSTAUDIO)
-    self = SPICE_AUDIO(spice_gstaudio_new(session, context, name));
+    if (!self)
+        self = SPICE_AUDIO(spice_gstaudio_new(session, context, name));
 #endif
     if (!self)
         return NULL;
@@ -50,6 +50,7 @@ struct _SpiceMsgOut {
     SpiceMarshaller       *marshaller;
     uint8_t               *header;
     gboolean              ro_check;
+    gint64                trace_time; /* input latency tracing, or 0 */
 };
 
 struct _SpiceMsgIn {
@@ -106,6 +107,7 @@ struct _SpiceChannelPrivate {
     gboolean                    xmit_queue_blocked;
     STATIC_MUTEX                xmit_queue_lock;
     guint                       xmit_queue_wakeup_id;
+    gboolean                    xmit_immediate;
 
     char                        name[16];
     enum spice_channel_state    state;
@@ -697,7 +697,7 @@ G_GNUC_INTERNAL
 void spice_msg_out_send(SpiceMsgOut *out)
 {
     SpiceChannelPrivate *c;
-    gboolean was_empty;
+    gboolean was_empty, immediate = FALSE;
 
     g_return_if_fail(out != NULL);
     g_return_if_fail(out->channel != NULL);
@@ -715,15 +715,30 @@ void spice_msg_out_send(SpiceMsgOut *out)
     /* One wakeup is enough to empty the entire queue -> only do a wakeup
        if the queue was empty, and there isn't one pending already. */
     if (was_empty && !c->xmit_queue_wakeup_id) {
-        c->xmit_queue_wakeup_id =
-            /* Use g_timeout_add_full so that can specify the priority */
-            g_timeout_add_full(G_PRIORITY_HIGH, 0,
-                               spice_channel_idle_wakeup,
-                               out->channel, NULL);
+        /* Latency sensitive channels are woken up right away when
+           sending from the main context, instead of waiting for all
+           the sources dispatched before the wakeup (rendering,
+           decoding...) */
+        if (c->xmit_immediate && c->coroutine.context == NULL &&
+            coroutine_self_is_main() &&
+            g_main_context_is_owner(g_main_context_default()))
+            immediate = TRUE;
+        else
+            c->xmit_queue_wakeup_id =
+                /* Use a timeout so that can specify the priority */
+                g_coroutine_timeout_add_full(&c->coroutine, G_PRIORITY_HIGH, 0,
+                                             spice_channel_idle_wakeup,
+                                             out->channel, NULL);
     }
 
 end:
     STATIC_MUTEX_UNLOCK(c->xmit_queue_lock);
+
+    if (immediate) {
+        SpiceChannel *channel = g_object_ref(out->channel);
+        spice_channel_wakeup(channel, FALSE);
+        g_object_unref(channel);
+    }
 }
 
 /* coroutine context */
@@ -861,6 +876,8 @@ static void spice_channel_write_msg(SpiceChannel *channel, SpiceMsgOut *out)
     data = spice_marshaller_linearize(out->marshaller, 0, &len, &free_data);
     /* spice_msg_out_hexdump(out, data, len); */
     spice_channel_write(channel, data, len);
+    if (out->trace_time)
+        spice_session_latency_sent(channel->priv->session, out->trace_time);
 
     if (free_data)
         g_free(data);
@@ -1821,12 +1838,40 @@ error:
     return FALSE;
 }
 
-/* system context */
+/* I/O thread context */
+static gboolean channel_wakeup_io_thread(gpointer data)
+{
+    SpiceChannel *channel = data;
+
+    spice_channel_wakeup(channel, FALSE);
+
+    return FALSE;
+}
+
+static gboolean channel_cancel_io_thread(gpointer data)
+{
+    SpiceChannel *channel = data;
+
+    spice_channel_wakeup(channel, TRUE);
+
+    return FALSE;
+}
+
+/* any context */
 G_GNUC_INTERNAL
 void spice_channel_wakeup(SpiceChannel *channel, gboolean cancel)
 {
     GCoroutine *c = &channel->priv->coroutine;
 
+    if (c->context != NULL && !g_main_context_is_owner(c->context)) {
+        /* the coroutine runs in an I/O thread, wake it up from there */
+        g_coroutine_timeout_add_full(c, G_PRIORITY_HIGH, 0,
+                                     cancel ? channel_cancel_io_thread :
+                                              channel_wakeup_io_thread,
+                                     g_object_ref(channel), g_object_unref);
+        return;
+    }
+
     if (cancel)
         g_coroutine_condition_cancel(c);
 
@@ -2122,16 +2167,21 @@ void spice_channel_destroy(SpiceChannel *channel)
 static void spice_channel_flushed(SpiceChannel *channel, gboolean success)
 {
     SpiceChannelPrivate *c = channel->priv;
-    GSList *l;
+    GSList *l, *flushing;
 
-    for (l = c->flushing; l != NULL; l = l->next) {
+    /* the channel may be processed from an I/O thread */
+    STATIC_MUTEX_LOCK(c->xmit_queue_lock);
+    flushing = c->flushing;
+    c->flushing = NULL;
+    STATIC_MUTEX_UNLOCK(c->xmit_queue_lock);
+
+    for (l = flushing; l != NULL; l = l->next) {
         GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT(l->data);
         g_simple_async_result_set_op_res_gboolean(result, success);
         g_simple_async_result_complete_in_idle(result);
     }
 
-    g_slist_free_full(c->flushing, g_object_unref);
-    c->flushing = NULL;
+    g_slist_free_full(flushing, g_object_unref);
 }
 
 /* coroutine context */
@@ -2343,6 +2393,14 @@ const GError* spice_channel_get_error(SpiceChannel *self)
     return c->error;
 }
 
+/* I/O thread context */
+static gboolean io_thread_delayed_unref(gpointer data)
+{
+    g_idle_add(spice_channel_delayed_unref, data);
+
+    return FALSE;
+}
+
 /* coroutine context */
 static void *spice_channel_coroutine(void *data)
 {
@@ -2500,7 +2558,11 @@ cleanup:
         g_warn_if_fail(c->event == SPICE_CHANNEL_NONE);
         channel_connect(channel, c->tls);
         g_object_unref(channel);
-    } else
+    } else if (c->coroutine.context != NULL)
+        /* let the coroutine exit before the main context unrefs it */
+        g_coroutine_timeout_add_full(&c->coroutine, G_PRIORITY_DEFAULT_IDLE, 0,
+                                     io_thread_delayed_unref, data, NULL);
+    else
         g_idle_add(spice_channel_delayed_unref, data);
 
     /* Co-routine exits now - the SpiceChannel object may no longer exist,
@@ -2519,7 +2581,9 @@ static gboolean connect_delayed(gpointer data)
 
     co = &c->coroutine.coroutine;
 
-    co->stack_size = 16 << 20; /* 16Mb */
+    co->stack_size = spice_session_get_coroutine_stack_size(c->session);
+    if (co->stack_size == 0)
+        co->stack_size = 16 << 20; /* 16Mb */
     co->entry = spice_channel_coroutine;
     co->release = NULL;
 
@@ -2561,8 +2625,14 @@ static gboolean channel_connect(SpiceChannel *channel, gboolean tls)
     g_return_val_if_fail(c->sock == NULL, FALSE);
     g_object_ref(G_OBJECT(channel)); /* Unref'd when co-routine exits */
 
+    if (c->coroutine.context == NULL)
+        c->coroutine.context = spice_session_get_channel_context(c->session,
+                                                                 c->channel_type);
+
     /* we connect in idle, to let previous coroutine exit, if present */
-    c->connect_delayed_id = g_idle_add(connect_delayed, channel);
+    c->connect_delayed_id =
+        g_coroutine_timeout_add_full(&c->coroutine, G_PRIORITY_DEFAULT_IDLE, 0,
+                                     connect_delayed, channel, NULL);
 
     return true;
 }
@@ -2628,7 +2698,7 @@ static void channel_reset(SpiceChannel *channel, gboolean migrating)
 
     CHANNEL_DEBUG(channel, "channel reset");
     if (c->connect_delayed_id) {
-        g_source_remove(c->connect_delayed_id);
+        g_coroutine_source_remove(&c->coroutine, c->connect_delayed_id);
         c->connect_delayed_id = 0;
     }
 
@@ -2674,7 +2744,7 @@ static void channel_reset(SpiceChannel *channel, gboolean migrating)
     g_queue_foreach(&c->xmit_queue, (GFunc)spice_msg_out_unref, NULL);
     g_queue_clear(&c->xmit_queue);
     if (c->xmit_queue_wakeup_id) {
-        g_source_remove(c->xmit_queue_wakeup_id);
+        g_coroutine_source_remove(&c->coroutine, c->xmit_queue_wakeup_id);
         c->xmit_queue_wakeup_id = 0;
     }
     STATIC_MUTEX_UNLOCK(c->xmit_queue_lock);
@@ -2977,15 +3047,14 @@ void spice_channel_flush_async(SpiceChannel *self, GCancellable *cancellable,
 
     STATIC_MUTEX_LOCK(c->xmit_queue_lock);
     was_empty = g_queue_is_empty(&c->xmit_queue);
+    if (!was_empty)
+        c->flushing = g_slist_append(c->flushing, simple);
     STATIC_MUTEX_UNLOCK(c->xmit_queue_lock);
     if (was_empty) {
         g_simple_async_result_set_op_res_gboolean(simple, TRUE);
         g_simple_async_result_complete_in_idle(simple);
         g_object_unref(simple);
-        return;
     }
-
-    c->flushing = g_slist_append(c->flushing, simple);
 }
 
 /**
@@ -0,0 +1,180 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <string.h>
+
+#include <GLES3/gl3.h>
+
+#include "spice-egl-primary.h"
+
+static void rect_union(const SpiceEglRect *a, const SpiceEglRect *b,
+                       SpiceEglRect *dest)
+{
+    gint x1 = MIN(a->x, b->x);
+    gint y1 = MIN(a->y, b->y);
+    gint x2 = MAX(a->x + a->width, b->x + b->width);
+    gint y2 = MAX(a->y + a->height, b->y + b->height);
+
+    dest->x = x1;
+    dest->y = y1;
+    dest->width = x2 - x1;
+    dest->height = y2 - y1;
+}
+
+/* (Re)allocate the texture for a @width x @height surface, and schedule
+ * a full upload. */
+G_GNUC_INTERNAL
+void spice_egl_primary_resize(SpiceEglPrimary *primary, gint width, gint height)
+{
+    SpiceEglRect full = { 0, 0, width, height };
+
+    if (primary->tex == 0) {
+        glGenTextures(1, &primary->tex);
+        glBindTexture(GL_TEXTURE_2D, primary->tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        /* the surface is x8r8g8b8, which GLES can't upload without
+         * an extension: upload it as RGBA, and swizzle on sampling */
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_BLUE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_ONE);
+        glGenBuffers(1, &primary->pbo);
+    }
+
+    if (primary->width != width || primary->height != height) {
+        glBindTexture(GL_TEXTURE_2D, primary->tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        primary->width = width;
+        primary->height = height;
+    }
+
+    primary->n_damage = 0;
+    spice_egl_primary_invalidate(primary, &full);
+}
+
+/* Record @rect to be uploaded on the next spice_egl_primary_upload() */
+G_GNUC_INTERNAL
+void spice_egl_primary_invalidate(SpiceEglPrimary *primary, const SpiceEglRect *rect)
+{
+    SpiceEglRect *damage = primary->damage;
+    SpiceEglRect r;
+    gint i;
+
+    /* clip to the texture */
+    r.x = MAX(rect->x, 0);
+    r.y = MAX(rect->y, 0);
+    r.width = MIN(rect->x + rect->width, primary->width) - r.x;
+    r.height = MIN(rect->y + rect->height, primary->height) - r.y;
+    if (r.width <= 0 || r.height <= 0)
+        return;
+
+    for (i = 0; i < primary->n_damage; i++) {
+        SpiceEglRect u;
+
+        rect_union(&damage[i], &r, &u);
+        if (u.width * u.height <=
+            damage[i].width * damage[i].height + r.width * r.height) {
+            damage[i] = u;
+            return;
+        }
+    }
+
+    if (primary->n_damage == SPICE_EGL_PRIMARY_MAX_DAMAGE) {
+        /* too fragmented, upload the bounding box */
+        for (i = 1; i < primary->n_damage; i++)
+            rect_union(&damage[0], &damage[i], &damage[0]);
+        rect_union(&damage[0], &r, &damage[0]);
+        primary->n_damage = 1;
+        return;
+    }
+
+    damage[primary->n_damage++] = r;
+}
+
+/* Stream the damaged parts of the surface to the texture: the
+ * rectangles are packed in a freshly orphaned PBO, so the driver
+ * doesn't have to wait for the previous upload to complete, and only
+ * those are copied with glTexSubImage2D. @data points to the top-left
+ * pixel of the surface. */
+G_GNUC_INTERNAL
+gboolean spice_egl_primary_upload(SpiceEglPrimary *primary,
+                                  const guint8 *data, gsize stride)
+{
+    gsize size = 0, offset = 0;
+    guint8 *dst;
+    gint i, y;
+
+    g_return_val_if_fail(primary->tex != 0, FALSE);
+
+    if (primary->n_damage == 0)
+        return TRUE;
+
+    for (i = 0; i < primary->n_damage; i++)
+        size += primary->damage[i].width * primary->damage[i].height * 4;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, primary->pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (dst == NULL) {
+        g_warning("failed to map the primary PBO");
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return FALSE;
+    }
+
+    for (i = 0; i < primary->n_damage; i++) {
+        const SpiceEglRect *r = &primary->damage[i];
+        const guint8 *src = data + r->y * stride + r->x * 4;
+
+        for (y = 0; y < r->height; y++) {
+            memcpy(dst, src, r->width * 4);
+            dst += r->width * 4;
+            src += stride;
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    glBindTexture(GL_TEXTURE_2D, primary->tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for (i = 0; i < primary->n_damage; i++) {
+        const SpiceEglRect *r = &primary->damage[i];
+
+        glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y, r->width, r->height,
+                        GL_RGBA, GL_UNSIGNED_BYTE, (void *)offset);
+        offset += r->width * r->height * 4;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    primary->n_damage = 0;
+
+    return TRUE;
+}
+
+G_GNUC_INTERNAL
+void spice_egl_primary_clear(SpiceEglPrimary *primary)
+{
+    if (primary->tex)
+        glDeleteTextures(1, &primary->tex);
+    if (primary->pbo)
+        glDeleteBuffers(1, &primary->pbo);
+    memset(primary, 0, sizeof(*primary));
+}
@@ -0,0 +1,51 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SPICE_EGL_PRIMARY_H_
+# define SPICE_EGL_PRIMARY_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* same layout as GdkRectangle, without depending on GTK */
+typedef struct SpiceEglRect {
+    gint x, y;
+    gint width, height;
+} SpiceEglRect;
+
+#define SPICE_EGL_PRIMARY_MAX_DAMAGE 16
+
+/* 2D x8r8g8b8 surface streamed to a GLES 3 texture, the GL context
+ * must be current when calling these functions */
+typedef struct SpiceEglPrimary {
+    guint               tex;
+    guint               pbo;
+    gint                width, height;
+    SpiceEglRect        damage[SPICE_EGL_PRIMARY_MAX_DAMAGE];
+    gint                n_damage;
+} SpiceEglPrimary;
+
+void spice_egl_primary_resize(SpiceEglPrimary *primary, gint width, gint height);
+void spice_egl_primary_invalidate(SpiceEglPrimary *primary, const SpiceEglRect *rect);
+gboolean spice_egl_primary_upload(SpiceEglPrimary *primary,
+                                  const guint8 *data, gsize stride);
+void spice_egl_primary_clear(SpiceEglPrimary *primary);
+
+G_END_DECLS
+
+#endif // SPICE_EGL_PRIMARY_H_
@@ -0,0 +1,168 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+
+#include "spice-egl-scanout.h"
+
+static void image_clear(SpiceEglScanoutImage *image, EGLDisplay display)
+{
+    if (image->tex)
+        glDeleteTextures(1, &image->tex);
+    if (image->image) {
+        PFNEGLDESTROYIMAGEKHRPROC destroy_image =
+            (gpointer)eglGetProcAddress("eglDestroyImageKHR");
+
+        destroy_image(display, image->image);
+    }
+    if (image->fd != -1)
+        close(image->fd);
+    memset(image, 0, sizeof(*image));
+    image->fd = -1;
+}
+
+static gboolean image_import(SpiceEglScanoutImage *image, EGLDisplay display,
+                             gint fd, guint32 width, guint32 height,
+                             guint32 stride, guint32 format)
+{
+    PFNEGLCREATEIMAGEKHRPROC create_image;
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture;
+    EGLint attrs[13];
+
+    /* extensions, not exported by every libEGL/libGLESv2 */
+    create_image = (gpointer)eglGetProcAddress("eglCreateImageKHR");
+    image_target_texture = (gpointer)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    if (create_image == NULL || image_target_texture == NULL) {
+        g_warning("EGL image import is not supported");
+        return FALSE;
+    }
+
+    attrs[0] = EGL_DMA_BUF_PLANE0_FD_EXT;
+    attrs[1] = fd;
+    attrs[2] = EGL_DMA_BUF_PLANE0_PITCH_EXT;
+    attrs[3] = stride;
+    attrs[4] = EGL_DMA_BUF_PLANE0_OFFSET_EXT;
+    attrs[5] = 0;
+    attrs[6] = EGL_WIDTH;
+    attrs[7] = width;
+    attrs[8] = EGL_HEIGHT;
+    attrs[9] = height;
+    attrs[10] = EGL_LINUX_DRM_FOURCC_EXT;
+    attrs[11] = format;
+    attrs[12] = EGL_NONE;
+
+    image->image = create_image(display, EGL_NO_CONTEXT,
+                                EGL_LINUX_DMA_BUF_EXT,
+                                (EGLClientBuffer)NULL, attrs);
+    if (image->image == EGL_NO_IMAGE_KHR) {
+        g_warning("failed to import scanout: 0x%x", eglGetError());
+        image->image = NULL;
+        return FALSE;
+    }
+
+    image->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (image->fd == -1) {
+        g_warning("failed to dup scanout fd: %s", g_strerror(errno));
+        image_clear(image, display);
+        return FALSE;
+    }
+
+    glGenTextures(1, &image->tex);
+    glBindTexture(GL_TEXTURE_2D, image->tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    image_target_texture(GL_TEXTURE_2D, (GLeglImageOES)image->image);
+
+    image->width = width;
+    image->height = height;
+    image->stride = stride;
+    image->format = format;
+
+    return TRUE;
+}
+
+G_GNUC_INTERNAL
+void spice_egl_scanout_init(SpiceEglScanout *scanout)
+{
+    guint i;
+
+    memset(scanout, 0, sizeof(*scanout));
+    for (i = 0; i < G_N_ELEMENTS(scanout->images); i++)
+        scanout->images[i].fd = -1;
+}
+
+/* Make the dma-buf @fd the current scanout, looking up its image, or
+ * importing it in place of the least recently used one. */
+G_GNUC_INTERNAL
+gboolean spice_egl_scanout_import(SpiceEglScanout *scanout, EGLDisplay display,
+                                  gint fd, guint32 width, guint32 height,
+                                  guint32 stride, guint32 format)
+{
+    SpiceEglScanoutImage *image;
+    struct stat st;
+    guint i, lru = 0;
+
+    scanout->current = NULL;
+
+    if (fstat(fd, &st) < 0) {
+        g_warning("failed to stat scanout fd: %s", g_strerror(errno));
+        return FALSE;
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(scanout->images); i++) {
+        image = &scanout->images[i];
+        if (image->image != NULL &&
+            image->dev == st.st_dev && image->ino == st.st_ino &&
+            image->width == width && image->height == height &&
+            image->stride == stride && image->format == format)
+            goto found;
+        if (image->used < scanout->images[lru].used)
+            lru = i;
+    }
+
+    image = &scanout->images[lru];
+    image_clear(image, display);
+    if (!image_import(image, display, fd, width, height, stride, format))
+        return FALSE;
+    image->dev = st.st_dev;
+    image->ino = st.st_ino;
+
+found:
+    image->used = ++scanout->used;
+    scanout->current = image;
+
+    return TRUE;
+}
+
+G_GNUC_INTERNAL
+void spice_egl_scanout_clear(SpiceEglScanout *scanout, EGLDisplay display)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(scanout->images); i++)
+        image_clear(&scanout->images[i], display);
+    spice_egl_scanout_init(scanout);
+}
@@ -0,0 +1,62 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SPICE_EGL_SCANOUT_H_
+# define SPICE_EGL_SCANOUT_H_
+
+#include <glib.h>
+#include <sys/types.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+G_BEGIN_DECLS
+
+#define SPICE_EGL_SCANOUT_CACHE_SIZE 3
+
+typedef struct SpiceEglScanoutImage {
+    gint                fd;
+    dev_t               dev;
+    ino_t               ino;
+    guint32             width, height;
+    guint32             stride, format;
+    guint64             used;
+    EGLImageKHR         image;
+    guint               tex;
+} SpiceEglScanoutImage;
+
+/* dma-buf scanouts imported as EGLImages bound to GLES textures, the
+ * GL context must be current when calling these functions.
+ *
+ * The server sends a new fd on every scanout, so the images are kept
+ * by dma-buf inode, and a guest flipping between a few buffers reuses
+ * them. Each entry holds a dup of the imported fd: the buffer, and so
+ * its inode number, can't be reused while it is cached. */
+typedef struct SpiceEglScanout {
+    SpiceEglScanoutImage images[SPICE_EGL_SCANOUT_CACHE_SIZE];
+    SpiceEglScanoutImage *current;
+    guint64             used;
+} SpiceEglScanout;
+
+void spice_egl_scanout_init(SpiceEglScanout *scanout);
+gboolean spice_egl_scanout_import(SpiceEglScanout *scanout, EGLDisplay display,
+                                  gint fd, guint32 width, guint32 height,
+                                  guint32 stride, guint32 format);
+void spice_egl_scanout_clear(SpiceEglScanout *scanout, EGLDisplay display);
+
+G_END_DECLS
+
+#endif // SPICE_EGL_SCANOUT_H_
@@ -26,18 +26,29 @@
 #include "spice-common.h"
 #include "spice-session.h"
 #include "spice-util.h"
+#include "channel-playback-priv.h"
 
 #define SPICE_GSTAUDIO_GET_PRIVATE(obj)                                  \
     (G_TYPE_INSTANCE_GET_PRIVATE((obj), SPICE_TYPE_GSTAUDIO, SpiceGstaudioPrivate))
 
 G_DEFINE_TYPE(SpiceGstaudio, spice_gstaudio, SPICE_TYPE_AUDIO)
 
+/*
+ * The pipelines are created once, and kept across start and stop: a
+ * change of format only changes the caps of the appsrc or appsink,
+ * and the other elements renegotiate. The playback delay is the
+ * latency of the pipeline, queried when it posts a latency message,
+ * and reported along with the data.
+ */
+#define DELAY_UPDATE_MS 200
+
 struct stream {
     GstElement              *pipe;
     GstElement              *src;
     GstElement              *sink;
     guint                   rate;
     guint                   channels;
+    guint                   bus_id;
 };
 
 struct _SpiceGstaudioPrivate {
@@ -45,7 +56,8 @@ struct _SpiceGstaudioPrivate {
     SpiceChannel            *rchannel;
     struct stream           playback;
     struct stream           record;
-    guint                   mmtime_id;
+    guint                   latency;
+    gint64                  delay_time;
 };
 
 static gboolean connect_channel(SpiceAudio *audio, SpiceChannel *channel);
@@ -58,6 +70,11 @@ static void spice_gstaudio_finalize(GObject *obj)
 
 void stream_dispose(struct stream *s)
 {
+    if (s->bus_id != 0) {
+        g_source_remove(s->bus_id);
+        s->bus_id = 0;
+    }
+
     if (s->pipe) {
         gst_element_set_state(s->pipe, GST_STATE_NULL);
         gst_object_unref(s->pipe);
@@ -115,6 +132,16 @@ static void spice_gstaudio_class_init(SpiceGstaudioClass *klass)
     g_type_class_add_private(klass, sizeof(SpiceGstaudioPrivate));
 }
 
+static GstCaps *audio_caps_new(gint channels, gint frequency)
+{
+    return gst_caps_new_simple("audio/x-raw",
+                               "format", G_TYPE_STRING, "S16LE",
+                               "channels", G_TYPE_INT, channels,
+                               "rate", G_TYPE_INT, frequency,
+                               "layout", G_TYPE_STRING, "interleaved",
+                               NULL);
+}
+
 static GstFlowReturn record_new_buffer(GstAppSink *appsink, gpointer data)
 {
     SpiceGstaudio *gstaudio = data;
@@ -168,9 +195,8 @@ static gboolean record_bus_cb(GstBus *bus, GstMessage *msg, gpointer data)
             return TRUE;
         }
 
+        /* the channel timestamps the data with the session mm-time */
         spice_record_send_data(SPICE_RECORD_CHANNEL(p->rchannel),
-                               /* FIXME: server side doesn't care about ts?
-                                  what is the unit? ms apparently */
                                mapping.data, mapping.size, 0);
         gst_buffer_unmap(buffer, &mapping);
         gst_sample_unref(s);
@@ -192,55 +218,50 @@ static void record_start(SpiceRecordChannel *channel, gint format, gint channels
     g_return_if_fail(p != NULL);
     g_return_if_fail(format == SPICE_AUDIO_FMT_S16);
 
-    if (p->record.pipe &&
-        (p->record.rate != frequency ||
-         p->record.channels != channels)) {
-        record_stop(gstaudio);
-        gst_object_unref(p->record.pipe);
-        p->record.pipe = NULL;
-    }
-
     if (!p->record.pipe) {
         GError *error = NULL;
         GstBus *bus;
-        gchar *audio_caps =
-            g_strdup_printf("audio/x-raw,format=\"S16LE\",channels=%d,rate=%d,"
-                            "layout=interleaved", channels, frequency);
-        gchar *pipeline =
-            g_strdup_printf("autoaudiosrc name=audiosrc ! queue ! audioconvert ! audioresample ! "
-                            "appsink caps=\"%s\" name=appsink", audio_caps);
-
-        p->record.pipe = gst_parse_launch(pipeline, &error);
+
+        p->record.pipe = gst_parse_launch("autoaudiosrc name=audiosrc ! queue ! "
+                                          "audioconvert ! audioresample ! "
+                                          "appsink name=appsink", &error);
         if (error != NULL) {
             g_warning("Failed to create pipeline: %s", error->message);
-            goto cleanup;
+            if (p->record.pipe != NULL) {
+                gst_object_unref(p->record.pipe);
+                p->record.pipe = NULL;
+            }
+            g_clear_error(&error);
+            return;
         }
 
         bus = gst_pipeline_get_bus(GST_PIPELINE(p->record.pipe));
-        gst_bus_add_watch(bus, record_bus_cb, data);
+        p->record.bus_id = gst_bus_add_watch(bus, record_bus_cb, data);
         gst_object_unref(GST_OBJECT(bus));
 
         p->record.src = gst_bin_get_by_name(GST_BIN(p->record.pipe), "audiosrc");
         p->record.sink = gst_bin_get_by_name(GST_BIN(p->record.pipe), "appsink");
-        p->record.rate = frequency;
-        p->record.channels = channels;
+        p->record.rate = 0;
+        p->record.channels = 0;
 
         gst_app_sink_set_emit_signals(GST_APP_SINK(p->record.sink), TRUE);
         spice_g_signal_connect_object(p->record.sink, "new-sample",
                                       G_CALLBACK(record_new_buffer), gstaudio, 0);
+    }
 
-cleanup:
-        if (error != NULL && p->record.pipe != NULL) {
-            gst_object_unref(p->record.pipe);
-            p->record.pipe = NULL;
-        }
-        g_clear_error(&error);
-        g_free(audio_caps);
-        g_free(pipeline);
+    if (p->record.rate != frequency ||
+        p->record.channels != channels) {
+        GstCaps *caps = audio_caps_new(channels, frequency);
+
+        /* the source renegotiates when it starts again */
+        gst_element_set_state(p->record.pipe, GST_STATE_READY);
+        gst_app_sink_set_caps(GST_APP_SINK(p->record.sink), caps);
+        gst_caps_unref(caps);
+        p->record.rate = frequency;
+        p->record.channels = channels;
     }
 
-    if (p->record.pipe)
-        gst_element_set_state(p->record.pipe, GST_STATE_PLAYING);
+    gst_element_set_state(p->record.pipe, GST_STATE_PLAYING);
 }
 
 static void playback_stop(SpicePlaybackChannel *channel, gpointer data)
@@ -250,15 +271,10 @@ static void playback_stop(SpicePlaybackChannel *channel, gpointer data)
 
     if (p->playback.pipe)
         gst_element_set_state(p->playback.pipe, GST_STATE_READY);
-    if (p->mmtime_id != 0) {
-        g_source_remove(p->mmtime_id);
-        p->mmtime_id = 0;
-    }
 }
 
-static gboolean update_mmtime_timeout_cb(gpointer data)
+static void playback_update_latency(SpiceGstaudio *gstaudio)
 {
-    SpiceGstaudio *gstaudio = data;
     SpiceGstaudioPrivate *p = gstaudio->priv;
     GstQuery *q;
 
@@ -270,9 +286,33 @@ static gboolean update_mmtime_timeout_cb(gpointer data)
         SPICE_DEBUG("got min latency %" GST_TIME_FORMAT ", max latency %"
                     GST_TIME_FORMAT ", live %d", GST_TIME_ARGS (minlat),
                     GST_TIME_ARGS (maxlat), live);
-        spice_playback_channel_set_delay(SPICE_PLAYBACK_CHANNEL(p->pchannel), GST_TIME_AS_MSECONDS(minlat));
+        p->latency = GST_TIME_AS_MSECONDS(minlat);
+        p->delay_time = g_get_monotonic_time();
+        if (p->pchannel != NULL)
+            spice_playback_channel_set_delay(SPICE_PLAYBACK_CHANNEL(p->pchannel), p->latency);
     }
     gst_query_unref (q);
+}
+
+static gboolean playback_bus_cb(GstBus *bus, GstMessage *msg, gpointer data)
+{
+    SpiceGstaudio *gstaudio = data;
+    SpiceGstaudioPrivate *p = gstaudio->priv;
+
+    g_return_val_if_fail(p != NULL, FALSE);
+
+    switch (GST_MESSAGE_TYPE(msg)) {
+    case GST_MESSAGE_LATENCY:
+        gst_bin_recalculate_latency(GST_BIN(p->playback.pipe));
+        playback_update_latency(gstaudio);
+        break;
+    case GST_MESSAGE_ASYNC_DONE:
+        /* the sink is ready, the latency is known */
+        playback_update_latency(gstaudio);
+        break;
+    default:
+        break;
+    }
 
     return TRUE;
 }
@@ -286,51 +326,49 @@ static void playback_start(SpicePlaybackChannel *channel, gint format, gint chan
     g_return_if_fail(p != NULL);
     g_return_if_fail(format == SPICE_AUDIO_FMT_S16);
 
-    if (p->playback.pipe &&
-        (p->playback.rate != frequency ||
-         p->playback.channels != channels)) {
-        playback_stop(channel, data);
-        gst_object_unref(p->playback.pipe);
-        p->playback.pipe = NULL;
-    }
-
     if (!p->playback.pipe) {
         GError *error = NULL;
-        gchar *audio_caps =
-            g_strdup_printf("audio/x-raw,format=\"S16LE\",channels=%d,rate=%d,"
-                            "layout=interleaved", channels, frequency);
+        GstBus *bus;
         gchar *pipeline = g_strdup (g_getenv("SPICE_GST_AUDIOSINK"));
         if (pipeline == NULL)
-            pipeline = g_strdup_printf("appsrc is-live=1 do-timestamp=0 caps=\"%s\" name=\"appsrc\" ! queue ! "
-                                       "audioconvert ! audioresample ! autoaudiosink name=\"audiosink\"", audio_caps);
+            pipeline = g_strdup("appsrc is-live=1 do-timestamp=0 name=\"appsrc\" ! queue ! "
+                                "audioconvert ! audioresample ! autoaudiosink name=\"audiosink\"");
         SPICE_DEBUG("audio pipeline: %s", pipeline);
         p->playback.pipe = gst_parse_launch(pipeline, &error);
+        g_free(pipeline);
         if (error != NULL) {
             g_warning("Failed to create pipeline: %s", error->message);
-            goto cleanup;
+            if (p->playback.pipe != NULL) {
+                gst_object_unref(p->playback.pipe);
+                p->playback.pipe = NULL;
+            }
+            g_clear_error(&error);
+            return;
         }
+
+        bus = gst_pipeline_get_bus(GST_PIPELINE(p->playback.pipe));
+        p->playback.bus_id = gst_bus_add_watch(bus, playback_bus_cb, data);
+        gst_object_unref(GST_OBJECT(bus));
+
         p->playback.src = gst_bin_get_by_name(GST_BIN(p->playback.pipe), "appsrc");
         p->playback.sink = gst_bin_get_by_name(GST_BIN(p->playback.pipe), "audiosink");
-        p->playback.rate = frequency;
-        p->playback.channels = channels;
-
-cleanup:
-        if (error != NULL && p->playback.pipe != NULL) {
-            gst_object_unref(p->playback.pipe);
-            p->playback.pipe = NULL;
-        }
-        g_clear_error(&error);
-        g_free(audio_caps);
-        g_free(pipeline);
+        p->playback.rate = 0;
+        p->playback.channels = 0;
     }
 
-    if (p->playback.pipe)
-        gst_element_set_state(p->playback.pipe, GST_STATE_PLAYING);
+    if (p->playback.src &&
+        (p->playback.rate != frequency ||
+         p->playback.channels != channels)) {
+        GstCaps *caps = audio_caps_new(channels, frequency);
 
-    if (p->mmtime_id == 0) {
-        update_mmtime_timeout_cb(gstaudio);
-        p->mmtime_id = g_timeout_add_seconds(1, update_mmtime_timeout_cb, gstaudio);
+        /* the caps go downstream with the next buffer */
+        gst_app_src_set_caps(GST_APP_SRC(p->playback.src), caps);
+        gst_caps_unref(caps);
+        p->playback.rate = frequency;
+        p->playback.channels = channels;
     }
+
+    gst_element_set_state(p->playback.pipe, GST_STATE_PLAYING);
 }
 
 static void playback_data(SpicePlaybackChannel *channel,
@@ -340,12 +378,24 @@ static void playback_data(SpicePlaybackChannel *channel,
     SpiceGstaudio *gstaudio = data;
     SpiceGstaudioPrivate *p = gstaudio->priv;
     GstBuffer *buf;
+    gint64 now;
 
     g_return_if_fail(p != NULL);
 
-    audio = g_memdup(audio, size); /* TODO: try to avoid memory copy */
-    buf = gst_buffer_new_wrapped(audio, size);
+    if (!p->playback.src)
+        return;
+
+    buf = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, audio, size, 0, size,
+                                      spice_playback_data_ref(audio),
+                                      spice_playback_data_unref);
     gst_app_src_push_buffer(GST_APP_SRC(p->playback.src), buf);
+
+    /* keep the session clock following the audio position */
+    now = g_get_monotonic_time();
+    if (p->delay_time != 0 && now - p->delay_time >= DELAY_UPDATE_MS * 1000) {
+        p->delay_time = now;
+        spice_playback_channel_set_delay(channel, p->latency);
+    }
 }
 
 #define VOLUME_NORMAL 65535
@@ -0,0 +1,266 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include "spice-mm-clock.h"
+#include "spice-util-priv.h"
+
+/*
+ * Multimedia clock recovery.
+ *
+ * The session mm-time is sampled from the main channel and from the
+ * playback channel, which reports the mm-time of the audio being
+ * heard. Instead of jumping to each sample, the clock follows them
+ * like a PLL: a fraction of the error between a sample and the clock
+ * is corrected by slewing the clock at most MM_CLOCK_MAX_SLEW, which
+ * filters out the network jitter. The clock runs at the rate of the
+ * server clock relative to the monotonic clock: the skew is measured
+ * from the average offset between the samples and the monotonic
+ * clock over successive windows, the windows in which the offset
+ * moved too much for a clock drift (latency changes) being ignored.
+ * The clock thus never goes backwards, and only jumps when the error
+ * is larger than MM_CLOCK_RESET_THRESH_MS, after a migration or a
+ * server side reset.
+ *
+ * While audio is playing, it is the reference: the video streams are
+ * scheduled with this clock, so they follow the audio, and the server
+ * samples are only used to detect discontinuities. The difference
+ * between the clock and the audio samples is the A/V offset.
+ */
+#define MM_CLOCK_RESET_THRESH_MS   500
+#define MM_CLOCK_MAX_SLEW          0.05
+#define MM_CLOCK_MAX_SKEW          0.0005
+#define MM_CLOCK_PHASE_GAIN        0.1
+#define MM_CLOCK_SKEW_WINDOW_MS    10000
+#define MM_CLOCK_SKEW_WEIGHT       0.25
+#define MM_CLOCK_AUDIO_TIMEOUT_MS  2000
+#define MM_CLOCK_AV_OFFSET_WEIGHT  0.125
+
+struct SpiceMmClock {
+    STATIC_MUTEX lock;
+    gboolean     valid;
+    gint64       base_clock;  /* monotonic time of the last sample, us */
+    gdouble      base_time;   /* clock at base_clock, ms */
+    gdouble      slew;        /* correction left to apply since base_clock, ms */
+    gdouble      skew;
+    SpiceMmClockSource window_source;
+    gint64       window_start;
+    gdouble      window_offset; /* sum of the sample offsets in the window, ms */
+    gdouble      window_clock;  /* sum of the sample times in the window, ms */
+    guint        window_samples;
+    gboolean     has_prev;
+    gdouble      prev_offset;   /* average offset of the previous window */
+    gdouble      prev_clock;    /* average time of the previous window */
+    gdouble      offset;      /* error of the last sample, ms */
+    gdouble      av_offset;
+    gint64       audio_clock; /* monotonic time of the last audio sample */
+};
+
+G_GNUC_INTERNAL
+SpiceMmClock *spice_mm_clock_new(void)
+{
+    SpiceMmClock *clock = g_new0(SpiceMmClock, 1);
+
+    STATIC_MUTEX_INIT(clock->lock);
+
+    return clock;
+}
+
+G_GNUC_INTERNAL
+void spice_mm_clock_free(SpiceMmClock *clock)
+{
+    if (clock == NULL)
+        return;
+
+    STATIC_MUTEX_CLEAR(clock->lock);
+    g_free(clock);
+}
+
+static gdouble mm_clock_at(SpiceMmClock *clock, gint64 now)
+{
+    gdouble elapsed = MAX(now - clock->base_clock, 0) / 1000.;
+    gdouble max = elapsed * MM_CLOCK_MAX_SLEW;
+    gdouble slew = CLAMP(clock->slew, -max, max);
+
+    return clock->base_time + elapsed * (1. + clock->skew) + slew;
+}
+
+static void mm_clock_reset(SpiceMmClock *clock, guint32 time, gint64 now)
+{
+    clock->valid = TRUE;
+    clock->base_clock = now;
+    clock->base_time = time;
+    clock->slew = 0;
+    clock->skew = 0;
+    clock->window_samples = 0;
+    clock->has_prev = FALSE;
+    clock->offset = 0;
+    clock->av_offset = 0;
+}
+
+static void mm_clock_measure_skew(SpiceMmClock *clock, SpiceMmClockSource source,
+                                  guint32 time, gint64 now)
+{
+    gdouble offset, local;
+
+    if (clock->window_samples > 0 && source != clock->window_source) {
+        clock->window_samples = 0;
+        clock->has_prev = FALSE;
+    }
+    if (clock->window_samples == 0) {
+        clock->window_source = source;
+        clock->window_start = now;
+        clock->window_offset = 0;
+        clock->window_clock = 0;
+    }
+
+    /* the difference is taken modulo 2^32, like the mm-time */
+    clock->window_offset += (gint32)(time - (guint32)(now / 1000));
+    clock->window_clock += now / 1000.;
+    clock->window_samples++;
+
+    if (now - clock->window_start < MM_CLOCK_SKEW_WINDOW_MS * 1000)
+        return;
+
+    offset = clock->window_offset / clock->window_samples;
+    local = clock->window_clock / clock->window_samples;
+    if (clock->has_prev) {
+        gdouble skew = (offset - clock->prev_offset) / (local - clock->prev_clock);
+
+        if (ABS(skew) <= MM_CLOCK_MAX_SKEW)
+            clock->skew += (skew - clock->skew) * MM_CLOCK_SKEW_WEIGHT;
+    }
+    clock->has_prev = TRUE;
+    clock->prev_offset = offset;
+    clock->prev_clock = local;
+    clock->window_samples = 0;
+}
+
+/* returns TRUE if the clock was reset to @time */
+G_GNUC_INTERNAL
+gboolean spice_mm_clock_update(SpiceMmClock *clock, SpiceMmClockSource source,
+                               guint32 time, gint64 now)
+{
+    gboolean reset = FALSE;
+    gboolean audio_playing;
+    gdouble cur;
+    gint32 error;
+
+    g_return_val_if_fail(clock != NULL, FALSE);
+
+    STATIC_MUTEX_LOCK(clock->lock);
+
+    if (!clock->valid) {
+        mm_clock_reset(clock, time, now);
+        goto end;
+    }
+
+    cur = mm_clock_at(clock, now);
+    error = (gint32)(time - (guint32)(guint64)cur);
+    audio_playing = clock->audio_clock != 0 &&
+        now - clock->audio_clock < MM_CLOCK_AUDIO_TIMEOUT_MS * 1000;
+
+    if (error > MM_CLOCK_RESET_THRESH_MS || error < -MM_CLOCK_RESET_THRESH_MS) {
+        SPICE_DEBUG("mm-clock reset, clock %u, new %u",
+                    (guint32)(guint64)cur, time);
+        mm_clock_reset(clock, time, now);
+        reset = TRUE;
+        goto end;
+    }
+
+    if (source == SPICE_MM_CLOCK_SERVER && audio_playing)
+        goto end;
+
+    mm_clock_measure_skew(clock, source, time, now);
+    clock->base_time = cur;
+    clock->base_clock = now;
+    clock->slew = error * MM_CLOCK_PHASE_GAIN;
+    clock->offset = error;
+
+    if (source == SPICE_MM_CLOCK_AUDIO) {
+        /* positive when the video is ahead of the audio */
+        clock->av_offset += (-error - clock->av_offset) * MM_CLOCK_AV_OFFSET_WEIGHT;
+    }
+
+end:
+    if (source == SPICE_MM_CLOCK_AUDIO)
+        clock->audio_clock = now;
+    STATIC_MUTEX_UNLOCK(clock->lock);
+
+    return reset;
+}
+
+G_GNUC_INTERNAL
+guint32 spice_mm_clock_get_time(SpiceMmClock *clock, gint64 now)
+{
+    guint32 time = 0;
+
+    g_return_val_if_fail(clock != NULL, 0);
+
+    STATIC_MUTEX_LOCK(clock->lock);
+    if (clock->valid)
+        time = (guint32)(guint64)mm_clock_at(clock, now);
+    STATIC_MUTEX_UNLOCK(clock->lock);
+
+    return time;
+}
+
+/* in ms, the error of the last sample */
+G_GNUC_INTERNAL
+gint spice_mm_clock_get_offset(SpiceMmClock *clock)
+{
+    gint offset;
+
+    g_return_val_if_fail(clock != NULL, 0);
+
+    STATIC_MUTEX_LOCK(clock->lock);
+    offset = (gint)clock->offset;
+    STATIC_MUTEX_UNLOCK(clock->lock);
+
+    return offset;
+}
+
+/* in ms, positive when the video is ahead of the audio */
+G_GNUC_INTERNAL
+gint spice_mm_clock_get_av_offset(SpiceMmClock *clock)
+{
+    gint offset;
+
+    g_return_val_if_fail(clock != NULL, 0);
+
+    STATIC_MUTEX_LOCK(clock->lock);
+    offset = (gint)clock->av_offset;
+    STATIC_MUTEX_UNLOCK(clock->lock);
+
+    return offset;
+}
+
+/* in ppm, positive when the server clock is faster */
+G_GNUC_INTERNAL
+gdouble spice_mm_clock_get_skew(SpiceMmClock *clock)
+{
+    gdouble skew;
+
+    g_return_val_if_fail(clock != NULL, 0);
+
+    STATIC_MUTEX_LOCK(clock->lock);
+    skew = clock->skew * 1e6;
+    STATIC_MUTEX_UNLOCK(clock->lock);
+
+    return skew;
+}
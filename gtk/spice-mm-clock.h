@@ -0,0 +1,44 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SPICE_MM_CLOCK_H_
+# define SPICE_MM_CLOCK_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    SPICE_MM_CLOCK_SERVER, /* main channel mm-time */
+    SPICE_MM_CLOCK_AUDIO,  /* mm-time of the audio being heard */
+} SpiceMmClockSource;
+
+typedef struct SpiceMmClock SpiceMmClock;
+
+/* @now is a g_get_monotonic_time() timestamp */
+SpiceMmClock *spice_mm_clock_new(void);
+void spice_mm_clock_free(SpiceMmClock *clock);
+gboolean spice_mm_clock_update(SpiceMmClock *clock, SpiceMmClockSource source,
+                               guint32 time, gint64 now);
+guint32 spice_mm_clock_get_time(SpiceMmClock *clock, gint64 now);
+gint spice_mm_clock_get_offset(SpiceMmClock *clock);
+gint spice_mm_clock_get_av_offset(SpiceMmClock *clock);
+gdouble spice_mm_clock_get_skew(SpiceMmClock *clock);
+
+G_END_DECLS
+
+#endif // SPICE_MM_CLOCK_H_
@@ -0,0 +1,547 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * An audio backend without sound device, for benchmarks and tests on
+ * machines without sound hardware or server, selected by setting
+ * SPICE_AUDIO_BACKEND=null in the environment.
+ *
+ * Playback goes to a virtual device, which plays the samples at the
+ * pace of the monotonic clock, and whose buffer fill is reported as
+ * the playback delay. The samples are discarded, or written to the WAV
+ * file named by SPICE_NULL_AUDIO_PLAYBACK_FILE.
+ *
+ * Recording produces a 440Hz tone, or loops over the WAV or raw S16
+ * file named by SPICE_NULL_AUDIO_RECORD_FILE, which is expected to have
+ * the format requested by the server. The samples are sent every
+ * SPICE_NULL_AUDIO_RECORD_PERIOD ms (default 20).
+ */
+#include "config.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <glib/gstdio.h>
+
+#include "spice-nullaudio.h"
+#include "spice-common.h"
+#include "spice-session.h"
+#include "spice-util.h"
+#include "spice-audio-priv.h"
+
+#define SPICE_NULLAUDIO_GET_PRIVATE(obj)                                  \
+    (G_TYPE_INSTANCE_GET_PRIVATE((obj), SPICE_TYPE_NULLAUDIO, SpiceNullaudioPrivate))
+
+G_DEFINE_TYPE(SpiceNullaudio, spice_nullaudio, SPICE_TYPE_AUDIO)
+
+/* the latency of the virtual device, besides its buffer */
+#define DEVICE_LATENCY_MS       20
+#define DEVICE_MAX_BUFFER_MS    1000
+#define DELAY_UPDATE_MS         100
+#define RECORD_PERIOD_MS        20
+#define RECORD_MAX_CATCHUP_MS   200
+#define RECORD_TONE_HZ          440
+#define RECORD_TONE_AMPLITUDE   8000
+#define WAV_HEADER_SIZE         44
+
+struct stream {
+    guint                   rate;
+    guint                   channels;
+    gint64                  start;   /* monotonic time of the first frame */
+    guint64                 frames;  /* frames written or read since start */
+};
+
+struct _SpiceNullaudioPrivate {
+    SpiceChannel            *pchannel;
+    SpiceChannel            *rchannel;
+    struct stream           playback;
+    struct stream           record;
+
+    gint64                  delay_time;
+    FILE                    *playback_file;
+    guint32                 playback_file_size;
+
+    guint                   record_period;
+    guint                   record_id;
+    gboolean                record_mute;
+    gint16                  *record_buf;
+    gchar                   *record_input;
+    gsize                   record_input_size;
+    gsize                   record_input_pos;
+    gdouble                 record_phase;
+};
+
+static gboolean connect_channel(SpiceAudio *audio, SpiceChannel *channel);
+static void channel_weak_notified(gpointer data, GObject *where_the_object_was);
+static void record_stop(SpiceNullaudio *nullaudio);
+
+/* ------------------------------------------------------------------ */
+/* WAV files                                                          */
+
+static void wav_put_u32(guint8 *p, guint32 v)
+{
+    v = GUINT32_TO_LE(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static void wav_put_u16(guint8 *p, guint16 v)
+{
+    v = GUINT16_TO_LE(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static void wav_write_header(FILE *f, guint channels, guint rate, guint32 data_size)
+{
+    guint8 h[WAV_HEADER_SIZE];
+
+    memcpy(h, "RIFF", 4);
+    wav_put_u32(h + 4, 36 + data_size);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    wav_put_u32(h + 16, 16);
+    wav_put_u16(h + 20, 1); /* PCM */
+    wav_put_u16(h + 22, channels);
+    wav_put_u32(h + 24, rate);
+    wav_put_u32(h + 28, rate * channels * sizeof(gint16));
+    wav_put_u16(h + 32, channels * sizeof(gint16));
+    wav_put_u16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    wav_put_u32(h + 40, data_size);
+
+    if (fseek(f, 0, SEEK_SET) < 0 || fwrite(h, sizeof(h), 1, f) != 1)
+        g_warning("failed to write the WAV header");
+    fseek(f, 0, SEEK_END);
+}
+
+/* returns the offset of the samples in a WAV file, or 0 for raw data */
+static gsize wav_data_offset(const gchar *data, gsize size)
+{
+    gsize pos = 12;
+
+    if (size < WAV_HEADER_SIZE || memcmp(data, "RIFF", 4) != 0 ||
+        memcmp(data + 8, "WAVE", 4) != 0)
+        return 0;
+
+    while (pos + 8 <= size) {
+        guint32 chunk_size;
+
+        memcpy(&chunk_size, data + pos + 4, sizeof(chunk_size));
+        chunk_size = GUINT32_FROM_LE(chunk_size);
+        if (memcmp(data + pos, "data", 4) == 0)
+            return pos + 8;
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    return size;
+}
+
+static void playback_file_close(SpiceNullaudioPrivate *p)
+{
+    if (p->playback_file == NULL)
+        return;
+
+    wav_write_header(p->playback_file, p->playback.channels,
+                     p->playback.rate, p->playback_file_size);
+    fclose(p->playback_file);
+    p->playback_file = NULL;
+}
+
+static void playback_file_open(SpiceNullaudioPrivate *p)
+{
+    const gchar *filename = g_getenv("SPICE_NULL_AUDIO_PLAYBACK_FILE");
+
+    if (filename == NULL)
+        return;
+
+    p->playback_file = g_fopen(filename, "wb");
+    if (p->playback_file == NULL) {
+        g_warning("failed to open %s: %s", filename, g_strerror(errno));
+        return;
+    }
+    p->playback_file_size = 0;
+    wav_write_header(p->playback_file, p->playback.channels, p->playback.rate, 0);
+}
+
+/* ------------------------------------------------------------------ */
+/* object                                                             */
+
+static void spice_nullaudio_finalize(GObject *obj)
+{
+    SpiceNullaudioPrivate *p = SPICE_NULLAUDIO(obj)->priv;
+
+    g_free(p->record_buf);
+    g_free(p->record_input);
+
+    G_OBJECT_CLASS(spice_nullaudio_parent_class)->finalize(obj);
+}
+
+static void spice_nullaudio_dispose(GObject *obj)
+{
+    SpiceNullaudio *nullaudio = SPICE_NULLAUDIO(obj);
+    SpiceNullaudioPrivate *p;
+    SPICE_DEBUG("%s", __FUNCTION__);
+    p = nullaudio->priv;
+
+    record_stop(nullaudio);
+    playback_file_close(p);
+
+    if (p->pchannel)
+        g_object_weak_unref(G_OBJECT(p->pchannel), channel_weak_notified, nullaudio);
+    p->pchannel = NULL;
+
+    if (p->rchannel)
+        g_object_weak_unref(G_OBJECT(p->rchannel), channel_weak_notified, nullaudio);
+    p->rchannel = NULL;
+
+    if (G_OBJECT_CLASS(spice_nullaudio_parent_class)->dispose)
+        G_OBJECT_CLASS(spice_nullaudio_parent_class)->dispose(obj);
+}
+
+static void spice_nullaudio_init(SpiceNullaudio *nullaudio)
+{
+    nullaudio->priv = SPICE_NULLAUDIO_GET_PRIVATE(nullaudio);
+}
+
+static void spice_nullaudio_class_init(SpiceNullaudioClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    SpiceAudioClass *audio_class = SPICE_AUDIO_CLASS(klass);
+
+    audio_class->connect_channel = connect_channel;
+
+    gobject_class->finalize = spice_nullaudio_finalize;
+    gobject_class->dispose = spice_nullaudio_dispose;
+
+    g_type_class_add_private(klass, sizeof(SpiceNullaudioPrivate));
+}
+
+/* ------------------------------------------------------------------ */
+/* playback                                                           */
+
+static guint64 stream_elapsed_frames(struct stream *s, gint64 now)
+{
+    return (guint64)(now - s->start) * s->rate / G_USEC_PER_SEC;
+}
+
+static void playback_start(SpicePlaybackChannel *channel, gint format, gint channels,
+                           gint frequency, gpointer data)
+{
+    SpiceNullaudio *nullaudio = data;
+    SpiceNullaudioPrivate *p = nullaudio->priv;
+
+    g_return_if_fail(p != NULL);
+    g_return_if_fail(format == SPICE_AUDIO_FMT_S16);
+    g_return_if_fail(channels > 0 && frequency > 0);
+
+    if (p->playback_file != NULL &&
+        (p->playback.rate != frequency ||
+         p->playback.channels != channels))
+        playback_file_close(p);
+
+    p->playback.rate = frequency;
+    p->playback.channels = channels;
+    p->playback.start = g_get_monotonic_time();
+    p->playback.frames = 0;
+    p->delay_time = 0;
+
+    if (p->playback_file == NULL)
+        playback_file_open(p);
+}
+
+static void playback_data(SpicePlaybackChannel *channel,
+                          gpointer *audio, gint size,
+                          gpointer data)
+{
+    SpiceNullaudio *nullaudio = data;
+    SpiceNullaudioPrivate *p = nullaudio->priv;
+    struct stream *s = &p->playback;
+    gint64 now = g_get_monotonic_time();
+    guint frame_size = s->channels * sizeof(gint16);
+    guint64 played, buffered;
+
+    g_return_if_fail(p != NULL);
+    g_return_if_fail(s->rate > 0);
+
+    played = stream_elapsed_frames(s, now);
+    if (played > s->frames) {
+        /* underflow, the device played silence until now */
+        s->start = now - (gint64)(s->frames * G_USEC_PER_SEC / s->rate);
+        played = s->frames;
+    }
+    buffered = s->frames - played;
+
+    if (buffered * 1000 / s->rate >= DEVICE_MAX_BUFFER_MS) {
+        SPICE_DEBUG("null playback overflow, dropping %d bytes", size);
+    } else {
+        s->frames += size / frame_size;
+        buffered += size / frame_size;
+        if (p->playback_file != NULL) {
+            if (fwrite(audio, size, 1, p->playback_file) == 1)
+                p->playback_file_size += size;
+            else
+                g_warning("failed to write the playback file");
+        }
+    }
+
+    if (now - p->delay_time >= DELAY_UPDATE_MS * 1000) {
+        p->delay_time = now;
+        spice_playback_channel_set_delay(channel,
+                                         buffered * 1000 / s->rate + DEVICE_LATENCY_MS);
+    }
+}
+
+static void playback_stop(SpicePlaybackChannel *channel, gpointer data)
+{
+    SpiceNullaudio *nullaudio = data;
+    SpiceNullaudioPrivate *p = nullaudio->priv;
+
+    /* the file is kept open, if the playback restarts with the same format */
+    if (p->playback_file != NULL) {
+        wav_write_header(p->playback_file, p->playback.channels,
+                         p->playback.rate, p->playback_file_size);
+        fflush(p->playback_file);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* record                                                             */
+
+static void record_fill(SpiceNullaudioPrivate *p, gint16 *dest, guint n_frames)
+{
+    struct stream *s = &p->record;
+    gsize size = n_frames * s->channels * sizeof(gint16);
+    guint i, ch;
+
+    if (p->record_mute) {
+        memset(dest, 0, size);
+        return;
+    }
+
+    if (p->record_input != NULL) {
+        guint8 *out = (guint8 *)dest;
+
+        while (size > 0) {
+            gsize n = MIN(size, p->record_input_size - p->record_input_pos);
+
+            memcpy(out, p->record_input + p->record_input_pos, n);
+            out += n;
+            size -= n;
+            p->record_input_pos += n;
+            if (p->record_input_pos == p->record_input_size)
+                p->record_input_pos = 0;
+        }
+        return;
+    }
+
+    for (i = 0; i < n_frames; i++) {
+        gint16 v = RECORD_TONE_AMPLITUDE * sin(p->record_phase);
+
+        for (ch = 0; ch < s->channels; ch++)
+            dest[i * s->channels + ch] = v;
+        p->record_phase += 2 * G_PI * RECORD_TONE_HZ / s->rate;
+        if (p->record_phase >= 2 * G_PI)
+            p->record_phase -= 2 * G_PI;
+    }
+}
+
+static gboolean record_timeout_cb(gpointer data)
+{
+    SpiceNullaudio *nullaudio = data;
+    SpiceNullaudioPrivate *p = nullaudio->priv;
+    struct stream *s = &p->record;
+    guint64 due = stream_elapsed_frames(s, g_get_monotonic_time());
+    guint max_frames = s->rate * RECORD_MAX_CATCHUP_MS / 1000;
+    guint n_frames;
+
+    if (p->rchannel == NULL)
+        return FALSE;
+
+    if (due - s->frames > max_frames) {
+        /* the main loop was stalled, skip the samples that were missed */
+        s->frames = due - max_frames;
+    }
+    n_frames = due - s->frames;
+    if (n_frames == 0)
+        return TRUE;
+
+    record_fill(p, p->record_buf, n_frames);
+    s->frames += n_frames;
+    /* the channel timestamps the data with the session mm-time */
+    spice_record_send_data(SPICE_RECORD_CHANNEL(p->rchannel), p->record_buf,
+                           n_frames * s->channels * sizeof(gint16), 0);
+
+    return TRUE;
+}
+
+static void record_load_input(SpiceNullaudioPrivate *p)
+{
+    const gchar *filename = g_getenv("SPICE_NULL_AUDIO_RECORD_FILE");
+    guint frame_size = p->record.channels * sizeof(gint16);
+    GError *error = NULL;
+    gchar *contents;
+    gsize size, offset;
+
+    g_clear_pointer(&p->record_input, g_free);
+    if (filename == NULL)
+        return;
+
+    if (!g_file_get_contents(filename, &contents, &size, &error)) {
+        g_warning("failed to read %s: %s", filename, error->message);
+        g_clear_error(&error);
+        return;
+    }
+
+    offset = wav_data_offset(contents, size);
+    size = (size - offset) / frame_size * frame_size;
+    if (size == 0) {
+        g_warning("no samples in %s", filename);
+        g_free(contents);
+        return;
+    }
+
+    memmove(contents, contents + offset, size);
+    p->record_input = contents;
+    p->record_input_size = size;
+    p->record_input_pos = 0;
+}
+
+static void record_stop(SpiceNullaudio *nullaudio)
+{
+    SpiceNullaudioPrivate *p = nullaudio->priv;
+
+    SPICE_DEBUG("%s", __FUNCTION__);
+    if (p->record_id != 0) {
+        g_source_remove(p->record_id);
+        p->record_id = 0;
+    }
+}
+
+static void record_start(SpiceRecordChannel *channel, gint format, gint channels,
+                         gint frequency, gpointer data)
+{
+    SpiceNullaudio *nullaudio = data;
+    SpiceNullaudioPrivate *p = nullaudio->priv;
+    SpiceAudioPrivate *audio = SPICE_AUDIO(nullaudio)->priv;
+    GSource *source;
+
+    g_return_if_fail(p != NULL);
+    g_return_if_fail(format == SPICE_AUDIO_FMT_S16);
+    g_return_if_fail(channels > 0 && frequency > 0);
+
+    record_stop(nullaudio);
+
+    if (p->record_input == NULL || p->record.channels != channels) {
+        p->record.channels = channels;
+        record_load_input(p);
+    }
+    p->record.rate = frequency;
+    p->record.start = g_get_monotonic_time();
+    p->record.frames = 0;
+    p->record_phase = 0;
+
+    g_free(p->record_buf);
+    p->record_buf = g_new(gint16, (frequency * RECORD_MAX_CATCHUP_MS / 1000) * channels);
+
+    source = g_timeout_source_new(p->record_period);
+    g_source_set_callback(source, record_timeout_cb, nullaudio, NULL);
+    p->record_id = g_source_attach(source, audio->main_context);
+    g_source_unref(source);
+}
+
+static void record_mute_changed(GObject *object, GParamSpec *pspec, gpointer data)
+{
+    SpiceNullaudio *nullaudio = data;
+    SpiceNullaudioPrivate *p = nullaudio->priv;
+
+    g_object_get(object, "mute", &p->record_mute, NULL);
+}
+
+/* ------------------------------------------------------------------ */
+
+static void
+channel_weak_notified(gpointer data,
+                      GObject *where_the_object_was)
+{
+    SpiceNullaudio *nullaudio = SPICE_NULLAUDIO(data);
+    SpiceNullaudioPrivate *p = nullaudio->priv;
+
+    if (where_the_object_was == (GObject *)p->pchannel) {
+        p->pchannel = NULL;
+    } else if (where_the_object_was == (GObject *)p->rchannel) {
+        SPICE_DEBUG("record closed");
+        record_stop(nullaudio);
+        p->rchannel = NULL;
+    }
+}
+
+static gboolean connect_channel(SpiceAudio *audio, SpiceChannel *channel)
+{
+    SpiceNullaudio *nullaudio = SPICE_NULLAUDIO(audio);
+    SpiceNullaudioPrivate *p = nullaudio->priv;
+
+    if (SPICE_IS_PLAYBACK_CHANNEL(channel)) {
+        g_return_val_if_fail(p->pchannel == NULL, FALSE);
+
+        p->pchannel = channel;
+        g_object_weak_ref(G_OBJECT(p->pchannel), channel_weak_notified, audio);
+        spice_g_signal_connect_object(channel, "playback-start",
+                                      G_CALLBACK(playback_start), nullaudio, 0);
+        spice_g_signal_connect_object(channel, "playback-data",
+                                      G_CALLBACK(playback_data), nullaudio, 0);
+        spice_g_signal_connect_object(channel, "playback-stop",
+                                      G_CALLBACK(playback_stop), nullaudio, 0);
+
+        return TRUE;
+    }
+
+    if (SPICE_IS_RECORD_CHANNEL(channel)) {
+        g_return_val_if_fail(p->rchannel == NULL, FALSE);
+
+        p->rchannel = channel;
+        g_object_weak_ref(G_OBJECT(p->rchannel), channel_weak_notified, audio);
+        spice_g_signal_connect_object(channel, "record-start",
+                                      G_CALLBACK(record_start), nullaudio, 0);
+        spice_g_signal_connect_object(channel, "record-stop",
+                                      G_CALLBACK(record_stop), nullaudio, G_CONNECT_SWAPPED);
+        spice_g_signal_connect_object(channel, "notify::mute",
+                                      G_CALLBACK(record_mute_changed), nullaudio, 0);
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+SpiceNullaudio *spice_nullaudio_new(SpiceSession *session, GMainContext *context,
+                                    const char *name)
+{
+    SpiceNullaudio *nullaudio;
+    const gchar *period;
+
+    nullaudio = g_object_new(SPICE_TYPE_NULLAUDIO,
+                             "session", session,
+                             "main-context", context,
+                             NULL);
+
+    period = g_getenv("SPICE_NULL_AUDIO_RECORD_PERIOD");
+    nullaudio->priv->record_period = period ? atoi(period) : RECORD_PERIOD_MS;
+    nullaudio->priv->record_period = CLAMP(nullaudio->priv->record_period,
+                                           1, RECORD_MAX_CATCHUP_MS);
+
+    return nullaudio;
+}
@@ -40,6 +40,7 @@ static gboolean disable_usbredir = FALSE;
 static gint cache_size = 0;
 static gint glz_window_size = 0;
 static gchar *secure_channels = NULL;
+static GStrv io_threads = NULL;
 static gchar *shared_dir = NULL;
 
 G_GNUC_NORETURN
@@ -138,6 +139,28 @@ static gboolean parse_secure_channels(const gchar *option_name, const gchar *val
 }
 
 
+static gboolean parse_io_threads(const gchar *option_name, const gchar *value,
+                                 gpointer data, GError **error)
+{
+    GStrv it;
+
+    g_strfreev(io_threads);
+    io_threads = g_strsplit(value, ",", -1);
+    for (it = io_threads; *it != NULL; it++) {
+        if ((g_strcmp0(*it, "display") != 0)
+             && (g_strcmp0(*it, "playback") != 0)
+             && (g_strcmp0(*it, "usbredir") != 0)) {
+            g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED,
+                    _("invalid channel name (%s), must be 'display', 'playback' or 'usbredir'"), *it);
+            g_strfreev(io_threads);
+            io_threads = NULL;
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
 static gboolean parse_usbredir_filter(const gchar *option_name,
                                       const gchar *value,
                                       gpointer data, GError **error)
@@ -194,6 +217,8 @@ GOptionGroup* spice_get_option_group(void)
           N_("Glz compression history size"), N_("<bytes>") },
         { "spice-shared-dir", '\0', 0, G_OPTION_ARG_FILENAME, &shared_dir,
           N_("Shared directory"), N_("<dir>") },
+        { "spice-io-threads", '\0', 0, G_OPTION_ARG_CALLBACK, parse_io_threads,
+          N_("Process the specified channels in their own threads"), "<display,playback,usbredir>" },
 
         { "spice-debug", '\0', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK, option_debug,
           N_("Enable Spice-GTK debugging"), NULL },
@@ -233,6 +258,9 @@ void spice_set_session_option(SpiceSession *session)
         g_object_set(session, "disable-effects", disable_effects, NULL);
     }
 
+    if (io_threads)
+        g_object_set(session, "io-threads", io_threads, NULL);
+
     if (secure_channels) {
         GStrv channels;
         channels = g_strsplit(secure_channels, ",", -1);
@@ -22,6 +22,7 @@
 #include "spice-session-priv.h"
 #include "spice-channel-priv.h"
 #include "spice-util-priv.h"
+#include "channel-playback-priv.h"
 
 #include <pulse/glib-mainloop.h>
 #include <pulse/pulseaudio.h>
@@ -29,6 +30,34 @@
 #define SPICE_PULSE_GET_PRIVATE(obj)                                  \
     (G_TYPE_INSTANCE_GET_PRIVATE((obj), SPICE_TYPE_PULSE, SpicePulsePrivate))
 
+/*
+ * The buffering of the streams depends on the latency profile: the
+ * playback buffer (tlength) starts at buffer_ms, and the record
+ * fragments (fragsize) at fragsize_ms. They are doubled, up to their
+ * maximum, after an underflow or an overflow, and reduced by a
+ * quarter, down to their initial size, after stable_s seconds
+ * without any.
+ */
+typedef struct LatencyProfile {
+    const gchar             *name;
+    guint                   buffer_ms;
+    guint                   max_buffer_ms;
+    guint                   minreq_ms;
+    guint                   fragsize_ms;
+    guint                   max_fragsize_ms;
+    guint                   stable_s;
+} LatencyProfile;
+
+static const LatencyProfile latency_profiles[] = {
+    { "interactive",  30,  200,  5,  5,  40, 10 },
+    { "balanced",    100,  400, 10, 10,  80, 30 },
+    { "robust",      250, 1000, 25, 20, 200, 60 },
+};
+#define DEFAULT_LATENCY_PROFILE (&latency_profiles[1])
+
+/* minimum time between two increases of the buffering */
+#define RESIZE_INTERVAL_MS 500
+
 struct stream {
     pa_sample_spec          spec;
     pa_stream               *stream;
@@ -37,6 +66,10 @@ struct stream {
     pa_operation            *cork_op;
     gboolean                started;
     guint                   num_underflow;
+    guint                   num_overflow;
+    guint                   buffer_ms;   /* tlength or fragsize */
+    gint64                  last_xrun;
+    gint64                  last_resize;
 };
 
 struct _SpicePulsePrivate {
@@ -50,6 +83,12 @@ struct _SpicePulsePrivate {
     struct stream           record;
     guint                   last_delay;
     guint                   target_delay;
+    const LatencyProfile    *profile;
+};
+
+enum {
+    PROP_0,
+    PROP_LATENCY_PROFILE,
 };
 
 G_DEFINE_TYPE(SpicePulse, spice_pulse, SPICE_TYPE_AUDIO)
@@ -75,6 +114,7 @@ static const char *context_state_names[] = {
     ((state < G_N_ELEMENTS(array)) ? array[state] : NULL)
 
 static void stream_stop(SpicePulse *pulse, struct stream *s);
+static void set_latency_profile(SpicePulse *pulse, const gchar *name);
 static gboolean connect_channel(SpiceAudio *audio, SpiceChannel *channel);
 static void channel_weak_notified(gpointer data, GObject *where_the_object_was);
 
@@ -132,6 +172,41 @@ static void spice_pulse_dispose(GObject *obj)
 static void spice_pulse_init(SpicePulse *pulse)
 {
     pulse->priv = SPICE_PULSE_GET_PRIVATE(pulse);
+    pulse->priv->profile = DEFAULT_LATENCY_PROFILE;
+}
+
+static void spice_pulse_get_property(GObject *gobject,
+                                     guint prop_id,
+                                     GValue *value,
+                                     GParamSpec *pspec)
+{
+    SpicePulsePrivate *p = SPICE_PULSE(gobject)->priv;
+
+    switch (prop_id) {
+    case PROP_LATENCY_PROFILE:
+        g_value_set_string(value, p->profile->name);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
+        break;
+    }
+}
+
+static void spice_pulse_set_property(GObject *gobject,
+                                     guint prop_id,
+                                     const GValue *value,
+                                     GParamSpec *pspec)
+{
+    SpicePulse *pulse = SPICE_PULSE(gobject);
+
+    switch (prop_id) {
+    case PROP_LATENCY_PROFILE:
+        set_latency_profile(pulse, g_value_get_string(value));
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
+        break;
+    }
 }
 
 static void spice_pulse_class_init(SpicePulseClass *klass)
@@ -143,6 +218,28 @@ static void spice_pulse_class_init(SpicePulseClass *klass)
 
     gobject_class->finalize = spice_pulse_finalize;
     gobject_class->dispose = spice_pulse_dispose;
+    gobject_class->get_property = spice_pulse_get_property;
+    gobject_class->set_property = spice_pulse_set_property;
+
+    /**
+     * SpicePulse:latency-profile:
+     *
+     * The buffering of the PulseAudio streams: "interactive" for the
+     * lowest latency, "balanced", or "robust" for unreliable systems.
+     * The buffers grow after underflows or overflows, and shrink back
+     * after a while without any. The default may be given with
+     * SPICE_PULSE_LATENCY_PROFILE in the environment.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_LATENCY_PROFILE,
+         g_param_spec_string("latency-profile",
+                             "Latency profile",
+                             "Latency profile of the audio streams",
+                             DEFAULT_LATENCY_PROFILE->name,
+                             G_PARAM_READWRITE |
+                             G_PARAM_STATIC_STRINGS));
 
     g_type_class_add_private(klass, sizeof(SpicePulsePrivate));
 }
@@ -253,6 +350,109 @@ static void stream_stop(SpicePulse *pulse, struct stream *s)
     s->stream = NULL;
 }
 
+static void stream_get_buffer_attr(SpicePulse *pulse, struct stream *s,
+                                   pa_buffer_attr *buffer_attr)
+{
+    SpicePulsePrivate *p = pulse->priv;
+
+    buffer_attr->maxlength = -1;
+    buffer_attr->prebuf = -1;
+    if (s == &p->playback) {
+        /* sized by the profile only: target_delay is just the amount
+         * buffered before uncorking, see stream_update_latency_callback() */
+        buffer_attr->tlength = pa_usec_to_bytes(s->buffer_ms * PA_USEC_PER_MSEC, &s->spec);
+        buffer_attr->minreq = pa_usec_to_bytes(p->profile->minreq_ms * PA_USEC_PER_MSEC,
+                                               &s->spec);
+        buffer_attr->fragsize = -1;
+    } else {
+        buffer_attr->tlength = -1;
+        buffer_attr->minreq = -1;
+        buffer_attr->fragsize = pa_usec_to_bytes(s->buffer_ms * PA_USEC_PER_MSEC, &s->spec);
+    }
+}
+
+static void stream_reset_buffer(SpicePulse *pulse, struct stream *s)
+{
+    SpicePulsePrivate *p = pulse->priv;
+
+    s->buffer_ms = s == &p->playback ? p->profile->buffer_ms : p->profile->fragsize_ms;
+    s->last_xrun = s->last_resize = g_get_monotonic_time();
+}
+
+static void stream_update_buffer(SpicePulse *pulse, struct stream *s)
+{
+    pa_buffer_attr buffer_attr;
+    pa_operation *op;
+
+    if (!s->stream || pa_stream_get_state(s->stream) != PA_STREAM_READY)
+        return;
+
+    stream_get_buffer_attr(pulse, s, &buffer_attr);
+    op = pa_stream_set_buffer_attr(s->stream, &buffer_attr, NULL, NULL);
+    if (op)
+        pa_operation_unref(op);
+}
+
+/* after an underflow or an overflow */
+static void stream_grow_buffer(SpicePulse *pulse, struct stream *s)
+{
+    SpicePulsePrivate *p = pulse->priv;
+    guint max = s == &p->playback ? p->profile->max_buffer_ms : p->profile->max_fragsize_ms;
+    gint64 now = g_get_monotonic_time();
+
+    s->last_xrun = now;
+    if (s->buffer_ms >= max || now - s->last_resize < RESIZE_INTERVAL_MS * 1000)
+        return;
+
+    s->buffer_ms = MIN(s->buffer_ms * 2, max);
+    s->last_resize = now;
+    SPICE_DEBUG("%s: %s buffer %u ms", __FUNCTION__,
+                s == &p->playback ? "playback" : "record", s->buffer_ms);
+    stream_update_buffer(pulse, s);
+}
+
+static void stream_shrink_buffer(SpicePulse *pulse, struct stream *s)
+{
+    SpicePulsePrivate *p = pulse->priv;
+    guint min = s == &p->playback ? p->profile->buffer_ms : p->profile->fragsize_ms;
+    gint64 now = g_get_monotonic_time();
+
+    if (s->buffer_ms <= min ||
+        now - MAX(s->last_xrun, s->last_resize) < p->profile->stable_s * G_USEC_PER_SEC)
+        return;
+
+    s->buffer_ms = MAX(s->buffer_ms * 3 / 4, min);
+    s->last_resize = now;
+    SPICE_DEBUG("%s: %s buffer %u ms", __FUNCTION__,
+                s == &p->playback ? "playback" : "record", s->buffer_ms);
+    stream_update_buffer(pulse, s);
+}
+
+static void set_latency_profile(SpicePulse *pulse, const gchar *name)
+{
+    SpicePulsePrivate *p = pulse->priv;
+    guint i;
+
+    if (name == NULL)
+        name = DEFAULT_LATENCY_PROFILE->name;
+
+    for (i = 0; i < G_N_ELEMENTS(latency_profiles); i++) {
+        if (g_str_equal(name, latency_profiles[i].name))
+            break;
+    }
+    if (i == G_N_ELEMENTS(latency_profiles)) {
+        g_warning("unknown audio latency profile '%s'", name);
+        return;
+    }
+
+    SPICE_DEBUG("audio latency profile: %s", name);
+    p->profile = &latency_profiles[i];
+    stream_reset_buffer(pulse, &p->playback);
+    stream_reset_buffer(pulse, &p->record);
+    stream_update_buffer(pulse, &p->playback);
+    stream_update_buffer(pulse, &p->record);
+}
+
 static void stream_state_callback(pa_stream *s, void *userdata)
 {
     SpicePulse *pulse = userdata;
@@ -284,20 +484,21 @@ static void stream_underflow_cb(pa_stream *s, void *userdata)
     p = pulse->priv;
     g_return_if_fail(p != NULL);
     p->playback.num_underflow++;
-#ifdef PULSE_ADJUST_LATENCY
-    const pa_buffer_attr *buffer_attr;
-    pa_buffer_attr new_buffer_attr;
-    pa_operation *op;
+    /* the stream underflows while corked, waiting to fill target_delay */
+    if (p->playback.started && !pa_stream_is_corked(s))
+        stream_grow_buffer(pulse, &p->playback);
+}
 
-    buffer_attr = pa_stream_get_buffer_attr(s);
-    g_return_if_fail(buffer_attr != NULL);
+static void stream_overflow_cb(pa_stream *s, void *userdata)
+{
+    SpicePulse *pulse = userdata;
+    SpicePulsePrivate *p;
 
-    new_buffer_attr = *buffer_attr;
-    new_buffer_attr.tlength *= 2;
-    new_buffer_attr.minreq *= 2;
-    op = pa_stream_set_buffer_attr(s, &new_buffer_attr, NULL, NULL);
-    pa_operation_unref(op);
-#endif
+    SPICE_DEBUG("PA playback stream overflow");
+
+    p = pulse->priv;
+    g_return_if_fail(p != NULL);
+    p->playback.num_overflow++;
 }
 
 static void stream_update_latency_callback(pa_stream *s, void *userdata)
@@ -323,6 +524,7 @@ static void stream_update_latency_callback(pa_stream *s, void *userdata)
     g_return_if_fail(negative == FALSE);
     p->last_delay = usec / PA_USEC_PER_MSEC;
     spice_playback_channel_set_delay(SPICE_PLAYBACK_CHANNEL(p->pchannel), usec / 1000);
+    stream_shrink_buffer(pulse, &p->playback);
     if (pa_stream_is_corked(p->playback.stream)) {
         if (p->last_delay >= p->target_delay) {
             SPICE_DEBUG("%s: uncork playback. delay %u target %u",  __FUNCTION__, p->last_delay, p->target_delay);
@@ -349,12 +551,11 @@ static void create_playback(SpicePulse *pulse)
                                        &p->playback.spec, NULL);
     pa_stream_set_state_callback(p->playback.stream, stream_state_callback, pulse);
     pa_stream_set_underflow_callback(p->playback.stream, stream_underflow_cb, pulse);
+    pa_stream_set_overflow_callback(p->playback.stream, stream_overflow_cb, pulse);
     pa_stream_set_latency_update_callback(p->playback.stream, stream_update_latency_callback, pulse);
 
-    buffer_attr.maxlength = -1;
-    buffer_attr.tlength = pa_usec_to_bytes(p->target_delay * PA_USEC_PER_MSEC, &p->playback.spec);
-    buffer_attr.prebuf = -1;
-    buffer_attr.minreq = -1;
+    stream_reset_buffer(pulse, &p->playback);
+    stream_get_buffer_attr(pulse, &p->playback, &buffer_attr);
     flags = PA_STREAM_ADJUST_LATENCY | PA_STREAM_AUTO_TIMING_UPDATE;
 
     if (pa_stream_connect_playback(p->playback.stream,
@@ -376,12 +577,12 @@ static void playback_start(SpicePlaybackChannel *channel, gint format, gint chan
 
     p->playback.started = TRUE;
     p->playback.num_underflow = 0;
+    p->playback.num_overflow = 0;
     g_object_get(p->pchannel, "min-latency", &latency, NULL);
 
     if (p->playback.stream &&
         (p->playback.spec.rate != frequency ||
-         p->playback.spec.channels != channels ||
-         p->target_delay != latency)) {
+         p->playback.spec.channels != channels)) {
         stream_stop(pulse, &p->playback);
     }
 
@@ -433,9 +634,13 @@ static void playback_data(SpicePlaybackChannel *channel,
         if (p->playback.state != state) {
             SPICE_DEBUG("%s: pulse playback stream ready", __FUNCTION__);
         }
-        if (pa_stream_write(p->playback.stream, audio, size, NULL, 0, PA_SEEK_RELATIVE) < 0) {
+        /* pulse keeps a reference rather than copying */
+        spice_playback_data_ref(audio);
+        if (pa_stream_write(p->playback.stream, audio, size,
+                            spice_playback_data_unref, 0, PA_SEEK_RELATIVE) < 0) {
             g_warning("pa_stream_write() failed: %s",
                       pa_strerror(pa_context_errno(p->context)));
+            spice_playback_data_unref(audio);
         }
         break;
     default:
@@ -453,7 +658,8 @@ static void playback_stop(SpicePlaybackChannel *channel, gpointer data)
     SpicePulse *pulse = data;
     SpicePulsePrivate *p = pulse->priv;
 
-    SPICE_DEBUG("%s: #underflow %u", __FUNCTION__, p->playback.num_underflow);
+    SPICE_DEBUG("%s: #underflow %u #overflow %u", __FUNCTION__,
+                p->playback.num_underflow, p->playback.num_overflow);
 
     p->playback.started = FALSE;
     if (!p->playback.stream)
@@ -478,14 +684,18 @@ static void stream_read_callback(pa_stream *s, size_t length, void *data)
             return;
         }
 
-        g_return_if_fail(snddata);
         g_return_if_fail(length > 0);
 
-        if (p->rchannel != NULL)
+        if (snddata == NULL) {
+            /* a hole: the source overran while we were not reading */
+            SPICE_DEBUG("PA record stream overflow, %" G_GSIZE_FORMAT " bytes lost", length);
+            p->record.num_overflow++;
+            stream_grow_buffer(pulse, &p->record);
+        } else if (p->rchannel != NULL) {
+            /* the channel timestamps the data with the session mm-time */
             spice_record_send_data(SPICE_RECORD_CHANNEL(p->rchannel),
-                                   /* FIXME: server side doesn't care about ts?
-                                      what is the unit? ms apparently */
                                    (gpointer)snddata, length, 0);
+        }
 
         if (pa_stream_drop(s) < 0) {
             g_warning("pa_stream_drop() failed: %s",
@@ -493,6 +703,8 @@ static void stream_read_callback(pa_stream *s, size_t length, void *data)
             return;
         }
     }
+
+    stream_shrink_buffer(pulse, &p->record);
 }
 
 static void create_record(SpicePulse *pulse)
@@ -512,11 +724,8 @@ static void create_record(SpicePulse *pulse)
     pa_stream_set_read_callback(p->record.stream, stream_read_callback, pulse);
     pa_stream_set_state_callback(p->record.stream, stream_state_callback, pulse);
 
-    /* FIXME: we might want customizable latency */
-    buffer_attr.maxlength = -1;
-    buffer_attr.prebuf = -1;
-    buffer_attr.fragsize = buffer_attr.tlength = pa_usec_to_bytes(20 * PA_USEC_PER_MSEC, &p->record.spec);
-    buffer_attr.minreq = (uint32_t) -1;
+    stream_reset_buffer(pulse, &p->record);
+    stream_get_buffer_attr(pulse, &p->record, &buffer_attr);
     flags = PA_STREAM_ADJUST_LATENCY;
 
     if (pa_stream_connect_record(p->record.stream, NULL, &buffer_attr, flags) < 0) {
@@ -570,7 +779,7 @@ static void record_stop(SpicePulse *pulse)
 {
     SpicePulsePrivate *p = pulse->priv;
 
-    SPICE_DEBUG("%s", __FUNCTION__);
+    SPICE_DEBUG("%s: #overflow %u", __FUNCTION__, p->record.num_overflow);
 
     p->record.started = FALSE;
     if (!p->record.stream)
@@ -830,6 +1039,9 @@ SpicePulse *spice_pulse_new(SpiceSession *session, GMainContext *context,
                          NULL);
     p = pulse->priv;
 
+    if (g_getenv("SPICE_PULSE_LATENCY_PROFILE"))
+        set_latency_profile(pulse, g_getenv("SPICE_PULSE_LATENCY_PROFILE"));
+
     p->mainloop = pa_glib_mainloop_new(context);
     p->state = PA_CONTEXT_READY;
     p->context = pa_context_new(pa_glib_mainloop_get_api(p->mainloop), name);
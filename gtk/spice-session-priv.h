@@ -33,6 +33,7 @@ typedef struct _PhodavServer PhodavServer;
 #include "spice-session.h"
 #include "spice-gtk-session.h"
 #include "spice-channel-cache.h"
+#include "spice-mm-clock.h"
 #include "decode.h"
 
 G_BEGIN_DECLS
@@ -50,7 +51,8 @@ GSocketConnection* spice_session_channel_open_host(SpiceSession *session, SpiceC
 void spice_session_channel_new(SpiceSession *session, SpiceChannel *channel);
 void spice_session_channel_migrate(SpiceSession *session, SpiceChannel *channel);
 
-void spice_session_set_mm_time(SpiceSession *session, guint32 time);
+void spice_session_set_mm_time(SpiceSession *session, SpiceMmClockSource source,
+                               guint32 time);
 guint32 spice_session_get_mm_time(SpiceSession *session);
 
 void spice_session_switching_disconnect(SpiceSession *session);
@@ -99,6 +101,15 @@ guint spice_session_get_n_display_channels(SpiceSession *session);
 void spice_session_set_main_channel(SpiceSession *session, SpiceChannel *channel);
 gboolean spice_session_set_migration_session(SpiceSession *session, SpiceSession *mig_session);
 
+gint64 spice_session_latency_input(SpiceSession *session, gint display_id, gint x, gint y);
+void spice_session_latency_sent(SpiceSession *session, gint64 time);
+void spice_session_latency_display(SpiceSession *session, gint channel_id,
+                                   GArray *monitors,
+                                   const gint *rects, gint n_rects);
+void spice_session_latency_mark(SpiceSession *session);
+GMainContext* spice_session_get_channel_context(SpiceSession *session, gint channel_type);
+gsize spice_session_get_coroutine_stack_size(SpiceSession *session);
+
 G_END_DECLS
 
 #endif /* __SPICE_CLIENT_SESSION_PRIV_H__ */
@@ -45,6 +45,24 @@ struct channel {
 #define MIN_GLZ_WINDOW_SIZE_DEFAULT (1024 * 1024 * 12)
 #define MAX_GLZ_WINDOW_SIZE_DEFAULT MIN((LZ_MAX_WINDOW_SIZE * 4), 1024 * 1024 * 64)
 
+/* log2 buckets of milliseconds: <1, 1-2, 2-4... */
+#define LATENCY_BUCKETS 16
+#define LATENCY_STAGES (SPICE_SESSION_LATENCY_MARK + 1)
+/* input events waiting for a display update */
+#define LATENCY_MAX_EVENTS 256
+
+typedef struct {
+    gint64 time;
+    gint display_id, x, y;
+    gboolean displayed;
+} LatencyEvent;
+
+typedef struct {
+    GThread *thread;
+    GMainContext *context;
+    GMainLoop *loop;
+} IOThread;
+
 struct _SpiceSessionPrivate {
     char              *host;
     char              *unix_path;
@@ -95,9 +113,9 @@ struct _SpiceSessionPrivate {
     int               protocol;
     SpiceChannel      *cmain; /* weak reference */
     Ring              channels;
-    guint32           mm_time;
+    SpiceMmClock      *mm_clock;
+    gint              av_offset; /* last notified, atomic */
     gboolean          client_provided_sockets;
-    guint64           mm_time_at_clock;
     SpiceSession      *migration;
     GList             *migration_left;
     SpiceSessionMigration migration_state;
@@ -123,6 +141,17 @@ struct _SpiceSessionPrivate {
     SpicePlaybackChannel *playback_channel;
     PhodavServer      *webdav;
     guint8             webdav_magic[WEBDAV_MAGIC_SIZE];
+
+    /* channel types scheduled from I/O threads */
+    GStrv             io_threads;
+    GHashTable        *io_thread_table;
+    guint             coroutine_stack_size;
+
+    /* input latency tracing */
+    STATIC_MUTEX      latency_lock;
+    gboolean          latency_tracing;
+    guint             latency[LATENCY_STAGES][LATENCY_BUCKETS];
+    GQueue            latency_events;
 };
 
 
@@ -202,6 +231,11 @@ enum {
     PROP_SHARED_DIR,
     PROP_USERNAME,
     PROP_UNIX_PATH,
+    PROP_LATENCY_TRACING,
+    PROP_IO_THREADS,
+    PROP_COROUTINE_STACK_SIZE,
+    PROP_AV_OFFSET,
+    PROP_MM_TIME_SKEW,
 };
 
 /* signals */
@@ -256,8 +290,10 @@ static void spice_session_init(SpiceSession *session)
     g_free(channels);
 
     ring_init(&s->channels);
+    STATIC_MUTEX_INIT(s->latency_lock);
     s->images = cache_new((GDestroyNotify)pixman_image_unref);
     s->glz_window = glz_decoder_window_new();
+    s->mm_clock = spice_mm_clock_new();
     update_proxy(session, NULL);
 }
 
@@ -290,6 +326,14 @@ session_disconnect(SpiceSession *self, gboolean keep_main)
     spice_session_abort_migration(self);
 }
 
+static void latency_events_clear(SpiceSessionPrivate *s)
+{
+    LatencyEvent *event;
+
+    while ((event = g_queue_pop_head(&s->latency_events)) != NULL)
+        g_slice_free(LatencyEvent, event);
+}
+
 static void
 spice_session_dispose(GObject *gobject)
 {
@@ -342,6 +386,13 @@ spice_session_finalize(GObject *gobject)
 
     g_clear_pointer(&s->pubkey, g_byte_array_unref);
     g_clear_pointer(&s->ca, g_byte_array_unref);
+    latency_events_clear(s);
+    STATIC_MUTEX_CLEAR(s->latency_lock);
+    spice_mm_clock_free(s->mm_clock);
+
+    /* the channels are gone, and their coroutines have exited */
+    g_clear_pointer(&s->io_thread_table, g_hash_table_unref);
+    g_strfreev(s->io_threads);
 
     /* Chain up to the parent class */
     if (G_OBJECT_CLASS(spice_session_parent_class)->finalize)
@@ -654,6 +705,21 @@ static void spice_session_get_property(GObject    *gobject,
     case PROP_SHARED_DIR:
         g_value_set_string(value, spice_session_get_shared_dir(session));
         break;
+    case PROP_LATENCY_TRACING:
+        g_value_set_boolean(value, s->latency_tracing);
+        break;
+    case PROP_IO_THREADS:
+        g_value_set_boxed(value, s->io_threads);
+        break;
+    case PROP_COROUTINE_STACK_SIZE:
+        g_value_set_uint(value, s->coroutine_stack_size);
+        break;
+    case PROP_AV_OFFSET:
+        g_value_set_int(value, spice_mm_clock_get_av_offset(s->mm_clock));
+        break;
+    case PROP_MM_TIME_SKEW:
+        g_value_set_double(value, spice_mm_clock_get_skew(s->mm_clock));
+        break;
     default:
 	G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
 	break;
@@ -787,6 +853,20 @@ static void spice_session_set_property(GObject      *gobject,
     case PROP_SHARED_DIR:
         spice_session_set_shared_dir(session, g_value_get_string(value));
         break;
+    case PROP_LATENCY_TRACING:
+        STATIC_MUTEX_LOCK(s->latency_lock);
+        s->latency_tracing = g_value_get_boolean(value);
+        if (!s->latency_tracing)
+            latency_events_clear(s);
+        STATIC_MUTEX_UNLOCK(s->latency_lock);
+        break;
+    case PROP_IO_THREADS:
+        g_strfreev(s->io_threads);
+        s->io_threads = g_value_dup_boxed(value);
+        break;
+    case PROP_COROUTINE_STACK_SIZE:
+        s->coroutine_stack_size = g_value_get_uint(value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
         break;
@@ -1379,6 +1459,122 @@ static void spice_session_class_init(SpiceSessionClass *klass)
                              G_PARAM_CONSTRUCT |
                              G_PARAM_STATIC_STRINGS));
 
+    /**
+     * SpiceSession:latency-tracing:
+     *
+     * Trace the latency of input events: when set, each key, button
+     * and motion event is timestamped, and the time it takes for it
+     * to be sent, for the display to be updated, and for the next
+     * display mark is accounted in histograms, see
+     * spice_session_get_latency_histogram().
+     *
+     * Only the events sent through the inputs channel are traced, such
+     * as those of a #SpiceDisplay widget: a session without one has
+     * empty histograms. spicy --latency prints them when the session
+     * is disconnected.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_LATENCY_TRACING,
+         g_param_spec_boolean("latency-tracing",
+                              "Latency tracing",
+                              "Trace the latency of input events",
+                              FALSE,
+                              G_PARAM_READWRITE |
+                              G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSession:io-threads:
+     *
+     * A string array of channel types to process in I/O threads, out
+     * of the main context. Each channel type gets its own thread,
+     * shared by all the channels of that type. Signals are still
+     * emitted from the main context.
+     *
+     * Only the "display", "playback" and "usbredir" channels can be
+     * processed in I/O threads, and only with the ucontext coroutine
+     * implementation. The other types are processed from the main
+     * context. This is taken into account when the channels connect.
+     *
+     * The display channels share one thread, as they share the image
+     * cache and glz dictionary: decoding and drawing move out of the
+     * main context, which is left with presenting the surfaces. The
+     * primary surface is only created and destroyed while the main
+     * context handles #SpiceDisplayChannel::display-primary-create and
+     * #SpiceDisplayChannel::display-primary-destroy, but its pixels may
+     * be read while being drawn, until the following
+     * #SpiceDisplayChannel::display-invalidate-region.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_IO_THREADS,
+         g_param_spec_boxed("io-threads",
+                            "I/O threads",
+                            "Array of channel types to process in I/O threads",
+                            G_TYPE_STRV,
+                            G_PARAM_READWRITE |
+                            G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSession:coroutine-stack-size:
+     *
+     * The stack size in bytes of the coroutines running the channels,
+     * or 0 for the default of 16MB. Stacks are taken from a pool
+     * shared by all sessions, and given back to it when a channel
+     * disconnects, so that reconnecting channels reuse them. This is
+     * taken into account when the channels connect.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_COROUTINE_STACK_SIZE,
+         g_param_spec_uint("coroutine-stack-size",
+                           "Coroutine stack size",
+                           "Stack size of the channel coroutines",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READWRITE |
+                           G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSession:av-offset:
+     *
+     * The measured offset in milliseconds between the video and the
+     * audio being played, positive when the video is ahead. The video
+     * streams are presented with the session multimedia clock, which
+     * follows the audio playback position while audio is playing, so
+     * this converges to 0 after the playback latency changes.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_AV_OFFSET,
+         g_param_spec_int("av-offset",
+                          "A/V offset",
+                          "Measured offset of the video to the audio in ms",
+                          G_MININT, G_MAXINT, 0,
+                          G_PARAM_READABLE |
+                          G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSession:mm-time-skew:
+     *
+     * The estimated rate difference in parts per million between the
+     * server multimedia clock and the local clock, positive when the
+     * server clock is faster. It is not notified.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_MM_TIME_SKEW,
+         g_param_spec_double("mm-time-skew",
+                             "Multimedia time skew",
+                             "Estimated skew of the server multimedia clock in ppm",
+                             -G_MAXDOUBLE, G_MAXDOUBLE, 0,
+                             G_PARAM_READABLE |
+                             G_PARAM_STATIC_STRINGS));
+
     g_type_class_add_private(klass, sizeof(SpiceSessionPrivate));
 }
 
@@ -1452,6 +1648,7 @@ SpiceSession *spice_session_new_from_session(SpiceSession *session)
     c->client_provided_sockets = s->client_provided_sockets;
     c->protocol = s->protocol;
     c->connection_id = s->connection_id;
+    c->coroutine_stack_size = s->coroutine_stack_size;
     if (s->proxy)
         c->proxy = g_object_ref(s->proxy);
 
@@ -2105,7 +2302,8 @@ GSocketConnection* spice_session_channel_open_host(SpiceSession *session, SpiceC
     open_host.client = g_socket_client_new();
     g_socket_client_set_timeout(open_host.client, SOCKET_TIMEOUT);
 
-    g_idle_add(open_host_idle_cb, &open_host);
+    g_coroutine_timeout_add_full(&c->coroutine, G_PRIORITY_DEFAULT_IDLE, 0,
+                                 open_host_idle_cb, &open_host, NULL);
     /* switch to main loop and wait for connection */
     coroutine_yield(NULL);
 
@@ -2223,31 +2421,32 @@ guint32 spice_session_get_mm_time(SpiceSession *session)
 
     SpiceSessionPrivate *s = session->priv;
 
-    /* FIXME: we may want to estimate the drift of clocks, and well,
-       do something better than this trivial approach */
-    return s->mm_time + (g_get_monotonic_time() - s->mm_time_at_clock) / 1000;
+    return spice_mm_clock_get_time(s->mm_clock, g_get_monotonic_time());
 }
 
-#define MM_TIME_DIFF_RESET_THRESH 500 // 0.5 sec
-
+/* coroutine or main context */
 G_GNUC_INTERNAL
-void spice_session_set_mm_time(SpiceSession *session, guint32 time)
+void spice_session_set_mm_time(SpiceSession *session, SpiceMmClockSource source,
+                               guint32 time)
 {
     g_return_if_fail(SPICE_IS_SESSION(session));
 
     SpiceSessionPrivate *s = session->priv;
-    guint32 old_time;
-
-    old_time = spice_session_get_mm_time(session);
+    gint av_offset, old;
 
-    s->mm_time = time;
-    s->mm_time_at_clock = g_get_monotonic_time();
-    SPICE_DEBUG("set mm time: %u", spice_session_get_mm_time(session));
-    if (time > old_time + MM_TIME_DIFF_RESET_THRESH ||
-        time < old_time) {
-        SPICE_DEBUG("%s: mm-time-reset, old %u, new %u", __FUNCTION__, old_time, s->mm_time);
+    SPICE_DEBUG("set mm time: %u, source %d", time, source);
+    if (spice_mm_clock_update(s->mm_clock, source, time, g_get_monotonic_time())) {
+        SPICE_DEBUG("%s: mm-time-reset, new %u", __FUNCTION__, time);
         g_coroutine_signal_emit(session, signals[SPICE_SESSION_MM_TIME_RESET], 0);
     }
+
+    /* the main and playback channels may run in different threads,
+     * only one of them notifies a given change */
+    av_offset = spice_mm_clock_get_av_offset(s->mm_clock);
+    old = g_atomic_int_get(&s->av_offset);
+    if (av_offset != old &&
+        g_atomic_int_compare_and_exchange(&s->av_offset, old, av_offset))
+        g_coroutine_object_notify(G_OBJECT(session), "av-offset");
 }
 
 G_GNUC_INTERNAL
@@ -2692,3 +2891,257 @@ gboolean spice_session_set_migration_session(SpiceSession *session, SpiceSession
 
     return TRUE;
 }
+
+static void latency_account(SpiceSessionPrivate *s, SpiceSessionLatency stage,
+                            gint64 time, gint64 now)
+{
+    gint64 ms = (now - time) / 1000;
+    guint bucket = 0;
+
+    while (ms > 0 && bucket < LATENCY_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+    s->latency[stage][bucket]++;
+}
+
+/**
+ * spice_session_get_latency_histogram:
+ * @session: a Spice session
+ * @stage: the traced stage
+ * @n_buckets: (out): return location for the number of buckets
+ *
+ * Gets the latency histogram of input events for @stage, collected
+ * while #SpiceSession:latency-tracing is set. The first bucket counts
+ * events under 1ms, the bucket @i counts events between 2^(@i - 1) and
+ * 2^@i ms, and the last bucket counts all the remaining events.
+ *
+ * Returns: (array length=n_buckets) (transfer none): the histogram
+ * buckets, owned by @session
+ * Since: 0.28
+ **/
+const guint *spice_session_get_latency_histogram(SpiceSession *session,
+                                                 SpiceSessionLatency stage,
+                                                 guint *n_buckets)
+{
+    g_return_val_if_fail(SPICE_IS_SESSION(session), NULL);
+    g_return_val_if_fail(stage < LATENCY_STAGES, NULL);
+    g_return_val_if_fail(n_buckets != NULL, NULL);
+
+    *n_buckets = LATENCY_BUCKETS;
+    return session->priv->latency[stage];
+}
+
+/* timestamp an input event, with the pointer position in display
+ * @display_id, or -1 if the event has no position. Returns the event
+ * time to be given to spice_session_latency_sent(), 0 if not tracing */
+G_GNUC_INTERNAL
+gint64 spice_session_latency_input(SpiceSession *session, gint display_id, gint x, gint y)
+{
+    SpiceSessionPrivate *s;
+    LatencyEvent *event;
+
+    g_return_val_if_fail(SPICE_IS_SESSION(session), 0);
+    s = session->priv;
+
+    if (!s->latency_tracing)
+        return 0;
+
+    event = g_slice_new0(LatencyEvent);
+    event->time = g_get_monotonic_time();
+    event->display_id = display_id;
+    event->x = x;
+    event->y = y;
+
+    STATIC_MUTEX_LOCK(s->latency_lock);
+    if (g_queue_get_length(&s->latency_events) >= LATENCY_MAX_EVENTS)
+        g_slice_free(LatencyEvent, g_queue_pop_head(&s->latency_events));
+    g_queue_push_tail(&s->latency_events, event);
+    STATIC_MUTEX_UNLOCK(s->latency_lock);
+
+    return event->time;
+}
+
+G_GNUC_INTERNAL
+void spice_session_latency_sent(SpiceSession *session, gint64 time)
+{
+    g_return_if_fail(SPICE_IS_SESSION(session));
+
+    if (!session->priv->latency_tracing || time == 0)
+        return;
+
+    STATIC_MUTEX_LOCK(session->priv->latency_lock);
+    latency_account(session->priv, SPICE_SESSION_LATENCY_SEND,
+                    time, g_get_monotonic_time());
+    STATIC_MUTEX_UNLOCK(session->priv->latency_lock);
+}
+
+/* @rects are x, y, width, height quadruplets, in the surface of
+ * display channel @channel_id, which has @monitors */
+G_GNUC_INTERNAL
+void spice_session_latency_display(SpiceSession *session, gint channel_id,
+                                   GArray *monitors,
+                                   const gint *rects, gint n_rects)
+{
+    SpiceSessionPrivate *s;
+    GList *l;
+    gint64 now;
+    gint i;
+
+    g_return_if_fail(SPICE_IS_SESSION(session));
+    s = session->priv;
+
+    if (!s->latency_tracing || n_rects == 0)
+        return;
+
+    now = g_get_monotonic_time();
+    STATIC_MUTEX_LOCK(s->latency_lock);
+    for (l = s->latency_events.head; l != NULL; l = l->next) {
+        LatencyEvent *event = l->data;
+
+        if (event->displayed)
+            continue;
+
+        if (event->display_id != -1) {
+            SpiceDisplayMonitorConfig *mc;
+            gint monitor_id, x, y;
+
+            /* the inputs display id is the monitor id on channel 0, and
+             * the channel id on the others, which have a single monitor */
+            if (channel_id == 0)
+                monitor_id = event->display_id;
+            else
+                monitor_id = event->display_id == channel_id ? 0 : -1;
+            if (monitor_id < 0 || (guint)monitor_id >= monitors->len)
+                continue;
+
+            /* the position is relative to the monitor */
+            mc = &g_array_index(monitors, SpiceDisplayMonitorConfig, monitor_id);
+            x = mc->x + event->x;
+            y = mc->y + event->y;
+            for (i = 0; i < n_rects; i++) {
+                const gint *r = &rects[i * 4];
+                if (x >= r[0] && x < r[0] + r[2] &&
+                    y >= r[1] && y < r[1] + r[3])
+                    break;
+            }
+            if (i == n_rects)
+                continue;
+        }
+
+        event->displayed = TRUE;
+        latency_account(s, SPICE_SESSION_LATENCY_DISPLAY, event->time, now);
+    }
+    STATIC_MUTEX_UNLOCK(s->latency_lock);
+}
+
+G_GNUC_INTERNAL
+void spice_session_latency_mark(SpiceSession *session)
+{
+    SpiceSessionPrivate *s;
+    LatencyEvent *event;
+    gint64 now;
+
+    g_return_if_fail(SPICE_IS_SESSION(session));
+    s = session->priv;
+
+    if (!s->latency_tracing)
+        return;
+
+    now = g_get_monotonic_time();
+    STATIC_MUTEX_LOCK(s->latency_lock);
+    while ((event = g_queue_pop_head(&s->latency_events)) != NULL) {
+        latency_account(s, SPICE_SESSION_LATENCY_MARK, event->time, now);
+        g_slice_free(LatencyEvent, event);
+    }
+    STATIC_MUTEX_UNLOCK(s->latency_lock);
+}
+
+#ifdef G_COROUTINE_IO_THREADS
+static gpointer io_thread_run(gpointer data)
+{
+    IOThread *io = data;
+
+    g_main_context_push_thread_default(io->context);
+    g_coroutine_set_io_thread();
+    g_main_loop_run(io->loop);
+    g_main_context_pop_thread_default(io->context);
+
+    return NULL;
+}
+
+static void io_thread_free(IOThread *io)
+{
+    g_main_loop_quit(io->loop);
+    g_thread_join(io->thread);
+    g_main_loop_unref(io->loop);
+    g_main_context_unref(io->context);
+    g_slice_free(IOThread, io);
+}
+#endif
+
+/* Returns the context to schedule the coroutine of a channel of type
+ * @channel_type from, or NULL for the default main context. */
+G_GNUC_INTERNAL
+GMainContext* spice_session_get_channel_context(SpiceSession *session, gint channel_type)
+{
+#ifdef G_COROUTINE_IO_THREADS
+    SpiceSessionPrivate *s;
+    const gchar *name;
+    gchar *thread_name;
+    IOThread *io;
+
+    g_return_val_if_fail(SPICE_IS_SESSION(session), NULL);
+    s = session->priv;
+
+    switch (channel_type) {
+    case SPICE_CHANNEL_DISPLAY:
+    case SPICE_CHANNEL_PLAYBACK:
+    case SPICE_CHANNEL_USBREDIR:
+        break;
+    default:
+        return NULL;
+    }
+
+    name = spice_channel_type_to_string(channel_type);
+    if (!spice_strv_contains(s->io_threads, name))
+        return NULL;
+
+    if (s->io_thread_table == NULL)
+        s->io_thread_table = g_hash_table_new_full(NULL, NULL, NULL,
+                                                   (GDestroyNotify)io_thread_free);
+
+    io = g_hash_table_lookup(s->io_thread_table, GINT_TO_POINTER(channel_type));
+    if (io == NULL) {
+        SPICE_DEBUG("starting %s I/O thread", name);
+        io = g_slice_new0(IOThread);
+        io->context = g_main_context_new();
+        io->loop = g_main_loop_new(io->context, FALSE);
+        thread_name = g_strdup_printf("spice-%s", name);
+        io->thread = g_thread_new(thread_name, io_thread_run, io);
+        g_free(thread_name);
+        g_hash_table_insert(s->io_thread_table, GINT_TO_POINTER(channel_type), io);
+    }
+
+    return io->context;
+#else
+    static gboolean warned = FALSE;
+
+    g_return_val_if_fail(SPICE_IS_SESSION(session), NULL);
+
+    if (session->priv->io_threads != NULL && !warned) {
+        g_warning("I/O threads are not supported by this build");
+        warned = TRUE;
+    }
+
+    return NULL;
+#endif
+}
+
+G_GNUC_INTERNAL
+gsize spice_session_get_coroutine_stack_size(SpiceSession *session)
+{
+    g_return_val_if_fail(SPICE_IS_SESSION(session), 0);
+
+    return session->priv->coroutine_stack_size;
+}
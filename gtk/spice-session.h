@@ -63,6 +63,25 @@ typedef enum {
     SPICE_SESSION_MIGRATION_CONNECTING,
 } SpiceSessionMigration;
 
+/**
+ * SpiceSessionLatency:
+ * @SPICE_SESSION_LATENCY_SEND: from an input event to the write of its
+ * message on the inputs channel
+ * @SPICE_SESSION_LATENCY_DISPLAY: from an input event to the next display
+ * update covering the pointer position, or to any display update for
+ * events without a position (keys, buttons and relative motion)
+ * @SPICE_SESSION_LATENCY_MARK: from an input event to the next display mark
+ *
+ * The stages of the input latency traced with #SpiceSession:latency-tracing.
+ *
+ * Since: 0.28
+ **/
+typedef enum {
+    SPICE_SESSION_LATENCY_SEND,
+    SPICE_SESSION_LATENCY_DISPLAY,
+    SPICE_SESSION_LATENCY_MARK,
+} SpiceSessionLatency;
+
 struct _SpiceSession
 {
     GObject parent;
@@ -97,6 +116,9 @@ gboolean spice_session_has_channel_type(SpiceSession *session, gint type);
 gboolean spice_session_get_read_only(SpiceSession *session);
 SpiceURI *spice_session_get_proxy_uri(SpiceSession *session);
 gboolean spice_session_is_for_migration(SpiceSession *session);
+const guint *spice_session_get_latency_histogram(SpiceSession *session,
+                                                 SpiceSessionLatency stage,
+                                                 guint *n_buckets);
 
 G_END_DECLS
 
@@ -17,11 +17,108 @@
 */
 #include "config.h"
 
+#include <math.h>
+
 #include "gtk-compat.h"
 #include "spice-widget.h"
 #include "spice-widget-priv.h"
 #include "spice-gtk-session-priv.h"
 
+/* granularity, in guest pixels, of the scaled image updates */
+#define SCALED_TILE_SIZE 64
+
+static void scaled_image_destroy(SpiceDisplayPrivate *d)
+{
+    g_clear_pointer(&d->scaled, cairo_surface_destroy);
+    g_clear_pointer(&d->scaled_dirty, g_free);
+}
+
+/* Bring the cached scaled copy of ximage up to date, redrawing only the
+ * damaged tiles. The scaling itself is done by pixman, which has SIMD
+ * fast paths for bilinear filtering. */
+static void scaled_image_update(SpiceDisplay *display, double s, int w, int h)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    cairo_pattern_t *pattern;
+    cairo_t *cr = NULL;
+    int tx, ty, run;
+
+    if (d->scaled == NULL ||
+        d->scaled_s != s ||
+        cairo_image_surface_get_width(d->scaled) != w ||
+        cairo_image_surface_get_height(d->scaled) != h) {
+        scaled_image_destroy(d);
+        d->scaled = cairo_image_surface_create(CAIRO_FORMAT_RGB24, w, h);
+        d->scaled_s = s;
+        d->scaled_tiles_x = (d->area.width + SCALED_TILE_SIZE - 1) / SCALED_TILE_SIZE;
+        d->scaled_tiles_y = (d->area.height + SCALED_TILE_SIZE - 1) / SCALED_TILE_SIZE;
+        d->scaled_dirty = g_malloc(d->scaled_tiles_x * d->scaled_tiles_y);
+        memset(d->scaled_dirty, 1, d->scaled_tiles_x * d->scaled_tiles_y);
+    }
+
+    /* clip to the damaged tiles, merging horizontal runs */
+    for (ty = 0; ty < d->scaled_tiles_y; ty++) {
+        guint8 *row = d->scaled_dirty + ty * d->scaled_tiles_x;
+
+        for (tx = 0; tx < d->scaled_tiles_x; tx += run) {
+            double x1, y1, x2, y2;
+
+            for (run = 0; tx + run < d->scaled_tiles_x && row[tx + run]; run++)
+                row[tx + run] = 0;
+            if (run == 0) {
+                run = 1;
+                continue;
+            }
+
+            if (cr == NULL)
+                cr = cairo_create(d->scaled);
+
+            /* the filter samples the neighbouring pixels too */
+            x1 = floor((tx * SCALED_TILE_SIZE - 1) * s);
+            y1 = floor((ty * SCALED_TILE_SIZE - 1) * s);
+            x2 = ceil(((tx + run) * SCALED_TILE_SIZE + 1) * s);
+            y2 = ceil(((ty + 1) * SCALED_TILE_SIZE + 1) * s);
+            cairo_rectangle(cr, x1, y1, x2 - x1, y2 - y1);
+        }
+    }
+
+    if (cr == NULL)
+        return;
+
+    cairo_clip(cr);
+    cairo_scale(cr, s, s);
+    if (!d->convert)
+        cairo_translate(cr, -d->area.x, -d->area.y);
+    cairo_set_source_surface(cr, d->ximage, 0, 0);
+    pattern = cairo_get_source(cr);
+    cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
+    cairo_pattern_set_filter(pattern, s < 1.0 ? CAIRO_FILTER_GOOD : CAIRO_FILTER_BILINEAR);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+}
+
+G_GNUC_INTERNAL
+void spicex_image_invalidate(SpiceDisplay *display, const GdkRectangle *rect)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    int tx, ty, tx1, ty1, tx2, ty2;
+
+    if (d->scaled_dirty == NULL)
+        return;
+
+    /* rect is within area */
+    tx1 = (rect->x - d->area.x) / SCALED_TILE_SIZE;
+    ty1 = (rect->y - d->area.y) / SCALED_TILE_SIZE;
+    tx2 = MIN(d->scaled_tiles_x,
+              (rect->x - d->area.x + rect->width + SCALED_TILE_SIZE - 1) / SCALED_TILE_SIZE);
+    ty2 = MIN(d->scaled_tiles_y,
+              (rect->y - d->area.y + rect->height + SCALED_TILE_SIZE - 1) / SCALED_TILE_SIZE);
+
+    for (ty = ty1; ty < ty2; ty++)
+        for (tx = tx1; tx < tx2; tx++)
+            d->scaled_dirty[ty * d->scaled_tiles_x + tx] = 1;
+}
 
 G_GNUC_INTERNAL
 int spicex_image_create(SpiceDisplay *display)
@@ -54,6 +151,7 @@ void spicex_image_destroy(SpiceDisplay *display)
 {
     SpiceDisplayPrivate *d = display->priv;
 
+    scaled_image_destroy(d);
     if (d->ximage) {
         cairo_surface_destroy(d->ximage);
         d->ximage = NULL;
@@ -111,11 +209,21 @@ void spicex_draw_event(SpiceDisplay *display, cairo_t *cr)
     if (d->ximage) {
         cairo_translate(cr, x, y);
         cairo_rectangle(cr, 0, 0, w, h);
-        cairo_scale(cr, s, s);
-        if (!d->convert)
-            cairo_translate(cr, -d->area.x, -d->area.y);
-        cairo_set_source_surface(cr, d->ximage, 0, 0);
-        cairo_fill(cr);
+        if (s != 1.0) {
+            /* expose is a plain blit of the scaled copy */
+            scaled_image_update(display, s, w, h);
+            cairo_set_source_surface(cr, d->scaled, 0, 0);
+            cairo_fill(cr);
+            cairo_scale(cr, s, s);
+            if (!d->convert)
+                cairo_translate(cr, -d->area.x, -d->area.y);
+        } else {
+            scaled_image_destroy(d);
+            if (!d->convert)
+                cairo_translate(cr, -d->area.x, -d->area.y);
+            cairo_set_source_surface(cr, d->ximage, 0, 0);
+            cairo_fill(cr);
+        }
 
         if (d->mouse_mode == SPICE_MOUSE_MODE_SERVER &&
             d->mouse_guest_x != -1 && d->mouse_guest_y != -1 &&
@@ -123,9 +231,12 @@ void spicex_draw_event(SpiceDisplay *display, cairo_t *cr)
             spice_gtk_session_get_pointer_grabbed(d->gtk_session)) {
             GdkPixbuf *image = d->mouse_pixbuf;
             if (image != NULL) {
+                int x, y;
+
+                spice_display_get_cursor_position(display, &x, &y);
                 gdk_cairo_set_source_pixbuf(cr, image,
-                                            d->mouse_guest_x - d->mouse_hotspot.x,
-                                            d->mouse_guest_y - d->mouse_hotspot.y);
+                                            x - d->mouse_hotspot.x,
+                                            y - d->mouse_hotspot.y);
                 cairo_paint(cr);
             }
         }
@@ -18,18 +18,20 @@
 #include "config.h"
 
 #include <math.h>
+#include <string.h>
 
 #define EGL_EGLEXT_PROTOTYPES
 #define GL_GLEXT_PROTOTYPES
 
 #include "spice-widget.h"
 #include "spice-widget-priv.h"
+#include "spice-gtk-session-priv.h"
 #include <libdrm/drm_fourcc.h>
 
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
-#include <GLES2/gl2.h>
+#include <GLES3/gl3.h>
 #include <GLES2/gl2ext.h>
 
 static const char *spice_egl_vertex_src =       \
@@ -137,6 +139,21 @@ static int spice_egl_init_shaders(SpiceDisplay *display)
     return 0;
 }
 
+static gboolean has_extension(const char *extensions, const char *name)
+{
+    gsize len = strlen(name);
+    const char *p = extensions;
+
+    while (p && (p = strstr(p, name)) != NULL) {
+        if ((p == extensions || p[-1] == ' ') &&
+            (p[len] == ' ' || p[len] == '\0'))
+            return TRUE;
+        p += len;
+    }
+
+    return FALSE;
+}
+
 int spice_egl_init(SpiceDisplay *display)
 {
     SpiceDisplayPrivate *d = SPICE_DISPLAY_GET_PRIVATE(display);
@@ -163,6 +180,8 @@ int spice_egl_init(SpiceDisplay *display)
     EGLenum api;
     EGLint major, minor, n;
 
+    spice_egl_scanout_init(&d->egl.images);
+
     dpy = gdk_x11_get_default_xdisplay();
     d->egl.display = eglGetDisplay((EGLNativeDisplayType)dpy);
     if (d->egl.display == EGL_NO_DISPLAY) {
@@ -210,9 +229,32 @@ int spice_egl_init(SpiceDisplay *display)
     eglMakeCurrent(d->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE,
                    EGL_NO_CONTEXT);
 
+    if (has_extension(eglQueryString(d->egl.display, EGL_EXTENSIONS),
+                      "EGL_KHR_swap_buffers_with_damage"))
+        d->egl.swap_with_damage = (gpointer)eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+    else if (has_extension(eglQueryString(d->egl.display, EGL_EXTENSIONS),
+                           "EGL_EXT_swap_buffers_with_damage"))
+        d->egl.swap_with_damage = (gpointer)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+
     return 0;
 }
 
+static gboolean spice_egl_make_current(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = SPICE_DISPLAY_GET_PRIVATE(display);
+
+    if (d->egl.surface == EGL_NO_SURFACE)
+        return FALSE;
+
+    /* each display has its own context, and they may be interleaved */
+    if (eglGetCurrentContext() == d->egl.ctx &&
+        eglGetCurrentSurface(EGL_DRAW) == d->egl.surface)
+        return TRUE;
+
+    return eglMakeCurrent(d->egl.display, d->egl.surface,
+                          d->egl.surface, d->egl.ctx);
+}
+
 static int spice_widget_init_egl_win(SpiceDisplay *display)
 {
     GtkWidget *widget = GTK_WIDGET(display);
@@ -260,6 +302,7 @@ static inline void gdk_drawable_get_size(GdkWindow *w, gint *ww, gint *wh)
 
 int spice_egl_realize_display(SpiceDisplay *display)
 {
+    SpiceDisplayPrivate *d = SPICE_DISPLAY_GET_PRIVATE(display);
     int ret;
     int ww, wh;
 
@@ -271,6 +314,8 @@ int spice_egl_realize_display(SpiceDisplay *display)
     if (ret)
         return ret;
 
+    d->egl.use_2d = d->gl_2d;
+
     gdk_drawable_get_size(gtk_widget_get_window(GTK_WIDGET(display)), &ww, &wh);
     spice_egl_resize_display(display, ww, wh);
 
@@ -283,6 +328,18 @@ void spice_egl_unrealize_display(SpiceDisplay *display)
 
     SPICE_DEBUG("egl unrealize %p", d->egl.surface);
 
+    if (spice_egl_make_current(display)) {
+        spice_egl_primary_clear(&d->egl.primary);
+        if (d->egl.cursor_tex)
+            glDeleteTextures(1, &d->egl.cursor_tex);
+    }
+    memset(&d->egl.primary, 0, sizeof(d->egl.primary));
+    /* even without a context, to close the cached dma-buf fds */
+    spice_egl_scanout_clear(&d->egl.images, d->egl.display);
+    d->egl.cursor_tex = 0;
+    g_clear_object(&d->egl.cursor_pixbuf);
+    d->egl.use_2d = FALSE;
+
     eglMakeCurrent(d->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE,
                    EGL_NO_CONTEXT);
 
@@ -296,10 +353,13 @@ void spice_egl_resize_display(SpiceDisplay *display, int w, int h)
 {
     SpiceDisplayPrivate *d = SPICE_DISPLAY_GET_PRIVATE(display);
 
+    if (!spice_egl_make_current(display))
+        return;
+
     apply_ortho(d->egl.mproj, 0, w, 0, h, -1, 1);
     glViewport(0, 0, w, h);
 
-    spice_egl_update_display(display);
+    spice_egl_update_display(display, NULL);
 }
 
 static void
@@ -374,88 +434,214 @@ client_draw_rect_tex(SpiceDisplay *display,
     draw_rect_from_arrays(display, verts, tex);
 }
 
+static void spice_egl_upload_primary(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = SPICE_DISPLAY_GET_PRIVATE(display);
+
+    if (d->data == NULL)
+        return;
+
+    /* converted 16bpp data only covers the monitor area */
+    if (d->convert)
+        spice_egl_primary_upload(&d->egl.primary, d->data, d->area.width * 4);
+    else
+        spice_egl_primary_upload(&d->egl.primary,
+                                 (guint8 *)d->data + d->area.y * d->stride + d->area.x * 4,
+                                 d->stride);
+}
+
+/* In server mouse mode, the guest cursor is part of the display: blend
+ * it over the surface, as the cairo backend does. */
+static void spice_egl_draw_cursor(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = SPICE_DISPLAY_GET_PRIVATE(display);
+    GdkPixbuf *pixbuf = d->mouse_pixbuf;
+    double s;
+    int x, y, cx, cy, cw, ch;
+
+    if (d->mouse_mode != SPICE_MOUSE_MODE_SERVER ||
+        d->mouse_guest_x == -1 || d->mouse_guest_y == -1 ||
+        d->show_cursor != NULL || pixbuf == NULL ||
+        !spice_gtk_session_get_pointer_grabbed(d->gtk_session))
+        return;
+
+    if (d->egl.cursor_tex == 0) {
+        glGenTextures(1, &d->egl.cursor_tex);
+        glBindTexture(GL_TEXTURE_2D, d->egl.cursor_tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, d->egl.cursor_tex);
+
+    cw = gdk_pixbuf_get_width(pixbuf);
+    ch = gdk_pixbuf_get_height(pixbuf);
+    /* only upload the shape when it changes, not on every move */
+    if (d->egl.cursor_pixbuf != pixbuf) {
+        g_clear_object(&d->egl.cursor_pixbuf);
+        d->egl.cursor_pixbuf = g_object_ref(pixbuf);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, gdk_pixbuf_get_rowstride(pixbuf) / 4);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, cw, ch, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, gdk_pixbuf_get_pixels(pixbuf));
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+
+    spice_display_get_scaling(display, &s, &x, &y, NULL, NULL);
+    spice_display_get_cursor_position(display, &cx, &cy);
+    x += floor((cx - d->mouse_hotspot.x - d->area.x) * s);
+    y += floor((cy - d->mouse_hotspot.y - d->area.y) * s);
+
+    /* the pixbuf alpha isn't premultiplied */
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    /* GL has a bottom-left origin, the pixbuf is stored top-down */
+    client_draw_rect_tex(display, x, d->wh - y - ch * s, cw * s, ch * s,
+                         0, 1, 1, -1);
+    glDisable(GL_BLEND);
+}
+
+/* Swap, telling the window system which part of the window changed if
+ * possible, so it doesn't have to copy or composite all of it. The whole
+ * back buffer is still redrawn, as its content is undefined after a
+ * swap. */
+static void spice_egl_swap(SpiceDisplay *display, const GdkRectangle *damage)
+{
+    SpiceDisplayPrivate *d = SPICE_DISPLAY_GET_PRIVATE(display);
+    GdkRectangle r;
+    EGLint rect[4];
+
+    if (damage == NULL || d->egl.swap_with_damage == NULL) {
+        eglSwapBuffers(d->egl.display, d->egl.surface);
+        return;
+    }
+
+    r.x = r.y = 0;
+    r.width = d->ww;
+    r.height = d->wh;
+    if (!gdk_rectangle_intersect(&r, damage, &r))
+        return;
+
+    /* EGL rectangles have a bottom-left origin */
+    rect[0] = r.x;
+    rect[1] = d->wh - r.y - r.height;
+    rect[2] = r.width;
+    rect[3] = r.height;
+    d->egl.swap_with_damage(d->egl.display, d->egl.surface, rect, 1);
+}
+
+/* Present the current source, @damage being the changed area of the
+ * window, or %NULL if unknown. */
 G_GNUC_INTERNAL
-void spice_egl_update_display(SpiceDisplay *display)
+void spice_egl_update_display(SpiceDisplay *display, const GdkRectangle *damage)
 {
     SpiceDisplayPrivate *d = SPICE_DISPLAY_GET_PRIVATE(display);
     double s;
     int x, y, w, h;
     gdouble tx, ty, tw, th;
 
-    g_return_if_fail(d->egl.image != NULL);
     g_return_if_fail(d->egl.surface != NULL);
 
+    if (!spice_egl_make_current(display))
+        return;
+
     spice_display_get_scaling(display, &s, &x, &y, &w, &h);
 
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    /* FIXME: bad floating arithmetic? */
-    tx = ((float)d->egl.scanout.x / (float)d->egl.scanout.width);
-    ty = ((float)d->egl.scanout.y / (float)d->egl.scanout.height);
-    tw = ((float)d->egl.scanout.w / (float)d->egl.scanout.width);
-    th = ((float)d->egl.scanout.h / (float)d->egl.scanout.height);
-    ty += 1 - th;
-    if (!d->egl.scanout.y0top) {
-        ty = 1 - ty;
-        th = -1 * th;
+    if (d->egl.draw_2d) {
+        if (d->egl.primary.tex == 0)
+            goto swap;
+
+        spice_egl_upload_primary(display);
+        glBindTexture(GL_TEXTURE_2D, d->egl.primary.tex);
+        /* the surface is stored top-down */
+        tx = 0;
+        ty = 1;
+        tw = 1;
+        th = -1;
+    } else {
+        g_return_if_fail(d->egl.images.current != NULL);
+
+        glBindTexture(GL_TEXTURE_2D, d->egl.images.current->tex);
+        /* FIXME: bad floating arithmetic? */
+        tx = ((float)d->egl.scanout.x / (float)d->egl.scanout.width);
+        ty = ((float)d->egl.scanout.y / (float)d->egl.scanout.height);
+        tw = ((float)d->egl.scanout.w / (float)d->egl.scanout.width);
+        th = ((float)d->egl.scanout.h / (float)d->egl.scanout.height);
+        ty += 1 - th;
+        if (!d->egl.scanout.y0top) {
+            ty = 1 - ty;
+            th = -1 * th;
+        }
     }
     SPICE_DEBUG("update %f +%d+%d %dx%d +%f+%f %fx%f", s, x, y, w, h,
                 tx, ty, tw, th);
 
     client_draw_rect_tex(display, x, y, w, h,
                          tx, ty, tw, th);
-    eglSwapBuffers(d->egl.display, d->egl.surface);
+    spice_egl_draw_cursor(display);
+swap:
+    spice_egl_swap(display, damage);
 }
 
+/* (Re)allocate the texture holding the 2D primary surface, for the
+ * current monitor area, and schedule a full upload. */
+G_GNUC_INTERNAL
+void spice_egl_update_primary(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = SPICE_DISPLAY_GET_PRIVATE(display);
+
+    g_return_if_fail(d->egl.use_2d);
+
+    if (!spice_egl_make_current(display))
+        return;
+
+    spice_egl_primary_resize(&d->egl.primary, d->area.width, d->area.height);
+}
+
+/* Record @rect, relative to the monitor area, to be uploaded on the
+ * next presentation. */
+G_GNUC_INTERNAL
+void spice_egl_invalidate_primary(SpiceDisplay *display, const GdkRectangle *rect)
+{
+    SpiceDisplayPrivate *d = SPICE_DISPLAY_GET_PRIVATE(display);
+    SpiceEglRect r = { rect->x, rect->y, rect->width, rect->height };
+
+    spice_egl_primary_invalidate(&d->egl.primary, &r);
+}
 
 G_GNUC_INTERNAL
 int spice_egl_update_scanout(SpiceDisplay *display,
                              const SpiceVirglScanout *scanout)
 {
     SpiceDisplayPrivate *d = SPICE_DISPLAY_GET_PRIVATE(display);
-    EGLint attrs[13];
     guint32 format;
 
     g_return_val_if_fail(scanout != NULL, -1);
     format = scanout->format;
 
-    if (scanout->fd == -1)
+    if (scanout->fd == -1) {
+        if (spice_egl_make_current(display))
+            spice_egl_scanout_clear(&d->egl.images, d->egl.display);
         return 0;
-
-    if (d->egl.image != NULL) {
-        eglDestroyImageKHR(d->egl.display, d->egl.image);
-        d->egl.image = NULL;
     }
 
-    attrs[0] = EGL_DMA_BUF_PLANE0_FD_EXT;
-    attrs[1] = scanout->fd;
-    attrs[2] = EGL_DMA_BUF_PLANE0_PITCH_EXT;
-    attrs[3] = scanout->stride;
-    attrs[4] = EGL_DMA_BUF_PLANE0_OFFSET_EXT;
-    attrs[5] = 0;
-    attrs[6] = EGL_WIDTH;
-    attrs[7] = scanout->width;
-    attrs[8] = EGL_HEIGHT;
-    attrs[9] = scanout->height;
-    attrs[10] = EGL_LINUX_DRM_FOURCC_EXT;
-    attrs[11] = format;
-    attrs[12] = EGL_NONE;
     SPICE_DEBUG("fd:%d stride:%d y0:%d %dx%d format:0x%x (%c%c%c%c)",
                 scanout->fd, scanout->stride, scanout->y0top,
                 scanout->width, scanout->height, format,
                 format & 0xff, (format >> 8) & 0xff, (format >> 16) & 0xff, format >> 24);
 
-    d->egl.image = eglCreateImageKHR(d->egl.display,
-                                       EGL_NO_CONTEXT,
-                                       EGL_LINUX_DMA_BUF_EXT,
-                                       (EGLClientBuffer)NULL,
-                                       attrs);
-    glGenTextures(1, &d->egl.tex_id);
-    glBindTexture(GL_TEXTURE_2D, d->egl.tex_id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, (GLeglImageOES)d->egl.image);
+    if (!spice_egl_make_current(display))
+        return -1;
+
+    if (!spice_egl_scanout_import(&d->egl.images, d->egl.display,
+                                  scanout->fd, scanout->width, scanout->height,
+                                  scanout->stride, scanout->format))
+        return -1;
+
     d->egl.scanout = *scanout;
 
     return 0;
@@ -37,6 +37,8 @@ G_BEGIN_DECLS
 #include <EGL/eglext.h>
 #include <X11/Xlib.h>
 #include <gdk/gdkx.h>
+#include "spice-egl-primary.h"
+#include "spice-egl-scanout.h"
 #endif
 
 #include "spice-widget.h"
@@ -71,6 +73,8 @@ struct _SpiceDisplayPrivate {
     gint                    ww, wh, mx, my;
 
     bool                    convert;
+    guint8                  *convert_dirty; /* tiles of area to convert */
+    gint                    convert_tiles_x, convert_tiles_y;
     bool                    have_mitshm;
     gboolean                allow_scaling;
     gboolean                only_downscale;
@@ -82,9 +86,14 @@ struct _SpiceDisplayPrivate {
     XVisualInfo             *vi;
     XImage                  *ximage;
     XShmSegmentInfo         *shminfo;
+    bool                    convert_shm; /* converted data is shared memory */
     GC                      gc;
 #else
     cairo_surface_t         *ximage;
+    cairo_surface_t         *scaled; /* cached scaled copy of ximage */
+    guint8                  *scaled_dirty; /* damaged tiles of area */
+    gint                    scaled_tiles_x, scaled_tiles_y;
+    double                  scaled_s;
 #endif
 
     SpiceSession            *session;
@@ -106,6 +115,17 @@ struct _SpiceDisplayPrivate {
     int                     mouse_last_y;
     int                     mouse_guest_x;
     int                     mouse_guest_y;
+    /* server cursor moves, applied once per frame */
+    gboolean                cursor_move_pending;
+    guint                   cursor_move_id;
+    int                     cursor_move_x;
+    int                     cursor_move_y;
+    /* local motion not yet reflected by the server cursor */
+    gboolean                cursor_prediction;
+    gboolean                gl_2d;
+    int                     mouse_predict_dx;
+    int                     mouse_predict_dy;
+    gint64                  mouse_predict_time;
 
     bool                    keyboard_grab_active;
     bool                    keyboard_have_focus;
@@ -143,9 +163,17 @@ struct _SpiceDisplayPrivate {
         guint32             mproj;
         guint32             attr_pos, attr_tex;
         guint32             vbuf_id;
-        guint               tex_id;
-        EGLImageKHR         image;
+        SpiceEglScanout     images;
         SpiceVirglScanout   scanout;
+        EGLBoolean          (*swap_with_damage)(EGLDisplay dpy, EGLSurface surface,
+                                                const EGLint *rects, EGLint n_rects);
+        /* 2D primary surface presented through GL */
+        gboolean            use_2d;
+        gboolean            draw_2d;
+        SpiceEglPrimary     primary;
+        /* server mode cursor, drawn over the display */
+        guint               cursor_tex;
+        GdkPixbuf           *cursor_pixbuf;
     } egl;
 #endif
     SpiceVirglChannel      *virgl;
@@ -153,6 +181,7 @@ struct _SpiceDisplayPrivate {
 
 int      spicex_image_create                 (SpiceDisplay *display);
 void     spicex_image_destroy                (SpiceDisplay *display);
+void     spicex_image_invalidate             (SpiceDisplay *display, const GdkRectangle *rect);
 #if GTK_CHECK_VERSION (2, 91, 0)
 void     spicex_draw_event                   (SpiceDisplay *display, cairo_t *cr);
 #else
@@ -160,13 +189,16 @@ void     spicex_expose_event                 (SpiceDisplay *display, GdkEventExp
 #endif
 gboolean spicex_is_scaled                    (SpiceDisplay *display);
 void     spice_display_get_scaling           (SpiceDisplay *display, double *s, int *x, int *y, int *w, int *h);
+void     spice_display_get_cursor_position   (SpiceDisplay *display, int *x, int *y);
 int      spice_egl_init                      (SpiceDisplay *display);
 int      spice_egl_realize_display           (SpiceDisplay *display);
 void     spice_egl_unrealize_display         (SpiceDisplay *display);
-void     spice_egl_update_display            (SpiceDisplay *display);
+void     spice_egl_update_display            (SpiceDisplay *display, const GdkRectangle *damage);
 void     spice_egl_resize_display            (SpiceDisplay *display, int w, int h);
 int      spice_egl_update_scanout            (SpiceDisplay *display,
                                               const SpiceVirglScanout *scanout);
+void     spice_egl_update_primary            (SpiceDisplay *display);
+void     spice_egl_invalidate_primary        (SpiceDisplay *display, const GdkRectangle *rect);
 
 G_END_DECLS
 
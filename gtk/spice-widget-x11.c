@@ -116,10 +116,38 @@ static int catch_no_mitshm(Display * dpy, XErrorEvent * event)
     return 0;
 }
 
+/* allocate the 32 bits color converted image in shared memory, so that
+ * it can still be blitted with MIT-SHM */
+static int convert_shm_alloc(SpiceDisplayPrivate *d)
+{
+#ifdef HAVE_SYS_SHM_H
+    int shmid;
+    void *data;
+
+    shmid = shmget(IPC_PRIVATE, d->height * d->stride, IPC_CREAT | 0600);
+    if (shmid < 0)
+        return -1;
+
+    data = shmat(shmid, 0, 0);
+    if (data == (void *)-1) {
+        shmctl(shmid, IPC_RMID, 0);
+        return -1;
+    }
+
+    memset(data, 0, d->height * d->stride);
+    d->data = data;
+    d->convert_shm = true;
+    return shmid;
+#else
+    return -1;
+#endif
+}
+
 G_GNUC_INTERNAL
 int spicex_image_create(SpiceDisplay *display)
 {
     SpiceDisplayPrivate   *d = display->priv;
+    int                   shmid = d->shmid;
 
     if (d->ximage != NULL)
         return 0;
@@ -142,16 +170,18 @@ int spicex_image_create(SpiceDisplay *display)
         g_return_val_if_fail(d->vi != NULL, 1);
     }
     if (d->convert) {
-        d->data = g_malloc0(d->height * d->stride); /* pixels are 32 bits */
+        shmid = -1;
+        d->convert_shm = false;
+        if (d->have_mitshm)
+            shmid = convert_shm_alloc(d);
+        if (shmid == -1)
+            d->data = g_malloc0(d->height * d->stride); /* pixels are 32 bits */
     }
 
     d->gc = XCreateGC(d->dpy, gdk_x11_drawable_get_xid(window),
                       GCForeground | GCBackground, &gcval);
 
-    if (d->convert) /* do not use shm when doing color format conversion */
-        goto xcreate;
-
-    if (d->have_mitshm && d->shmid != -1) {
+    if (d->have_mitshm && shmid != -1) {
         if (!XShmQueryExtension(d->dpy)) {
             goto shm_fail;
         }
@@ -163,11 +193,11 @@ int spicex_image_create(SpiceDisplay *display)
         if (d->ximage == NULL)
             goto shm_fail;
         d->shminfo->shmaddr = d->data;
-        d->shminfo->shmid = d->shmid;
+        d->shminfo->shmid = shmid;
         d->shminfo->readOnly = false;
         XShmAttach(d->dpy, d->shminfo);
         XSync(d->dpy, False);
-        shmctl(d->shmid, IPC_RMID, 0);
+        shmctl(shmid, IPC_RMID, 0);
         if (no_mitshm)
             goto shm_fail;
         XSetErrorHandler(old_handler);
@@ -180,7 +210,10 @@ int spicex_image_create(SpiceDisplay *display)
     d->shminfo = NULL;
     if (old_handler)
         XSetErrorHandler(old_handler);
- xcreate:
+#ifdef HAVE_SYS_SHM_H
+    if (d->convert_shm)
+        shmctl(shmid, IPC_RMID, 0);
+#endif
     d->ximage = XCreateImage(d->dpy, d->vi->visual, d->vi->depth, ZPixmap, 0,
                              d->data, d->width, d->height, 32, d->stride);
     return 0;
@@ -194,11 +227,11 @@ void spicex_image_destroy(SpiceDisplay *display)
     if (d->ximage) {
         /* avoid XDestroy to free shared memory, owned and freed by
            channel-display itself */
-        if (d->ximage->data == d->data_origin)
+        if (d->ximage->data == d->data_origin || d->convert_shm)
             d->ximage->data = NULL;
         XDestroyImage(d->ximage);
         d->ximage = NULL;
-        if (d->convert)
+        if (d->convert && !d->convert_shm)
             d->data = 0;
     }
     if (d->shminfo) {
@@ -210,12 +243,25 @@ void spicex_image_destroy(SpiceDisplay *display)
         XFreeGC(d->dpy, d->gc);
         d->gc = NULL;
     }
+#ifdef HAVE_SYS_SHM_H
+    if (d->convert_shm && d->data) {
+        shmdt(d->data);
+        d->data = NULL;
+    }
+#endif
+    d->convert_shm = false;
     if (d->convert && d->data) {
         g_free(d->data);
         d->data = NULL;
     }
 }
 
+G_GNUC_INTERNAL
+void spicex_image_invalidate(SpiceDisplay *display, const GdkRectangle *rect)
+{
+    /* the image is blitted as is, nothing to update */
+}
+
 G_GNUC_INTERNAL
 void spicex_expose_event(SpiceDisplay *display, GdkEventExpose *expose)
 {
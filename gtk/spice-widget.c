@@ -87,7 +87,9 @@ enum {
     PROP_ZOOM_LEVEL,
     PROP_MONITOR_ID,
     PROP_KEYPRESS_DELAY,
-    PROP_READY
+    PROP_READY,
+    PROP_CURSOR_PREDICTION,
+    PROP_GL_2D,
 };
 
 /* Signals */
@@ -113,7 +115,8 @@ static void try_mouse_ungrab(SpiceDisplay *display);
 static void recalc_geometry(GtkWidget *widget);
 static void channel_new(SpiceSession *s, SpiceChannel *channel, gpointer data);
 static void channel_destroy(SpiceSession *s, SpiceChannel *channel, gpointer data);
-static void cursor_invalidate(SpiceDisplay *display);
+static gboolean cursor_invalidate(SpiceDisplay *display);
+static void cursor_move_flush(SpiceDisplay *display);
 static void update_area(SpiceDisplay *display, gint x, gint y, gint width, gint height);
 static void release_keys(SpiceDisplay *display);
 
@@ -169,6 +172,12 @@ static void spice_display_get_property(GObject    *object,
     case PROP_KEYPRESS_DELAY:
         g_value_set_uint(value, d->keypress_delay);
         break;
+    case PROP_CURSOR_PREDICTION:
+        g_value_set_boolean(value, d->cursor_prediction);
+        break;
+    case PROP_GL_2D:
+        g_value_set_boolean(value, d->gl_2d);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
         break;
@@ -370,6 +379,15 @@ static void spice_display_set_property(GObject      *object,
     case PROP_KEYPRESS_DELAY:
         d->keypress_delay = g_value_get_uint(value);
         break;
+    case PROP_CURSOR_PREDICTION:
+        cursor_invalidate(display);
+        d->cursor_prediction = g_value_get_boolean(value);
+        d->mouse_predict_dx = d->mouse_predict_dy = 0;
+        cursor_invalidate(display);
+        break;
+    case PROP_GL_2D:
+        d->gl_2d = g_value_get_boolean(value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
         break;
@@ -414,6 +432,14 @@ static void spice_display_dispose(GObject *obj)
         d->key_delayed_id = 0;
     }
 
+#if GTK_CHECK_VERSION(3, 8, 0)
+    if (d->cursor_move_id) {
+        gtk_widget_remove_tick_callback(GTK_WIDGET(display), d->cursor_move_id);
+        d->cursor_move_id = 0;
+    }
+#endif
+    d->cursor_move_pending = FALSE;
+
     G_OBJECT_CLASS(spice_display_parent_class)->dispose(obj);
 }
 
@@ -430,6 +456,7 @@ static void spice_display_finalize(GObject *obj)
     }
     g_free(d->activeseq);
     d->activeseq = NULL;
+    g_clear_pointer(&d->convert_dirty, g_free);
 
     if (d->show_cursor) {
         gdk_cursor_unref(d->show_cursor);
@@ -1113,22 +1140,185 @@ static gboolean do_color_convert(SpiceDisplay *display, GdkRectangle *r)
     return true;
 }
 
+/* granularity, in guest pixels, of the color conversion */
+#define CONVERT_TILE_SIZE 64
+/* below this amount of pixels, converting in place is cheaper than
+ * dispatching to the worker threads */
+#define CONVERT_THREAD_MIN_PIXELS (256 * 256)
+
+typedef struct _ConvertJob {
+    SpiceDisplay *display;
+    GdkRectangle rect;
+    GAsyncQueue *done;
+} ConvertJob;
+
+/* worker thread */
+static void convert_job_run(gpointer data, gpointer user_data)
+{
+    ConvertJob *job = data;
+
+    do_color_convert(job->display, &job->rect);
+    g_async_queue_push(job->done, job);
+}
+
+static GThreadPool *convert_pool_get(void)
+{
+    static GThreadPool *pool = NULL;
+    static gboolean failed = FALSE;
+    GError *error = NULL;
+    gint threads = 2;
+
+    if (pool != NULL || failed)
+        return pool;
+
+#if GLIB_CHECK_VERSION(2,36,0)
+    threads = g_get_num_processors();
+#endif
+    pool = g_thread_pool_new(convert_job_run, NULL, threads, FALSE, &error);
+    if (pool == NULL) {
+        g_warning("failed to create color conversion threads: %s", error->message);
+        g_clear_error(&error);
+        failed = TRUE;
+    }
+
+    return pool;
+}
+
+/* Mark the tiles covering @r, in primary coordinates, to be converted
+ * before the next draw. */
+static void convert_invalidate(SpiceDisplay *display, const GdkRectangle *r)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    gint tx, ty, tx1, ty1, tx2, ty2;
+    gint tiles_x = (d->area.width + CONVERT_TILE_SIZE - 1) / CONVERT_TILE_SIZE;
+    gint tiles_y = (d->area.height + CONVERT_TILE_SIZE - 1) / CONVERT_TILE_SIZE;
+
+    if (d->convert_dirty == NULL ||
+        d->convert_tiles_x != tiles_x || d->convert_tiles_y != tiles_y) {
+        g_free(d->convert_dirty);
+        d->convert_dirty = g_malloc0(tiles_x * tiles_y);
+        d->convert_tiles_x = tiles_x;
+        d->convert_tiles_y = tiles_y;
+    }
+
+    tx1 = (r->x - d->area.x) / CONVERT_TILE_SIZE;
+    ty1 = (r->y - d->area.y) / CONVERT_TILE_SIZE;
+    tx2 = MIN(tiles_x, (r->x - d->area.x + r->width + CONVERT_TILE_SIZE - 1) / CONVERT_TILE_SIZE);
+    ty2 = MIN(tiles_y, (r->y - d->area.y + r->height + CONVERT_TILE_SIZE - 1) / CONVERT_TILE_SIZE);
+
+    for (ty = ty1; ty < ty2; ty++)
+        for (tx = tx1; tx < tx2; tx++)
+            d->convert_dirty[ty * tiles_x + tx] = 1;
+}
+
+/* Convert the dirty tiles, spreading horizontal runs of tiles over
+ * worker threads when there is enough work. This blocks until the
+ * conversion is complete, so the channel can't modify the source in
+ * the meantime. */
+static void convert_flush(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    GArray *rects;
+    GThreadPool *pool = NULL;
+    GAsyncQueue *done;
+    ConvertJob *jobs;
+    gint tx, ty, run, pixels = 0;
+    guint i;
+
+    if (!d->convert || d->convert_dirty == NULL ||
+        d->data == NULL || d->data_origin == NULL)
+        return;
+
+    rects = g_array_new(FALSE, FALSE, sizeof(GdkRectangle));
+    for (ty = 0; ty < d->convert_tiles_y; ty++) {
+        guint8 *row = d->convert_dirty + ty * d->convert_tiles_x;
+
+        for (tx = 0; tx < d->convert_tiles_x; tx += run) {
+            GdkRectangle rect;
+
+            for (run = 0; tx + run < d->convert_tiles_x && row[tx + run]; run++)
+                row[tx + run] = 0;
+            if (run == 0) {
+                run = 1;
+                continue;
+            }
+
+            rect.x = tx * CONVERT_TILE_SIZE;
+            rect.y = ty * CONVERT_TILE_SIZE;
+            rect.width = MIN((tx + run) * CONVERT_TILE_SIZE, d->area.width) - rect.x;
+            rect.height = MIN((ty + 1) * CONVERT_TILE_SIZE, d->area.height) - rect.y;
+            rect.x += d->area.x;
+            rect.y += d->area.y;
+            pixels += rect.width * rect.height;
+            g_array_append_val(rects, rect);
+        }
+    }
+
+    if (rects->len > 1 && pixels >= CONVERT_THREAD_MIN_PIXELS)
+        pool = convert_pool_get();
+
+    if (pool == NULL) {
+        for (i = 0; i < rects->len; i++)
+            do_color_convert(display, &g_array_index(rects, GdkRectangle, i));
+        g_array_unref(rects);
+        return;
+    }
+
+    done = g_async_queue_new();
+    jobs = g_new(ConvertJob, rects->len);
+    for (i = 0; i < rects->len; i++) {
+        jobs[i].display = display;
+        jobs[i].rect = g_array_index(rects, GdkRectangle, i);
+        jobs[i].done = done;
+        g_thread_pool_push(pool, &jobs[i], NULL);
+    }
+    for (i = 0; i < rects->len; i++)
+        g_async_queue_pop(done);
+
+    g_async_queue_unref(done);
+    g_free(jobs);
+    g_array_unref(rects);
+}
 
 #if GTK_CHECK_VERSION (2, 91, 0)
 static gboolean draw_event(GtkWidget *widget, cairo_t *cr)
 {
     SpiceDisplay *display = SPICE_DISPLAY(widget);
     SpiceDisplayPrivate *d = display->priv;
+#ifdef USE_EGL
+    GdkRectangle clip, *damage = NULL;
+#endif
     g_return_val_if_fail(d != NULL, false);
 
-    if (d->egl.enabled)
-        return false;
+#if !GTK_CHECK_VERSION(3, 8, 0)
+    cursor_move_flush(display);
+#endif
+
+#ifdef USE_EGL
+    if (gdk_cairo_get_clip_rectangle(cr, &clip))
+        damage = &clip;
+
+    if (d->egl.enabled && !d->egl.draw_2d) {
+        if (d->egl.images.current == NULL)
+            return false;
+        spice_egl_update_display(display, damage);
+        return true;
+    }
+#endif
 
     if (d->mark == 0 || d->data == NULL ||
         d->area.width == 0 || d->area.height == 0)
         return false;
     g_return_val_if_fail(d->ximage != NULL, false);
 
+    convert_flush(display);
+#ifdef USE_EGL
+    if (d->egl.enabled) {
+        spice_egl_update_display(display, damage);
+        update_mouse_pointer(display);
+        return true;
+    }
+#endif
     spicex_draw_event(display, cr);
     update_mouse_pointer(display);
 
@@ -1141,11 +1331,30 @@ static gboolean expose_event(GtkWidget *widget, GdkEventExpose *expose)
     SpiceDisplayPrivate *d = display->priv;
     g_return_val_if_fail(d != NULL, false);
 
+    cursor_move_flush(display);
+
+#ifdef USE_EGL
+    if (d->egl.enabled && !d->egl.draw_2d) {
+        if (d->egl.images.current == NULL)
+            return false;
+        spice_egl_update_display(display, &expose->area);
+        return true;
+    }
+#endif
+
     if (d->mark == 0 || d->data == NULL ||
         d->area.width == 0 || d->area.height == 0)
         return false;
     g_return_val_if_fail(d->ximage != NULL, false);
 
+    convert_flush(display);
+#ifdef USE_EGL
+    if (d->egl.enabled) {
+        spice_egl_update_display(display, &expose->area);
+        update_mouse_pointer(display);
+        return true;
+    }
+#endif
     spicex_expose_event(display, expose);
     update_mouse_pointer(display);
 
@@ -1624,6 +1833,14 @@ static gboolean motion_event(GtkWidget *widget, GdkEventMotion *motion)
             spice_inputs_motion(d->inputs, dx, dy,
                                 button_mask_gdk_to_spice(motion->state));
 
+            if (d->cursor_prediction && (dx != 0 || dy != 0)) {
+                cursor_invalidate(display);
+                d->mouse_predict_dx += dx;
+                d->mouse_predict_dy += dy;
+                d->mouse_predict_time = g_get_monotonic_time();
+                cursor_invalidate(display);
+            }
+
             d->mouse_last_x = x;
             d->mouse_last_y = y;
             if (dx != 0 || dy != 0)
@@ -1766,7 +1983,11 @@ static void update_image(SpiceDisplay *display)
 
     spicex_image_create(display);
     if (d->convert)
-        do_color_convert(display, &d->area);
+        convert_invalidate(display, &d->area);
+#ifdef USE_EGL
+    if (d->egl.use_2d)
+        spice_egl_update_primary(display);
+#endif
 }
 
 static void realize(GtkWidget *widget)
@@ -1781,13 +2002,18 @@ static void realize(GtkWidget *widget)
                                            &d->keycode_maplen);
 
 #ifdef USE_EGL
-    spice_egl_realize_display(display);
+    if (spice_egl_realize_display(display) == 0 && d->egl.use_2d) {
+        d->egl.enabled = TRUE;
+        d->egl.draw_2d = TRUE;
+        gtk_widget_set_double_buffered(widget, FALSE);
+    }
 #endif
     update_image(display);
 }
 
 static void unrealize(GtkWidget *widget)
 {
+    cursor_move_flush(SPICE_DISPLAY(widget));
     spicex_image_destroy(SPICE_DISPLAY(widget));
 #ifdef USE_EGL
     spice_egl_unrealize_display(SPICE_DISPLAY(widget));
@@ -2007,6 +2233,44 @@ static void spice_display_class_init(SpiceDisplayClass *klass)
                           G_PARAM_CONSTRUCT |
                           G_PARAM_STATIC_STRINGS));
 
+    /**
+     * SpiceDisplay:cursor-prediction:
+     *
+     * In server mouse mode, draw the cursor where the local mouse
+     * motion should bring it, without waiting for the guest to report
+     * the new position. This hides the round-trip latency of the
+     * cursor on slow links, at the cost of small corrections when
+     * the guest disagrees (pointer acceleration, screen edges...).
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_CURSOR_PREDICTION,
+         g_param_spec_boolean("cursor-prediction", "Cursor prediction",
+                              "Whether to predict the server cursor position",
+                              FALSE,
+                              G_PARAM_READWRITE |
+                              G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceDisplay:gl-2d:
+     *
+     * Present the 2D display surface through OpenGL ES 3 instead of
+     * cairo, when EGL support is available: only the damaged areas are
+     * uploaded to a texture, and scaling is done by the GPU. It takes
+     * effect when the widget is realized, and is ignored if EGL can't
+     * be initialized.
+     *
+     * Since: 0.28
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_GL_2D,
+         g_param_spec_boolean("gl-2d", "GL 2D",
+                              "Whether to present the 2D display with OpenGL",
+                              FALSE,
+                              G_PARAM_READWRITE |
+                              G_PARAM_STATIC_STRINGS));
+
     /**
      * SpiceDisplay:monitor-id:
      *
@@ -2186,10 +2450,9 @@ static void primary_destroy(SpiceChannel *channel, gpointer data)
     set_monitor_ready(display, false);
 }
 
-static void invalidate(SpiceChannel *channel,
-                       gint x, gint y, gint w, gint h, gpointer data)
+static void invalidate(SpiceDisplay *display,
+                       gint x, gint y, gint w, gint h)
 {
-    SpiceDisplay *display = data;
     SpiceDisplayPrivate *d = display->priv;
     int display_x, display_y;
     int x1, y1, x2, y2;
@@ -2201,7 +2464,9 @@ static void invalidate(SpiceChannel *channel,
         .height = h
     };
 
-    if (d->egl.enabled) {
+    if (d->egl.use_2d) {
+        d->egl.draw_2d = TRUE;
+    } else if (d->egl.enabled) {
         d->egl.enabled = false;
         gtk_widget_set_double_buffered(GTK_WIDGET(display), true);
     }
@@ -2213,7 +2478,18 @@ static void invalidate(SpiceChannel *channel,
         return;
 
     if (d->convert)
-        do_color_convert(display, &rect);
+        convert_invalidate(display, &rect);
+
+#ifdef USE_EGL
+    if (d->egl.use_2d) {
+        GdkRectangle r = rect;
+
+        r.x -= d->area.x;
+        r.y -= d->area.y;
+        spice_egl_invalidate_primary(display, &r);
+    } else
+#endif
+        spicex_image_invalidate(display, &rect);
 
     spice_display_get_scaling(display, &s,
                               &display_x, &display_y,
@@ -2229,6 +2505,17 @@ static void invalidate(SpiceChannel *channel,
                                x2 - x1, y2-y1);
 }
 
+static void invalidate_region(SpiceChannel *channel,
+                              gint *rects, gint n_rects, gpointer data)
+{
+    SpiceDisplay *display = data;
+    gint i;
+
+    for (i = 0; i < n_rects; i++)
+        invalidate(display, rects[4 * i], rects[4 * i + 1],
+                   rects[4 * i + 2], rects[4 * i + 3]);
+}
+
 static void mark(SpiceDisplay *display, gint mark)
 {
     SpiceDisplayPrivate *d = display->priv;
@@ -2239,6 +2526,63 @@ static void mark(SpiceDisplay *display, gint mark)
     update_ready(display);
 }
 
+/* pixbuf and cursor built for a cursor shape, attached to it in the
+ * channel, so they are reused when the server sends the shape from its
+ * cache, as it does with the frames of animated cursors */
+typedef struct {
+    GdkDisplay              *display;
+    GdkPixbuf               *pixbuf;
+    GdkCursor               *cursor;
+} CursorData;
+
+static void cursor_data_free(CursorData *cdata)
+{
+    g_object_unref(cdata->pixbuf);
+    gdk_cursor_unref(cdata->cursor);
+    g_slice_free(CursorData, cdata);
+}
+
+static GdkCursor *cursor_data_lookup(SpiceDisplay *display,
+                                     SpiceCursorChannel *channel,
+                                     gint width, gint height,
+                                     gint hot_x, gint hot_y,
+                                     gconstpointer rgba)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    GdkDisplay *gdk_display = gtk_widget_get_display(GTK_WIDGET(display));
+    CursorData *cdata;
+    GdkPixbuf *pixbuf;
+    GdkCursor *cursor;
+
+    cdata = spice_cursor_channel_get_cursor_data(channel);
+    if (cdata != NULL && cdata->display == gdk_display) {
+        d->mouse_pixbuf = g_object_ref(cdata->pixbuf);
+        return gdk_cursor_ref(cdata->cursor);
+    }
+
+    pixbuf = gdk_pixbuf_new_from_data(g_memdup(rgba, width * height * 4),
+                                      GDK_COLORSPACE_RGB,
+                                      TRUE, 8,
+                                      width,
+                                      height,
+                                      width * 4,
+                                      (GdkPixbufDestroyNotify)g_free, NULL);
+    d->mouse_pixbuf = pixbuf;
+    cursor = gdk_cursor_new_from_pixbuf(gdk_display, pixbuf, hot_x, hot_y);
+    /* another widget may have attached its own, on another display */
+    if (cursor == NULL || cdata != NULL)
+        return cursor;
+
+    cdata = g_slice_new(CursorData);
+    cdata->display = gdk_display;
+    cdata->pixbuf = g_object_ref(pixbuf);
+    cdata->cursor = gdk_cursor_ref(cursor);
+    spice_cursor_channel_set_cursor_data(channel, cdata,
+                                         (GDestroyNotify)cursor_data_free);
+
+    return cursor;
+}
+
 static void cursor_set(SpiceCursorChannel *channel,
                        gint width, gint height, gint hot_x, gint hot_y,
                        gpointer rgba, gpointer data)
@@ -2247,6 +2591,7 @@ static void cursor_set(SpiceCursorChannel *channel,
     SpiceDisplayPrivate *d = display->priv;
     GdkCursor *cursor = NULL;
 
+    cursor_move_flush(display);
     cursor_invalidate(display);
 
     if (d->mouse_pixbuf) {
@@ -2255,17 +2600,10 @@ static void cursor_set(SpiceCursorChannel *channel,
     }
 
     if (rgba != NULL) {
-        d->mouse_pixbuf = gdk_pixbuf_new_from_data(g_memdup(rgba, width * height * 4),
-                                                   GDK_COLORSPACE_RGB,
-                                                   TRUE, 8,
-                                                   width,
-                                                   height,
-                                                   width * 4,
-                                                   (GdkPixbufDestroyNotify)g_free, NULL);
         d->mouse_hotspot.x = hot_x;
         d->mouse_hotspot.y = hot_y;
-        cursor = gdk_cursor_new_from_pixbuf(gtk_widget_get_display(GTK_WIDGET(display)),
-                                            d->mouse_pixbuf, hot_x, hot_y);
+        cursor = cursor_data_lookup(display, channel, width, height,
+                                    hot_x, hot_y, rgba);
     } else
         g_warn_if_reached();
 
@@ -2280,7 +2618,8 @@ static void cursor_set(SpiceCursorChannel *channel,
         }
     }
 
-    gdk_cursor_unref(d->mouse_cursor);
+    if (d->mouse_cursor)
+        gdk_cursor_unref(d->mouse_cursor);
     d->mouse_cursor = cursor;
 
     update_mouse_pointer(display);
@@ -2292,6 +2631,7 @@ static void cursor_hide(SpiceCursorChannel *channel, gpointer data)
     SpiceDisplay *display = data;
     SpiceDisplayPrivate *d = display->priv;
 
+    cursor_move_flush(display);
     if (d->show_cursor != NULL) /* then we are already hidden */
         return;
 
@@ -2357,36 +2697,87 @@ void spice_display_get_scaling(SpiceDisplay *display,
         *y_out = y;
 }
 
-static void cursor_invalidate(SpiceDisplay *display)
+/* Returns: whether a redraw of the cursor area was queued */
+static gboolean cursor_invalidate(SpiceDisplay *display)
 {
     SpiceDisplayPrivate *d = display->priv;
     double s;
-    int x, y;
+    int x, y, cx, cy;
 
     if (!gtk_widget_get_realized (GTK_WIDGET(display)))
-        return;
+        return FALSE;
 
     if (d->mouse_pixbuf == NULL)
-        return;
+        return FALSE;
 
     spice_display_get_scaling(display, &s, &x, &y, NULL, NULL);
+    spice_display_get_cursor_position(display, &cx, &cy);
 
     gtk_widget_queue_draw_area(GTK_WIDGET(display),
-                               floor ((d->mouse_guest_x - d->mouse_hotspot.x - d->area.x) * s) + x,
-                               floor ((d->mouse_guest_y - d->mouse_hotspot.y - d->area.y) * s) + y,
+                               floor ((cx - d->mouse_hotspot.x - d->area.x) * s) + x,
+                               floor ((cy - d->mouse_hotspot.y - d->area.y) * s) + y,
                                ceil (gdk_pixbuf_get_width(d->mouse_pixbuf) * s),
                                ceil (gdk_pixbuf_get_height(d->mouse_pixbuf) * s));
+    return TRUE;
 }
 
-static void cursor_move(SpiceCursorChannel *channel, gint x, gint y, gpointer data)
+/* the guest should have caught up with local motion by then */
+#define CURSOR_PREDICTION_TIMEOUT_US (G_USEC_PER_SEC / 2)
+
+/* Remove the part of the predicted motion the server cursor moved by. */
+static int predict_consume(int pending, int moved)
+{
+    if (pending > 0)
+        return MAX(0, pending - MAX(moved, 0));
+    return MIN(0, pending - MIN(moved, 0));
+}
+
+G_GNUC_INTERNAL
+void spice_display_get_cursor_position(SpiceDisplay *display, int *x, int *y)
+{
+    SpiceDisplayPrivate *d = display->priv;
+
+    *x = d->mouse_guest_x;
+    *y = d->mouse_guest_y;
+    if (!d->cursor_prediction || d->mouse_guest_x == -1 || d->mouse_guest_y == -1)
+        return;
+
+    *x = CLAMP(*x + d->mouse_predict_dx, d->area.x, d->area.x + d->area.width - 1);
+    *y = CLAMP(*y + d->mouse_predict_dy, d->area.y, d->area.y + d->area.height - 1);
+}
+
+static void cursor_move_flush(SpiceDisplay *display)
 {
-    SpiceDisplay *display = data;
     SpiceDisplayPrivate *d = display->priv;
 
+    if (!d->cursor_move_pending)
+        return;
+
+    d->cursor_move_pending = FALSE;
+#if GTK_CHECK_VERSION(3, 8, 0)
+    if (d->cursor_move_id) {
+        gtk_widget_remove_tick_callback(GTK_WIDGET(display), d->cursor_move_id);
+        d->cursor_move_id = 0;
+    }
+#endif
+
     cursor_invalidate(display);
 
-    d->mouse_guest_x = x;
-    d->mouse_guest_y = y;
+    if (d->cursor_prediction) {
+        if (d->mouse_guest_x == -1 || d->mouse_guest_y == -1 ||
+            !d->mouse_grab_active ||
+            g_get_monotonic_time() - d->mouse_predict_time > CURSOR_PREDICTION_TIMEOUT_US) {
+            d->mouse_predict_dx = d->mouse_predict_dy = 0;
+        } else {
+            d->mouse_predict_dx = predict_consume(d->mouse_predict_dx,
+                                                  d->cursor_move_x - d->mouse_guest_x);
+            d->mouse_predict_dy = predict_consume(d->mouse_predict_dy,
+                                                  d->cursor_move_y - d->mouse_guest_y);
+        }
+    }
+
+    d->mouse_guest_x = d->cursor_move_x;
+    d->mouse_guest_y = d->cursor_move_y;
 
     cursor_invalidate(display);
 
@@ -2399,11 +2790,57 @@ static void cursor_move(SpiceCursorChannel *channel, gint x, gint y, gpointer da
     }
 }
 
+#if GTK_CHECK_VERSION(3, 8, 0)
+/* frame clock update phase: the invalidated cursor area is painted in
+ * this same frame */
+static gboolean cursor_move_tick(GtkWidget *widget, GdkFrameClock *clock,
+                                 gpointer data)
+{
+    SpiceDisplay *display = SPICE_DISPLAY(widget);
+
+    display->priv->cursor_move_id = 0;
+    cursor_move_flush(display);
+    return FALSE;
+}
+#endif
+
+static void cursor_move(SpiceCursorChannel *channel, gint x, gint y, gpointer data)
+{
+    SpiceDisplay *display = data;
+    SpiceDisplayPrivate *d = display->priv;
+
+    d->cursor_move_x = x;
+    d->cursor_move_y = y;
+
+    /* only keep the last position of the frame */
+    if (d->cursor_move_pending)
+        return;
+    d->cursor_move_pending = TRUE;
+
+#if GTK_CHECK_VERSION(3, 8, 0)
+    if (gtk_widget_get_realized(GTK_WIDGET(display))) {
+        d->cursor_move_id =
+            gtk_widget_add_tick_callback(GTK_WIDGET(display), cursor_move_tick,
+                                         NULL, NULL);
+        return;
+    }
+#else
+    /* flushed from the draw handler, the old cursor area being
+     * redrawn anyway */
+    if (cursor_invalidate(display))
+        return;
+#endif
+
+    cursor_move_flush(display);
+}
+
 static void cursor_reset(SpiceCursorChannel *channel, gpointer data)
 {
     SpiceDisplay *display = data;
     GdkWindow *window = gtk_widget_get_window(GTK_WIDGET(display));
 
+    cursor_move_flush(display);
+
     if (!window) {
         SPICE_DEBUG("%s: no window, returning",  __FUNCTION__);
         return;
@@ -2429,14 +2866,28 @@ static void virgl_update(SpiceDisplay *display,
                          guint32 x, guint32 y, guint32 w, guint32 h)
 {
     SpiceDisplayPrivate *d = display->priv;
+    const SpiceVirglScanout *so = &d->egl.scanout;
+    int display_x, display_y;
+    double s;
 
     SPICE_DEBUG("%s: got update",  __FUNCTION__);
-    if (!d->egl.enabled) {
+    if (!d->egl.enabled || d->egl.draw_2d) {
         d->egl.enabled = TRUE;
+        d->egl.draw_2d = FALSE;
         gtk_widget_set_double_buffered(GTK_WIDGET(display), FALSE);
+        gtk_widget_queue_draw(GTK_WIDGET(display));
+        return;
     }
 
-    spice_egl_update_display(display);
+    /* present from the draw handler, so updates are coalesced on
+     * the frame clock, with the damage mapped to the window */
+    if (!so->y0top)
+        y = so->height - y - h;
+    spice_display_get_scaling(display, &s, &display_x, &display_y, NULL, NULL);
+    gtk_widget_queue_draw_area(GTK_WIDGET(display),
+                               display_x + floor(((gint)x - (gint)so->x) * s),
+                               display_y + floor(((gint)y - (gint)so->y) * s),
+                               ceil(w * s) + 1, ceil(h * s) + 1);
 }
 
 static void channel_new(SpiceSession *s, SpiceChannel *channel, gpointer data)
@@ -2463,8 +2914,8 @@ static void channel_new(SpiceSession *s, SpiceChannel *channel, gpointer data)
                                       G_CALLBACK(primary_create), display, 0);
         spice_g_signal_connect_object(channel, "display-primary-destroy",
                                       G_CALLBACK(primary_destroy), display, 0);
-        spice_g_signal_connect_object(channel, "display-invalidate",
-                                      G_CALLBACK(invalidate), display, 0);
+        spice_g_signal_connect_object(channel, "display-invalidate-region",
+                                      G_CALLBACK(invalidate_region), display, 0);
         spice_g_signal_connect_object(channel, "display-mark",
                                       G_CALLBACK(mark), display, G_CONNECT_AFTER | G_CONNECT_SWAPPED);
         spice_g_signal_connect_object(channel, "notify::monitors",
@@ -2684,6 +3135,7 @@ GdkPixbuf *spice_display_get_pixbuf(SpiceDisplay *display)
     g_return_val_if_fail(d != NULL, NULL);
     /* TODO: ensure d->data has been exposed? */
     g_return_val_if_fail(d->data != NULL, NULL);
+    convert_flush(display);
 
     data = g_malloc0(d->area.width * d->area.height * 3);
     src = d->data;
@@ -138,6 +138,17 @@ int main(int argc, char *argv[])
                    spice_channel_type_to_string(channel_type),
                    total_read_bytes);
         }
+        for (iter = list ; iter ; iter = iter->next) {
+            guint hits, misses;
+
+            if (!SPICE_IS_CURSOR_CHANNEL(iter->data))
+                continue;
+            g_object_get(iter->data,
+                "cache-hits", &hits,
+                "cache-misses", &misses,
+                NULL);
+            printf("cursor cache: %u hits, %u misses\n", hits, misses);
+        }
         g_list_free(list);
     }
     return 0;
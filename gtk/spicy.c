@@ -118,6 +118,7 @@ static void del_window(spice_connection *conn, SpiceWindow *win);
 /* options */
 static gboolean fullscreen = false;
 static gboolean version = false;
+static gboolean latency = false;
 static char *spicy_title = NULL;
 /* globals */
 static GMainLoop     *mainloop = NULL;
@@ -1626,6 +1627,7 @@ static spice_connection *connection_new(void)
     conn = g_new0(spice_connection, 1);
     conn->session = spice_session_new();
     conn->gtk_session = spice_gtk_session_get(conn->session);
+    g_object_set(conn->session, "latency-tracing", latency, NULL);
     g_signal_connect(conn->session, "channel-new",
                      G_CALLBACK(channel_new), conn);
     g_signal_connect(conn->session, "channel-destroy",
@@ -1660,8 +1662,33 @@ static void connection_disconnect(spice_connection *conn)
     spice_session_disconnect(conn->session);
 }
 
+static void print_latency(SpiceSession *session)
+{
+    static const char *stages[] = { "send", "display", "mark" };
+    const guint *histogram;
+    guint i, n;
+    guint stage;
+
+    g_print("input latency (ms):\n");
+    for (stage = 0; stage < G_N_ELEMENTS(stages); stage++) {
+        histogram = spice_session_get_latency_histogram(session, stage, &n);
+        g_print("%s:", stages[stage]);
+        for (i = 0; i < n; i++) {
+            if (i == 0)
+                g_print(" <1:%u", histogram[i]);
+            else if (i == n - 1)
+                g_print(" >=%u:%u", 1 << (i - 1), histogram[i]);
+            else
+                g_print(" %u-%u:%u", 1 << (i - 1), 1 << i, histogram[i]);
+        }
+        g_print("\n");
+    }
+}
+
 static void connection_destroy(spice_connection *conn)
 {
+    if (latency)
+        print_latency(conn->session);
     g_object_unref(conn->session);
     free(conn);
 
@@ -1688,6 +1715,11 @@ static GOptionEntry cmd_entries[] = {
         .arg              = G_OPTION_ARG_NONE,
         .arg_data         = &version,
         .description      = N_("Display version and quit"),
+    },{
+        .long_name        = "latency",
+        .arg              = G_OPTION_ARG_NONE,
+        .arg_data         = &latency,
+        .description      = N_("Trace the latency of input events, and print it on disconnection"),
     },{
         .long_name        = "title",
         .arg              = G_OPTION_ARG_STRING,
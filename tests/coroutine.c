@@ -124,6 +124,73 @@ static void test_coroutine_yield(void)
 #endif
 }
 
+#if WITH_UCONTEXT
+static void test_coroutine_stack_pool(void)
+{
+    struct coroutine co = {
+        .stack_size = 1 << 20,
+        .entry = co_entry_42,
+    };
+    gpointer stack;
+
+    coroutine_init(&co);
+    stack = co.cc.stack;
+    g_assert_cmpint(GPOINTER_TO_INT(coroutine_yieldto(&co, GINT_TO_POINTER(42))), ==, 0x42);
+    g_assert(co.exited);
+
+    /* the stack of the exited coroutine is reused */
+    memset(&co, 0, sizeof(co));
+    co.stack_size = 1 << 20;
+    co.entry = co_entry_42;
+    coroutine_init(&co);
+    g_assert(co.cc.stack == stack);
+    g_assert_cmpint(GPOINTER_TO_INT(coroutine_yieldto(&co, GINT_TO_POINTER(42))), ==, 0x42);
+}
+#endif
+
+static gpointer co_entry_switch(gpointer data)
+{
+    gsize n = GPOINTER_TO_SIZE(data);
+    gsize i;
+
+    for (i = 0; i < n; i++)
+        g_assert(GPOINTER_TO_SIZE(coroutine_yield(GSIZE_TO_POINTER(i))) == i + 1);
+
+    return NULL;
+}
+
+static void test_coroutine_switch_rate(void)
+{
+    struct coroutine co = {
+        .stack_size = 16 << 20,
+        .entry = co_entry_switch,
+    };
+    /* run a few switches in every mode, measure with -m perf */
+    gsize n = g_test_perf() ? 10000000 : 10000;
+    gsize i;
+    gpointer val;
+    gdouble elapsed;
+
+    coroutine_init(&co);
+
+    g_test_timer_start();
+    val = coroutine_yieldto(&co, GSIZE_TO_POINTER(n));
+    for (i = 0; i < n; i++) {
+        g_assert(GPOINTER_TO_SIZE(val) == i);
+        val = coroutine_yieldto(&co, GSIZE_TO_POINTER(i + 1));
+    }
+    elapsed = g_test_timer_elapsed();
+
+    g_assert(val == NULL);
+    g_assert(co.exited);
+
+    /* each round trip is two switches */
+    g_test_minimized_result(elapsed * 1e9 / (2 * n), "%.1f ns per switch",
+                            elapsed * 1e9 / (2 * n));
+    if (elapsed > 0)
+        g_test_message("%.0f switches/s", 2 * n / elapsed);
+}
+
 int main(int argc, char* argv[])
 {
     g_test_init(&argc, &argv, NULL);
@@ -131,6 +198,10 @@ int main(int argc, char* argv[])
     g_test_add_func("/coroutine/simple", test_coroutine_simple);
     g_test_add_func("/coroutine/two", test_coroutine_two);
     g_test_add_func("/coroutine/yield", test_coroutine_yield);
+#if WITH_UCONTEXT
+    g_test_add_func("/coroutine/stack-pool", test_coroutine_stack_pool);
+#endif
+    g_test_add_func("/coroutine/switch-rate", test_coroutine_switch_rate);
 
     return g_test_run ();
 }
@@ -0,0 +1,408 @@
+#include "config.h"
+
+#include <glib.h>
+#include <string.h>
+
+#ifdef HAVE_LINUX_UDMABUF_H
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/udmabuf.h>
+#include <libdrm/drm_fourcc.h>
+#endif
+
+#define EGL_EGLEXT_PROTOTYPES
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES3/gl3.h>
+
+#include "spice-egl-primary.h"
+#include "spice-egl-scanout.h"
+
+/* Runs on any EGL implementation able to create a surfaceless GLES 3
+ * context, such as Mesa llvmpipe (LIBGL_ALWAYS_SOFTWARE=1); the GL
+ * tests are skipped otherwise. The scanout test also needs dma-buf
+ * import and /dev/udmabuf. */
+
+#define WIDTH 64
+#define HEIGHT 48
+
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static GLuint program, fbo, fbo_tex;
+
+static const char *vertex_src =
+    "#version 300 es\n"
+    "in vec2 pos;\n"
+    "out vec2 tc;\n"
+    "void main() {\n"
+    "  tc = pos * 0.5 + 0.5;\n"
+    "  gl_Position = vec4(pos, 0.0, 1.0);\n"
+    "}\n";
+
+static const char *fragment_src =
+    "#version 300 es\n"
+    "precision mediump float;\n"
+    "in vec2 tc;\n"
+    "uniform sampler2D samp;\n"
+    "out vec4 color;\n"
+    "void main() {\n"
+    "  color = texture(samp, tc);\n"
+    "}\n";
+
+static GLuint compile(GLenum type, const char *src)
+{
+    GLuint shader = glCreateShader(type);
+    GLint status;
+
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    g_assert(status);
+
+    return shader;
+}
+
+static gboolean gl_init(void)
+{
+    static const EGLint conf_attrs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT_KHR,
+        EGL_SURFACE_TYPE, 0,
+        EGL_NONE
+    };
+    static const EGLint ctx_attrs[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 3,
+        EGL_NONE
+    };
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+    EGLConfig conf;
+    EGLContext ctx;
+    EGLint n;
+    GLint status;
+
+    get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+        eglGetProcAddress("eglGetPlatformDisplayEXT");
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    if (get_platform_display != NULL)
+        egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                           EGL_DEFAULT_DISPLAY, NULL);
+#endif
+    if (egl_display == EGL_NO_DISPLAY)
+        egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (egl_display == EGL_NO_DISPLAY ||
+        !eglInitialize(egl_display, NULL, NULL) ||
+        !eglBindAPI(EGL_OPENGL_ES_API) ||
+        !eglChooseConfig(egl_display, conf_attrs, &conf, 1, &n) || n != 1)
+        return FALSE;
+
+    ctx = eglCreateContext(egl_display, conf, EGL_NO_CONTEXT, ctx_attrs);
+    if (ctx == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx))
+        return FALSE;
+
+    program = glCreateProgram();
+    glAttachShader(program, compile(GL_VERTEX_SHADER, vertex_src));
+    glAttachShader(program, compile(GL_FRAGMENT_SHADER, fragment_src));
+    glBindAttribLocation(program, 0, "pos");
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    g_assert(status);
+
+    glGenTextures(1, &fbo_tex);
+    glBindTexture(GL_TEXTURE_2D, fbo_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, WIDTH, HEIGHT, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, fbo_tex, 0);
+    g_assert_cmphex(glCheckFramebufferStatus(GL_FRAMEBUFFER), ==,
+                    GL_FRAMEBUFFER_COMPLETE);
+    glViewport(0, 0, WIDTH, HEIGHT);
+
+    return TRUE;
+}
+
+/* sample the whole texture, so that the swizzle applies, row y of the
+ * result being row y of the surface */
+static void render(GLuint tex, guint8 *rgba)
+{
+    static const GLfloat quad[] = { -1, -1, 1, -1, -1, 1, 1, 1 };
+
+    glUseProgram(program);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, quad);
+    glEnableVertexAttribArray(0);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glDisableVertexAttribArray(0);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    g_assert_cmphex(glGetError(), ==, GL_NO_ERROR);
+}
+
+static guint32 pixel(gint x, gint y, gint seed)
+{
+    /* x8r8g8b8, with garbage in the unused byte */
+    return 0x5a000000 | ((x * 4 + seed) & 0xff) << 16 |
+        ((y * 5 + seed) & 0xff) << 8 | ((x + y) & 0xff);
+}
+
+static void check_pixel(const guint8 *rgba, gint x, gint y, guint32 expected)
+{
+    const guint8 *p = rgba + (y * WIDTH + x) * 4;
+
+    g_assert_cmpuint(p[0], ==, (expected >> 16) & 0xff);
+    g_assert_cmpuint(p[1], ==, (expected >> 8) & 0xff);
+    g_assert_cmpuint(p[2], ==, expected & 0xff);
+    g_assert_cmpuint(p[3], ==, 0xff);
+}
+
+static void test_primary_upload(void)
+{
+    SpiceEglPrimary primary = { 0, };
+    guint32 *data = g_new(guint32, WIDTH * HEIGHT);
+    guint8 *rgba = g_malloc(WIDTH * HEIGHT * 4);
+    SpiceEglRect r1 = { 10, 5, 8, 6 };
+    SpiceEglRect r2 = { 40, 30, 4, 4 };
+    gint x, y;
+
+    for (y = 0; y < HEIGHT; y++)
+        for (x = 0; x < WIDTH; x++)
+            data[y * WIDTH + x] = pixel(x, y, 0);
+
+    spice_egl_primary_resize(&primary, WIDTH, HEIGHT);
+    g_assert_cmpint(primary.n_damage, ==, 1);
+    g_assert(spice_egl_primary_upload(&primary, (guint8 *)data, WIDTH * 4));
+    g_assert_cmpint(primary.n_damage, ==, 0);
+    render(primary.tex, rgba);
+    for (y = 0; y < HEIGHT; y++)
+        for (x = 0; x < WIDTH; x++)
+            check_pixel(rgba, x, y, pixel(x, y, 0));
+
+    /* everything changes, only the damaged rectangles are uploaded */
+    for (y = 0; y < HEIGHT; y++)
+        for (x = 0; x < WIDTH; x++)
+            data[y * WIDTH + x] = pixel(x, y, 1);
+    spice_egl_primary_invalidate(&primary, &r1);
+    spice_egl_primary_invalidate(&primary, &r2);
+    g_assert_cmpint(primary.n_damage, ==, 2);
+    g_assert(spice_egl_primary_upload(&primary, (guint8 *)data, WIDTH * 4));
+    render(primary.tex, rgba);
+    for (y = 0; y < HEIGHT; y++) {
+        for (x = 0; x < WIDTH; x++) {
+            gboolean in = (x >= r1.x && x < r1.x + r1.width &&
+                           y >= r1.y && y < r1.y + r1.height) ||
+                (x >= r2.x && x < r2.x + r2.width &&
+                 y >= r2.y && y < r2.y + r2.height);
+
+            check_pixel(rgba, x, y, pixel(x, y, in ? 1 : 0));
+        }
+    }
+
+    /* a stride larger than the surface, as for a monitor area */
+    g_free(data);
+    data = g_new(guint32, (WIDTH + 16) * HEIGHT);
+    for (y = 0; y < HEIGHT; y++)
+        for (x = 0; x < WIDTH + 16; x++)
+            data[y * (WIDTH + 16) + x] = pixel(x, y, 2);
+    spice_egl_primary_resize(&primary, WIDTH, HEIGHT);
+    g_assert(spice_egl_primary_upload(&primary, (guint8 *)(data + 16),
+                                      (WIDTH + 16) * 4));
+    render(primary.tex, rgba);
+    for (y = 0; y < HEIGHT; y++)
+        for (x = 0; x < WIDTH; x++)
+            check_pixel(rgba, x, y, pixel(x + 16, y, 2));
+
+    spice_egl_primary_clear(&primary);
+    g_assert_cmpuint(primary.tex, ==, 0);
+    g_free(data);
+    g_free(rgba);
+}
+
+static void test_primary_damage(void)
+{
+    SpiceEglPrimary primary = { 0, };
+    SpiceEglRect r;
+    gint i;
+
+    /* no GL needed, the texture isn't touched */
+    primary.width = 100;
+    primary.height = 100;
+
+    /* adjacent rectangles are merged */
+    r = (SpiceEglRect){ 0, 0, 10, 10 };
+    spice_egl_primary_invalidate(&primary, &r);
+    r = (SpiceEglRect){ 10, 0, 10, 10 };
+    spice_egl_primary_invalidate(&primary, &r);
+    g_assert_cmpint(primary.n_damage, ==, 1);
+    g_assert_cmpint(primary.damage[0].width, ==, 20);
+    g_assert_cmpint(primary.damage[0].height, ==, 10);
+
+    /* clipped to the surface */
+    primary.n_damage = 0;
+    r = (SpiceEglRect){ -5, 95, 10, 10 };
+    spice_egl_primary_invalidate(&primary, &r);
+    g_assert_cmpint(primary.n_damage, ==, 1);
+    g_assert_cmpint(primary.damage[0].x, ==, 0);
+    g_assert_cmpint(primary.damage[0].y, ==, 95);
+    g_assert_cmpint(primary.damage[0].width, ==, 5);
+    g_assert_cmpint(primary.damage[0].height, ==, 5);
+    r = (SpiceEglRect){ 200, 0, 10, 10 };
+    spice_egl_primary_invalidate(&primary, &r);
+    g_assert_cmpint(primary.n_damage, ==, 1);
+
+    /* too fragmented, collapsed to the bounding box */
+    primary.n_damage = 0;
+    for (i = 0; i < SPICE_EGL_PRIMARY_MAX_DAMAGE + 1; i++) {
+        r = (SpiceEglRect){ (i % 5) * 20, (i / 5) * 20, 1, 1 };
+        spice_egl_primary_invalidate(&primary, &r);
+    }
+    g_assert_cmpint(primary.n_damage, ==, 1);
+    g_assert_cmpint(primary.damage[0].x, ==, 0);
+    g_assert_cmpint(primary.damage[0].y, ==, 0);
+    g_assert_cmpint(primary.damage[0].width, ==, 81);
+    g_assert_cmpint(primary.damage[0].height, ==, 61);
+}
+
+#ifdef HAVE_LINUX_UDMABUF_H
+/* a dma-buf backed by a memfd, so that no GPU is needed to import it */
+static gint udmabuf_new(gint seed)
+{
+    struct udmabuf_create create = { 0, };
+    gsize size = WIDTH * HEIGHT * 4;
+    guint32 *data;
+    gint dev, memfd, fd, x, y;
+
+    memfd = memfd_create("spice-test", MFD_ALLOW_SEALING);
+    g_assert_cmpint(memfd, >=, 0);
+    g_assert_cmpint(ftruncate(memfd, size), ==, 0);
+    g_assert_cmpint(fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK), ==, 0);
+
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    g_assert(data != MAP_FAILED);
+    for (y = 0; y < HEIGHT; y++)
+        for (x = 0; x < WIDTH; x++)
+            data[y * WIDTH + x] = pixel(x, y, seed);
+    munmap(data, size);
+
+    dev = open("/dev/udmabuf", O_RDWR);
+    g_assert_cmpint(dev, >=, 0);
+    create.memfd = memfd;
+    create.flags = UDMABUF_FLAGS_CLOEXEC;
+    create.size = size;
+    fd = ioctl(dev, UDMABUF_CREATE, &create);
+    g_assert_cmpint(fd, >=, 0);
+    close(dev);
+    close(memfd);
+
+    return fd;
+}
+
+static gboolean scanout_supported(void)
+{
+    const char *exts = eglQueryString(egl_display, EGL_EXTENSIONS);
+
+    return exts != NULL && strstr(exts, "EGL_EXT_image_dma_buf_import") &&
+        access("/dev/udmabuf", R_OK | W_OK) == 0;
+}
+
+static void check_scanout(SpiceEglScanout *scanout, guint8 *rgba, gint seed)
+{
+    gint x, y;
+
+    g_assert(scanout->current != NULL);
+    render(scanout->current->tex, rgba);
+    for (y = 0; y < HEIGHT; y++)
+        for (x = 0; x < WIDTH; x++)
+            check_pixel(rgba, x, y, pixel(x, y, seed));
+}
+
+static gboolean scanout_import(SpiceEglScanout *scanout, gint fd)
+{
+    return spice_egl_scanout_import(scanout, egl_display, fd,
+                                    WIDTH, HEIGHT, WIDTH * 4,
+                                    DRM_FORMAT_XRGB8888);
+}
+
+static void test_scanout_import(void)
+{
+    SpiceEglScanout scanout;
+    SpiceEglScanoutImage *first, *second;
+    guint8 *rgba = g_malloc(WIDTH * HEIGHT * 4);
+    EGLImageKHR image;
+    gint fd[2], resent, i;
+
+    spice_egl_scanout_init(&scanout);
+
+    fd[0] = udmabuf_new(0);
+    g_assert(scanout_import(&scanout, fd[0]));
+    check_scanout(&scanout, rgba, 0);
+    first = scanout.current;
+    image = first->image;
+
+    fd[1] = udmabuf_new(1);
+    g_assert(scanout_import(&scanout, fd[1]));
+    check_scanout(&scanout, rgba, 1);
+    second = scanout.current;
+    g_assert(second != first);
+
+    /* the first buffer is re-sent with a new fd, as the server does
+     * when the guest flips back to it: it is not imported again */
+    resent = dup(fd[0]);
+    close(fd[0]);
+    g_assert(scanout_import(&scanout, resent));
+    g_assert(scanout.current == first);
+    g_assert(first->image == image);
+    check_scanout(&scanout, rgba, 0);
+
+    /* a new buffer behind the same fd number: the cache holds its own
+     * fd of the old one, so the inode can't be reused */
+    fd[0] = udmabuf_new(2);
+    g_assert_cmpint(dup2(fd[0], resent), ==, resent);
+    close(fd[0]);
+    g_assert(scanout_import(&scanout, resent));
+    g_assert(scanout.current != first && scanout.current != second);
+    check_scanout(&scanout, rgba, 2);
+
+    /* the least recently used buffer is evicted */
+    fd[0] = udmabuf_new(3);
+    g_assert(scanout_import(&scanout, fd[0]));
+    g_assert(scanout.current == second);
+    check_scanout(&scanout, rgba, 3);
+
+    spice_egl_scanout_clear(&scanout, egl_display);
+    g_assert(scanout.current == NULL);
+    for (i = 0; i < SPICE_EGL_SCANOUT_CACHE_SIZE; i++) {
+        g_assert(scanout.images[i].image == NULL);
+        g_assert_cmpuint(scanout.images[i].tex, ==, 0);
+        g_assert_cmpint(scanout.images[i].fd, ==, -1);
+    }
+    close(fd[0]);
+    close(fd[1]);
+    close(resent);
+    g_free(rgba);
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/egl/primary/damage", test_primary_damage);
+    if (gl_init()) {
+        g_test_add_func("/egl/primary/upload", test_primary_upload);
+#ifdef HAVE_LINUX_UDMABUF_H
+        if (scanout_supported())
+            g_test_add_func("/egl/scanout/import", test_scanout_import);
+        else
+            g_printerr("no udmabuf or dma-buf import, skipping the scanout test\n");
+#endif
+    } else {
+        g_printerr("no surfaceless GLES 3 context, skipping the GL tests\n");
+    }
+
+    return g_test_run();
+}
@@ -1,6 +1,7 @@
 #include <glib.h>
 
 #include "spice-session.h"
+#include "spice-mm-clock.h"
 
 static void test_session_uri(void)
 {
@@ -64,11 +65,53 @@ static void test_session_uri(void)
     }
 }
 
+static void test_session_mm_clock(void)
+{
+    SpiceMmClock *clock = spice_mm_clock_new();
+    gint64 now = 1000000;
+    guint32 time, last;
+
+    g_assert_cmpuint(spice_mm_clock_get_time(clock, now), ==, 0);
+    g_assert(!spice_mm_clock_update(clock, SPICE_MM_CLOCK_SERVER, 5000, now));
+    now += 100000;
+    g_assert_cmpuint(spice_mm_clock_get_time(clock, now), ==, 5100);
+
+    /* a small step backwards is slewed, the clock never goes back */
+    g_assert(!spice_mm_clock_update(clock, SPICE_MM_CLOCK_AUDIO, 5050, now));
+    last = spice_mm_clock_get_time(clock, now);
+    g_assert_cmpuint(last, ==, 5100);
+    for (; now < 6000000; now += 10000) {
+        time = spice_mm_clock_get_time(clock, now);
+        g_assert_cmpuint(time, >=, last);
+        last = time;
+        if (now % 100000 == 0)
+            spice_mm_clock_update(clock, SPICE_MM_CLOCK_AUDIO,
+                                  5050 + (now - 1100000) / 1000, now);
+    }
+    last = spice_mm_clock_get_time(clock, now);
+    g_assert_cmpint(ABS((gint32)(last - (5050 + (now - 1100000) / 1000))), <=, 5);
+    g_assert_cmpint(spice_mm_clock_get_av_offset(clock), >=, 0);
+    g_assert_cmpint(spice_mm_clock_get_av_offset(clock), <=, 10);
+
+    /* audio is the reference while it plays */
+    g_assert(!spice_mm_clock_update(clock, SPICE_MM_CLOCK_SERVER, last + 200, now));
+    g_assert_cmpuint(spice_mm_clock_get_time(clock, now), ==, last);
+
+    /* large jumps reset the clock */
+    g_assert(spice_mm_clock_update(clock, SPICE_MM_CLOCK_SERVER, last + 1000, now));
+    g_assert_cmpuint(spice_mm_clock_get_time(clock, now), ==, last + 1000);
+    g_assert(spice_mm_clock_update(clock, SPICE_MM_CLOCK_SERVER, 1000, now));
+    g_assert_cmpuint(spice_mm_clock_get_time(clock, now), ==, 1000);
+
+    spice_mm_clock_free(clock);
+}
+
 int main(int argc, char* argv[])
 {
     g_test_init(&argc, &argv, NULL);
 
     g_test_add_func("/session/uri", test_session_uri);
+    g_test_add_func("/session/mm-clock", test_session_mm_clock);
 
     return g_test_run();
 }